@@ -0,0 +1,203 @@
+#pragma once
+
+// Baked assets
+// The archive is produced offline by AssetBaker.cpp and packs every model, light file and texture
+// in a single file, already converted to the layout the application uploads to the GPU:
+//
+//   AssetArchiveHeader
+//   AssetArchiveEntry[entryCount]     <- table of contents
+//   blobs                             <- 16-byte aligned, referenced by the entries
+//
+// A mesh blob contains the vertices (already in the Vert layout), the uint32 indices and the lights.
+// A texture blob contains a DDS file with the whole mip chain, block compressed (BC1 or BC7).
+// At runtime the archive is memory mapped, and loaders copy directly from the mapping.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include "MappedFile.hpp"
+
+#define ASSET_ARCHIVE_DEFAULT_PATH "assets.pak"
+#define ASSET_ARCHIVE_MAGIC 0x4B415050u // "PPAK"
+#define ASSET_ARCHIVE_VERSION 2u
+#define ASSET_ARCHIVE_NAME_LEN 112
+#define ASSET_ARCHIVE_ALIGNMENT 16
+
+enum AssetArchiveEntryType : uint32_t { ARCHIVE_MESH = 1, ARCHIVE_TEXTURE = 2 };
+
+struct AssetArchiveHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+struct AssetArchiveEntry {
+    char name[ASSET_ARCHIVE_NAME_LEN];  // source path, e.g. "models/furniture/closet_003_Mesh.055.mgcg"
+    uint32_t type;                      // AssetArchiveEntryType
+    uint32_t layoutKey;                 // meshes: key of the vertex layout it was baked for
+    uint64_t sourceStamp;               // size and modification time of the sources, to detect stale bakes
+    uint64_t offset;                    // start of the blob from the beginning of the archive
+    uint64_t size;                      // size of the blob
+
+    // Meshes
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t lightCount;
+    float minCoords[3];
+    float maxCoords[3];
+
+    // Textures
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;                  // channels of the source image
+    uint32_t reserved;
+};
+
+// Light parameters, stored without the glm alignment so that the file does not depend on it
+struct AssetArchiveLight {
+    float position[3];
+    float lightColor[3];
+    uint32_t type;
+    float g;
+    float beta;
+    float cosout;
+    float cosin;
+    float direction[3];
+};
+
+// Combines size and modification time of the given files (missing files are skipped)
+inline uint64_t assetSourceStamp(const std::vector<std::string> &files) {
+    uint64_t h = 1469598103934665603ull;
+    for (const auto &f: files) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(f, ec);
+        if (ec) continue;
+        auto time = std::filesystem::last_write_time(f, ec);
+        if (ec) continue;
+        uint64_t v[2] = {static_cast<uint64_t>(size), static_cast<uint64_t>(time.time_since_epoch().count())};
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(v);
+        for (size_t i = 0; i < sizeof(v); i++) {
+            h = (h ^ p[i]) * 1099511628211ull;
+        }
+    }
+    return h;
+}
+
+inline std::string assetArchiveName(const std::string &file) {
+    std::string name = file;
+    for (auto &c: name) {
+        if (c == '\\') c = '/';
+    }
+    return name;
+}
+
+
+// Read side: maps the whole file and looks up entries in the table of contents
+struct AssetArchive {
+    const char *base = nullptr;
+    size_t length = 0;
+    const AssetArchiveEntry *entries = nullptr;
+    uint32_t entryCount = 0;
+    MappedFile mapping;
+
+    bool open(const std::string &path) {
+        if (!mapping.open(path)) return false;
+        base = mapping.data;
+        length = mapping.size;
+
+        const auto *header = reinterpret_cast<const AssetArchiveHeader *>(base);
+        if (length < sizeof(AssetArchiveHeader) || header->magic != ASSET_ARCHIVE_MAGIC ||
+            header->version != ASSET_ARCHIVE_VERSION ||
+            length < sizeof(AssetArchiveHeader) + header->entryCount * sizeof(AssetArchiveEntry)) {
+            std::cout << "Asset archive " << path << " is not valid, ignoring it\n";
+            close();
+            return false;
+        }
+        entryCount = header->entryCount;
+        entries = reinterpret_cast<const AssetArchiveEntry *>(base + sizeof(AssetArchiveHeader));
+        std::cout << "Asset archive " << path << ": " << entryCount << " entries, " << length << " B\n";
+        return true;
+    }
+
+    void close() {
+        mapping.close();
+        base = nullptr;
+        length = 0;
+        entries = nullptr;
+        entryCount = 0;
+    }
+
+    bool isOpen() const { return base != nullptr; }
+
+    // Returns nullptr if the asset is not in the archive, or if its sources changed after the bake
+    const AssetArchiveEntry *find(const std::string &file, AssetArchiveEntryType type, uint32_t layoutKey,
+                                  const std::vector<std::string> &sources) const {
+        if (!isOpen()) return nullptr;
+        std::string name = assetArchiveName(file);
+        for (uint32_t i = 0; i < entryCount; i++) {
+            const AssetArchiveEntry &E = entries[i];
+            if (E.type != type || E.layoutKey != layoutKey || strncmp(E.name, name.c_str(), ASSET_ARCHIVE_NAME_LEN) != 0)
+                continue;
+            if (E.offset + E.size > length) return nullptr;
+            if (E.sourceStamp != assetSourceStamp(sources)) {
+                std::cout << "Asset archive: " << name << " changed since it was baked, loading the source\n";
+                return nullptr;
+            }
+            return &E;
+        }
+        return nullptr;
+    }
+
+    const char *data(const AssetArchiveEntry &E) const { return base + E.offset; }
+};
+
+
+// Write side, used by the baker
+struct AssetArchiveWriter {
+    std::vector<AssetArchiveEntry> entries;
+    std::vector<std::vector<char>> blobs;
+
+    AssetArchiveEntry &add(const std::string &file, AssetArchiveEntryType type, std::vector<char> blob) {
+        std::string name = assetArchiveName(file);
+        if (name.size() >= ASSET_ARCHIVE_NAME_LEN) {
+            throw std::runtime_error("asset name too long for the archive: " + name);
+        }
+        AssetArchiveEntry E{};
+        strncpy(E.name, name.c_str(), ASSET_ARCHIVE_NAME_LEN - 1);
+        E.type = type;
+        E.size = blob.size();
+        entries.push_back(E);
+        blobs.push_back(std::move(blob));
+        return entries.back();
+    }
+
+    void write(const std::string &path) {
+        uint64_t offset = sizeof(AssetArchiveHeader) + entries.size() * sizeof(AssetArchiveEntry);
+        for (size_t i = 0; i < entries.size(); i++) {
+            offset = (offset + ASSET_ARCHIVE_ALIGNMENT - 1) & ~static_cast<uint64_t>(ASSET_ARCHIVE_ALIGNMENT - 1);
+            entries[i].offset = offset;
+            offset += entries[i].size;
+        }
+
+        std::ofstream out(path, std::ios_base::binary);
+        if (!out.is_open()) {
+            throw std::runtime_error("failed to open " + path + " for writing!");
+        }
+        AssetArchiveHeader header{ASSET_ARCHIVE_MAGIC, ASSET_ARCHIVE_VERSION, static_cast<uint32_t>(entries.size()), 0};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(AssetArchiveEntry));
+        for (size_t i = 0; i < entries.size(); i++) {
+            static const char zeros[ASSET_ARCHIVE_ALIGNMENT] = {};
+            out.write(zeros, entries[i].offset - static_cast<uint64_t>(out.tellp()));
+            out.write(blobs[i].data(), blobs[i].size());
+        }
+        std::cout << "Written " << path << ": " << entries.size() << " entries, " << offset << " B\n";
+    }
+};
@@ -0,0 +1,509 @@
+// Offline asset baker.
+// Converts models/ (with their lights/ files) and textures/ into the archive that BaseProject maps at startup,
+// so that the application does not have to decrypt, inflate, parse and decode every asset at each launch.
+//
+// It must be built with the same compiler, flags and include paths of the application (the vertex
+// layouts are stored as they are in memory), and run from the project directory:
+//     AssetBaker [output file, default assets.pak]
+//     AssetBaker --bench-mgcg [directory, default models/furniture]
+//     AssetBaker --bench-obj [file, default models/character/character.obj] [synthetic OBJ size in MB, default 256]
+//     AssetBaker --bench-vertices [synthetic OBJ size in MB, default 64]
+//     AssetBaker --bench-cull [boxes, default 100000]
+//     AssetBaker --bench-transforms [objects, default 1000, 10000 and 100000]
+//     AssetBaker --dds [directory, default textures]
+// Re-run it whenever a model, a light file or a texture changes: stale entries are detected and
+// ignored at runtime, so the application falls back to the sources for them.
+// --dds writes the block compressed version of every image next to it (same name, .dds extension): the
+// files can be passed to Texture::init instead of the sources, or inspected with any DDS viewer.
+
+#include <string>
+#include <string_view>
+#include <iostream>
+#include <filesystem>
+#include <random>
+#include "Starter.hpp"
+#include "Vertex.h"
+
+namespace fs = std::filesystem;
+
+// Sorted, so that two bakes of the same assets produce the same archive
+std::vector<std::string> listFiles(const std::string &path, const std::vector<std::string> &extensions) {
+    std::vector<std::string> files;
+    for (const auto &entry: fs::recursive_directory_iterator(path)) {
+        if (!entry.is_regular_file())
+            continue;
+        std::string ext = entry.path().extension().string();
+        if (std::find(extensions.begin(), extensions.end(), ext) != extensions.end())
+            files.push_back(entry.path().generic_string());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Throughput of the MGCG decoding (decrypt + inflate, file reads excluded): the plusaes + sinflate
+// path the loader used before, against MGCGDecoder with and without AES-NI
+int benchMGCG(const std::string &path) {
+    std::vector<std::vector<char>> sources;
+    size_t total = 0;
+    for (const auto &file: listFiles(path, {".mgcg"})) {
+        sources.push_back(readFile(file));
+        total += sources.back().size();
+    }
+    if (sources.empty()) {
+        std::cerr << "No .mgcg file in " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << sources.size() << " files, " << total << " B, " << JobSystem::shared().threadCount() << " threads\n";
+
+    auto measure = [&](const char *name, const std::function<size_t(const std::vector<char> &)> &decode) {
+        const int runs = 5;
+        size_t out = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < runs; r++) {
+            for (const auto &src: sources) {
+                out += decode(src);
+            }
+        }
+        float s = std::chrono::duration<float, std::chrono::seconds::period>(
+                std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << name << ": " << (static_cast<float>(total) * runs / (1024.0f * 1024.0f)) / s << " MB/s ("
+                  << out / runs << " B decoded)\n";
+    };
+
+    measure("plusaes + sinflate", [](const std::vector<char> &src) {
+        const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128");
+        const unsigned char iv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                      0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+        unsigned long padded_size = 0;
+        std::vector<unsigned char> decrypted(src.size());
+        plusaes::decrypt_cbc((const unsigned char *) src.data(), src.size(), &key[0], key.size(), &iv,
+                             &decrypted[0], decrypted.size(), &padded_size);
+        int size = 0;
+        sscanf(reinterpret_cast<const char *>(&decrypted[0]), "%d", &size);
+        void *decomp = calloc(size, 1);
+        int n = sinflate(decomp, size, &decrypted[16], static_cast<int>(decrypted.size()) - 16);
+        free(decomp);
+        return static_cast<size_t>(n);
+    });
+
+    MGCGDecoder portable("CG2023SkelKey128", false);
+    measure("MGCGDecoder, portable", [&](const std::vector<char> &src) {
+        std::vector<char> data = src;
+        return portable.decode(data).size();
+    });
+    if (MGCGDecoder::shared().usesAESNI()) {
+        measure("MGCGDecoder, AES-NI", [](const std::vector<char> &src) {
+            std::vector<char> data = src;
+            return MGCGDecoder::shared().decode(data).size();
+        });
+    }
+    return EXIT_SUCCESS;
+}
+
+// A grid of quads with positions, normals and texture coordinates, about sizeMB long
+std::string syntheticOBJ(size_t sizeMB) {
+    std::string obj;
+    obj.reserve(sizeMB << 20);
+    size_t side = 1;
+    while (side * side * 184 < (sizeMB << 20)) side++;
+    char line[128];
+    for (size_t i = 0; i < side; i++) {
+        for (size_t j = 0; j < side; j++) {
+            float x = static_cast<float>(i) * 0.125f, z = static_cast<float>(j) * 0.125f;
+            obj.append(line, snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvn 0.000000 1.000000 0.000000\nvt %.6f %.6f\n",
+                                      x, std::sin(x) * std::cos(z), z, x / side, z / side));
+        }
+    }
+    for (size_t i = 0; i + 1 < side; i++) {
+        for (size_t j = 0; j + 1 < side; j++) {
+            size_t a = i * side + j + 1, b = a + 1, c = a + side + 1, d = a + side;
+            obj.append(line, snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+                                      a, a, a, b, b, b, c, c, c, d, d, d));
+        }
+    }
+    return obj;
+}
+
+// OBJ parsing time with an increasing number of threads
+int benchOBJ(const std::string &file, size_t sizeMB) {
+    MappedFile F;
+    if (!F.open(file)) {
+        std::cerr << "Cannot open " << file << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string synthetic = syntheticOBJ(sizeMB);
+    std::vector<unsigned> threadCounts;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < cores; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(cores);
+    for (const auto &input: {std::make_pair(file, std::string_view(F.data, F.size)),
+                             std::make_pair(std::string("synthetic"), std::string_view(synthetic))}) {
+        std::cout << input.first << ": " << input.second.size() << " B\n";
+        float single = 0.0f;
+        for (unsigned threads: threadCounts) {
+            JobSystem jobs(threads - 1);
+            OBJData obj;
+            auto start = std::chrono::high_resolution_clock::now();
+            OBJParser::parse(input.second.data(), input.second.size(), obj, jobs);
+            float s = std::chrono::duration<float, std::chrono::seconds::period>(
+                    std::chrono::high_resolution_clock::now() - start).count();
+            if (threads == 1) single = s;
+            std::cout << "  " << threads << " threads: " << s * 1000.0f << " ms, "
+                      << input.second.size() / (1024.0f * 1024.0f) / s << " MB/s, speedup " << single / s
+                      << ", " << obj.corners.size() / 3 << " triangles\n";
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// The OBJ to vertex conversion as it was before VertexTraits: attribute tests and offsets read from the
+// descriptor for every vertex
+template <class Vert>
+void buildWithDescriptor(const OBJData &obj, const VertexDescriptor &VD, std::vector<Vert> &vertices,
+                         std::vector<uint32_t> &indices) {
+    vertices.resize(obj.corners.size());
+    indices.resize(obj.corners.size());
+    JobSystem::shared().parallelFor(obj.corners.size(), OBJ_MIN_CHUNK_SIZE / 16, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const OBJCorner &index = obj.corners[i];
+            Vert vertex{};
+            if (VD.Position.hasIt) {
+                *(glm::vec3 *) ((char *) (&vertex) + VD.Position.offset) = glm::vec3(
+                        obj.positions[3 * index.v + 0], obj.positions[3 * index.v + 1], obj.positions[3 * index.v + 2]);
+            }
+            if (VD.Color.hasIt) {
+                *(glm::vec3 *) ((char *) (&vertex) + VD.Color.offset) = glm::vec3(
+                        obj.colors[3 * index.v + 0], obj.colors[3 * index.v + 1], obj.colors[3 * index.v + 2]);
+            }
+            if (VD.UV.hasIt && (index.vt >= 0)) {
+                *(glm::vec2 *) ((char *) (&vertex) + VD.UV.offset) = glm::vec2(
+                        obj.texCoords[2 * index.vt + 0], 1 - obj.texCoords[2 * index.vt + 1]);
+            }
+            if (VD.Normal.hasIt && (index.vn >= 0)) {
+                *(glm::vec3 *) ((char *) (&vertex) + VD.Normal.offset) = glm::vec3(
+                        obj.normals[3 * index.vn + 0], obj.normals[3 * index.vn + 1], obj.normals[3 * index.vn + 2]);
+            }
+            vertices[i] = vertex;
+            indices[i] = static_cast<uint32_t>(i);
+        }
+    });
+}
+
+// Returns whether both conversions give the same indices and the same attributes (compared through VertexTraits,
+// as the padding of the vertices is left uninitialized)
+template <class Vert>
+bool benchVertexType(const char *name, const OBJData &obj, const VertexDescriptor &VD) {
+    const int runs = 5;
+    float descriptor = std::numeric_limits<float>::max(), traits = std::numeric_limits<float>::max();
+    std::vector<Vert> reference;
+    std::vector<uint32_t> referenceIndices;
+    Model<Vert> M;
+    for (int r = 0; r < runs; r++) {
+        reference.clear();
+        referenceIndices.clear();
+        auto start = std::chrono::high_resolution_clock::now();
+        buildWithDescriptor(obj, VD, reference, referenceIndices);
+        auto middle = std::chrono::high_resolution_clock::now();
+        M.vertices.clear();
+        M.indices.clear();
+        M.buildFromOBJ(obj);
+        auto stop = std::chrono::high_resolution_clock::now();
+        descriptor = std::min(descriptor, std::chrono::duration<float, std::chrono::seconds::period>(middle - start).count());
+        traits = std::min(traits, std::chrono::duration<float, std::chrono::seconds::period>(stop - middle).count());
+    }
+    bool same = (reference.size() == M.vertices.size()) && (referenceIndices == M.indices);
+    constexpr size_t keySize = meshVertexKeySize<Vert>();
+    unsigned char referenceKey[keySize], key[keySize];
+    for (size_t v = 0; same && (v < reference.size()); v++) {
+        meshVertexKey(reference[v], referenceKey);
+        meshVertexKey(M.vertices[v], key);
+        same = (memcmp(referenceKey, key, keySize) == 0);
+    }
+    std::cout << name << " (" << sizeof(Vert) << " B): descriptor " << obj.corners.size() / descriptor / 1e6f
+              << " Mvertices/s, traits " << obj.corners.size() / traits / 1e6f << " Mvertices/s, speedup "
+              << descriptor / traits << (same ? "" : ", OUTPUT DIFFERS") << "\n";
+    return same;
+}
+
+// OBJ to vertex conversion speed, per vertex type, on an already parsed synthetic OBJ
+int benchVertices(size_t sizeMB) {
+    std::string synthetic = syntheticOBJ(sizeMB);
+    OBJData obj;
+    OBJParser::parse(synthetic.data(), synthetic.size(), obj);
+    std::cout << "synthetic: " << obj.corners.size() << " corners\n";
+
+    VertexDescriptor VMesh, VVertexWithColor, VMeshTexID;
+    VMesh.init(nullptr, {
+            {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX}
+    }, {
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos),  sizeof(glm::vec3), POSITION},
+            {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, norm), sizeof(glm::vec3), NORMAL},
+            {0, 2, VK_FORMAT_R32G32_SFLOAT,    offsetof(Vertex, UV),   sizeof(glm::vec2), UV},
+    });
+    VVertexWithColor.init(nullptr, {
+            {0, sizeof(VertexVColor), VK_VERTEX_INPUT_RATE_VERTEX}
+    }, {
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexVColor, pos),   sizeof(glm::vec3), POSITION},
+            {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexVColor, norm),  sizeof(glm::vec3), NORMAL},
+            {0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexVColor, color), sizeof(glm::vec3), COLOR}
+    });
+    VMeshTexID.init(nullptr, {
+            {0, sizeof(VertexWithTextID), VK_VERTEX_INPUT_RATE_VERTEX}
+    }, {
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexWithTextID, pos),   sizeof(glm::vec3), POSITION},
+            {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexWithTextID, norm),  sizeof(glm::vec3), NORMAL},
+            {0, 2, VK_FORMAT_R32G32_SFLOAT,    offsetof(VertexWithTextID, UV),    sizeof(glm::vec2), UV},
+            {0, 3, VK_FORMAT_R8_UINT,          offsetof(VertexWithTextID, texID), sizeof(uint8_t),   OTHER}
+    });
+
+    bool same = benchVertexType<Vertex>("Vertex", obj, VMesh);
+    same = benchVertexType<VertexVColor>("VertexVColor", obj, VVertexWithColor) && same;
+    same = benchVertexType<VertexWithTextID>("VertexWithTextID", obj, VMeshTexID) && same;
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Frustum culling of random boxes around the camera: CullingBoxes (8 boxes at a time) against a loop of
+// frustumContainsBounds on the same boxes
+int benchCull(size_t boxCount) {
+    const int runs = 20;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f), size(0.1f, 3.0f);
+    std::vector<glm::vec3> minCoords(boxCount), maxCoords(boxCount);
+    CullingBoxes boxes;
+    boxes.resize(boxCount);
+    for (size_t i = 0; i < boxCount; i++) {
+        minCoords[i] = glm::vec3(position(rng), position(rng), position(rng));
+        maxCoords[i] = minCoords[i] + glm::vec3(size(rng), size(rng), size(rng));
+        boxes.set(i, minCoords[i], maxCoords[i]);
+    }
+    glm::mat4 ViewPrj = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f) *
+                        glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = frustumFromViewProjection(ViewPrj);
+
+    float scalar = std::numeric_limits<float>::max(), simd = std::numeric_limits<float>::max();
+    std::vector<uint8_t> reference(boxCount), visible;
+    size_t visibleCount = 0;
+    for (int r = 0; r < runs; r++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < boxCount; i++) {
+            reference[i] = frustumContainsBounds(frustum, minCoords[i], maxCoords[i]) ? 1 : 0;
+        }
+        auto middle = std::chrono::high_resolution_clock::now();
+        visibleCount = boxes.cull(frustum, visible);
+        auto stop = std::chrono::high_resolution_clock::now();
+        scalar = std::min(scalar, std::chrono::duration<float, std::chrono::milliseconds::period>(middle - start).count());
+        simd = std::min(simd, std::chrono::duration<float, std::chrono::milliseconds::period>(stop - middle).count());
+    }
+    std::cout << boxCount << " boxes, " << visibleCount << " visible: scalar " << scalar << " ms, batched "
+              << simd << " ms, speedup " << scalar / simd << ((visible == reference) ? "" : ", OUTPUT DIFFERS")
+              << "\n";
+    return (visible == reference) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ViewPrj * world matrix of the objects [first, end) of a BatchTransforms, as the MVP matrices of the push
+// constants: only the 3 columns of ViewPrj that are not multiplied by a zero are combined
+void batchMVP(const BatchTransforms &batch, size_t first, size_t end, const glm::mat4 &ViewPrj, glm::mat4 *out) {
+    for (size_t i = first; i < end; i++) {
+        float c = batch.scaledCos[i], sn = batch.scaledSin[i], s = batch.scale[i];
+        glm::mat4 &M = out[i];
+        M[0] = (c * ViewPrj[0] - sn * ViewPrj[2]) * batch.boxExtentX[i];
+        M[1] = (s * batch.boxExtentY[i]) * ViewPrj[1];
+        M[2] = (sn * ViewPrj[0] + c * ViewPrj[2]) * batch.boxExtentZ[i];
+        M[3] = (batch.posX[i] + c * batch.boxMinX[i] + sn * batch.boxMinZ[i]) * ViewPrj[0] +
+               (batch.posY[i] + s * batch.boxMinY[i]) * ViewPrj[1] +
+               (batch.posZ[i] + c * batch.boxMinZ[i] - sn * batch.boxMinX[i]) * ViewPrj[2] + ViewPrj[3];
+    }
+}
+
+// World, normal and MVP matrices of random objects: glm (MakeWorldMatrix, dequantization, inverse of the
+// transpose, ViewPrj product) one object at a time, against BatchTransforms and batchMVP. Returns whether they
+// match
+bool benchTransformCount(size_t objectCount) {
+    struct Transform {
+        glm::mat4 worldMat, nMat;
+    };
+    const int runs = 20;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f), angle(-3.14159f, 3.14159f), size(0.5f, 2.0f);
+    std::vector<glm::vec3> positions(objectCount);
+    std::vector<float> yaws(objectCount), scales(objectCount);
+    std::vector<glm::mat4> dequantizations(objectCount);
+    BatchTransforms batch;
+    batch.resize(objectCount);
+    for (size_t i = 0; i < objectCount; i++) {
+        positions[i] = glm::vec3(position(rng), position(rng), position(rng));
+        yaws[i] = angle(rng);
+        scales[i] = size(rng);
+        dequantizations[i] = glm::translate(glm::mat4(1.0f), -glm::vec3(size(rng))) * glm::scale(glm::mat4(1.0f), glm::vec3(2.0f * size(rng)));
+        batch.set(i, positions[i], yaws[i], scales[i], dequantizations[i]);
+    }
+    glm::mat4 ViewPrj = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f) *
+                        glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    float scalar = std::numeric_limits<float>::max(), simd = std::numeric_limits<float>::max();
+    std::vector<Transform> reference(objectCount), transforms(objectCount);
+    std::vector<glm::mat4> referenceMVP(objectCount), mvp(objectCount);
+    for (int r = 0; r < runs; r++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < objectCount; i++) {
+            glm::mat4 World = glm::translate(glm::mat4(1.0f), positions[i]) *
+                              glm::rotate(glm::mat4(1.0f), yaws[i], glm::vec3(0.0f, 1.0f, 0.0f)) *
+                              glm::scale(glm::mat4(1.0f), glm::vec3(scales[i]));
+            reference[i].nMat = glm::inverse(glm::transpose(World));
+            reference[i].worldMat = World * dequantizations[i];
+            referenceMVP[i] = ViewPrj * reference[i].worldMat;
+        }
+        auto middle = std::chrono::high_resolution_clock::now();
+        batch.compute(0, objectCount, transforms.data());
+        batchMVP(batch, 0, objectCount, ViewPrj, mvp.data());
+        auto stop = std::chrono::high_resolution_clock::now();
+        scalar = std::min(scalar, std::chrono::duration<float, std::chrono::milliseconds::period>(middle - start).count());
+        simd = std::min(simd, std::chrono::duration<float, std::chrono::milliseconds::period>(stop - middle).count());
+    }
+
+    // Relative to the size of each element, as the products can be large
+    float maxError = 0.0f;
+    auto compare = [&](const glm::mat4 &A, const glm::mat4 &B) {
+        for (int c = 0; c < 4; c++) {
+            for (int k = 0; k < 4; k++) {
+                maxError = std::max(maxError, std::abs(A[c][k] - B[c][k]) / (1.0f + std::abs(A[c][k])));
+            }
+        }
+    };
+    for (size_t i = 0; i < objectCount; i++) {
+        compare(reference[i].worldMat, transforms[i].worldMat);
+        compare(reference[i].nMat, transforms[i].nMat);
+        compare(referenceMVP[i], mvp[i]);
+    }
+    std::cout << objectCount << " objects: glm " << scalar << " ms, batched " << simd << " ms, speedup "
+              << scalar / simd << ", max relative error " << maxError << ((maxError > 1e-4f) ? ", OUTPUT DIFFERS" : "")
+              << "\n";
+    return maxError <= 1e-4f;
+}
+
+int benchTransforms(size_t objectCount) {
+    bool match = true;
+    if (objectCount > 0) {
+        match = benchTransformCount(objectCount);
+    } else {
+        for (size_t count: {1000, 10000, 100000}) {
+            match = benchTransformCount(count) && match;
+        }
+    }
+    return match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Block compressed textures as standalone DDS files
+int encodeDDS(const std::string &directory) {
+    size_t sourceBytes = 0, ddsBytes = 0;
+    for (const auto &file: listFiles(directory, {".png", ".jpg", ".jpeg"})) {
+        int texWidth, texHeight, texChannels;
+        stbi_uc *pixels = stbi_load(file.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        if (!pixels) {
+            std::cerr << "Cannot load " << file << std::endl;
+            return EXIT_FAILURE;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<char> dds = bcEncodeTexture(pixels, texWidth, texHeight);
+        stbi_image_free(pixels);
+        std::string outFile = fs::path(file).replace_extension(".dds").generic_string();
+        std::ofstream out(outFile, std::ios_base::binary);
+        out.write(dds.data(), static_cast<std::streamsize>(dds.size()));
+        if (!out) {
+            std::cerr << "Cannot write " << outFile << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // RGBA8 with the mip chain generated at runtime: 4/3 of the base level
+        size_t rgbaBytes = static_cast<size_t>(texWidth) * texHeight * 4 * 4 / 3;
+        sourceBytes += rgbaBytes;
+        ddsBytes += dds.size();
+        std::cout << outFile << ": " << texWidth << "x" << texHeight << ", " << dds.size() << " B ("
+                  << static_cast<float>(rgbaBytes) / dds.size() << "x smaller than RGBA8), "
+                  << std::chrono::duration<float, std::chrono::seconds::period>(
+                          std::chrono::high_resolution_clock::now() - start).count() << " s\n";
+    }
+    std::cout << "Total: " << ddsBytes << " B instead of " << sourceBytes << " B of RGBA8\n";
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc > 1 && std::string(argv[1]) == "--bench-mgcg") {
+            return benchMGCG((argc > 2) ? argv[2] : "models/furniture");
+        }
+        if (argc > 1 && std::string(argv[1]) == "--bench-obj") {
+            return benchOBJ((argc > 2) ? argv[2] : "models/character/character.obj",
+                            (argc > 3) ? std::stoul(argv[3]) : 256);
+        }
+        if (argc > 1 && std::string(argv[1]) == "--dds") {
+            return encodeDDS((argc > 2) ? argv[2] : "textures");
+        }
+        if (argc > 1 && std::string(argv[1]) == "--bench-vertices") {
+            return benchVertices((argc > 2) ? std::stoul(argv[2]) : 64);
+        }
+        if (argc > 1 && std::string(argv[1]) == "--bench-cull") {
+            return benchCull((argc > 2) ? std::stoul(argv[2]) : 100000);
+        }
+        if (argc > 1 && std::string(argv[1]) == "--bench-transforms") {
+            return benchTransforms((argc > 2) ? std::stoul(argv[2]) : 0);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string outFile = (argc > 1) ? argv[1] : ASSET_ARCHIVE_DEFAULT_PATH;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Same vertex descriptors used in VTemplate: each mesh is stored with the key of the layout it was
+    // baked for, and it is taken from the archive only by a Model that uses that layout.
+    VertexDescriptor VMesh, VVertexWithColor;
+    VMesh.init(nullptr, {
+            {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX}
+    }, {
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos),  sizeof(glm::vec3), POSITION},
+            {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, norm), sizeof(glm::vec3), NORMAL},
+            {0, 2, VK_FORMAT_R32G32_SFLOAT,    offsetof(Vertex, UV),   sizeof(glm::vec2), UV},
+    });
+    VVertexWithColor.init(nullptr, {
+            {0, sizeof(VertexVColor), VK_VERTEX_INPUT_RATE_VERTEX}
+    }, {
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexVColor, pos),   sizeof(glm::vec3), POSITION},
+            {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexVColor, norm),  sizeof(glm::vec3), NORMAL},
+            {0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexVColor, color), sizeof(glm::vec3), COLOR}
+    });
+
+    AssetArchiveWriter W;
+    try {
+        for (const auto &file: listFiles("models", {".mgcg", ".gltf", ".obj"})) {
+            ModelType MT = (fs::path(file).extension() == ".obj") ? OBJ :
+                           (fs::path(file).extension() == ".gltf") ? GLTF : MGCG;
+
+            Model<Vertex> M;
+            M.load(&VMesh, file, MT);
+            M.bake(W, file);
+
+            // OBJ files can also be drawn with per-vertex colors (e.g. the Polikea building)
+            if (MT == OBJ) {
+                Model<VertexVColor> MC;
+                MC.load(&VVertexWithColor, file, MT);
+                MC.bake(W, file);
+            }
+        }
+
+        for (const auto &file: listFiles("textures", {".png", ".jpg", ".jpeg"})) {
+            std::cout << "Baking : " << file << "\n";
+            Texture::bake(W, file.c_str());
+        }
+
+        W.write(outFile);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Baked in " << std::chrono::duration<float, std::chrono::seconds::period>(
+            std::chrono::high_resolution_clock::now() - start).count() << " s\n";
+    return EXIT_SUCCESS;
+}
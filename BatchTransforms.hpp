@@ -0,0 +1,118 @@
+#pragma once
+
+// Batch transforms
+// World and normal matrices of many objects placed by a position, a rotation around the y axis and a uniform
+// scale, as MakeWorldMatrix, optionally followed by a dequantization matrix (see VertexCompression.hpp). The
+// objects are kept as a structure of arrays, with s * cos(yaw) and s * sin(yaw) computed once by set(), and the
+// matrices are computed 8 objects at a time: with AVX in one register, otherwise with a plain loop the compiler
+// can vectorize. With W = T(p) * s * R, the normal matrix inverse(transpose(W)) has a closed form:
+//     the upper 3x3 is R / s = W / s^2, the last row is -(R^T p) / s, the last column is (0, 0, 0, 1)
+// so no matrix is ever multiplied or inverted. The dequantization only changes the world matrix, as the normal
+// matrix is computed before it. The results are written to any struct with a glm::mat4 worldMat and nMat (as
+// ObjectTransform), so they can go straight to mapped memory.
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#define BATCH_TRANSFORMS_BATCH 8
+
+struct BatchTransforms {
+    // Padded to a multiple of BATCH_TRANSFORMS_BATCH, the padding is never written
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> scaledCos, scaledSin, scale;
+    std::vector<float> boxMinX, boxMinY, boxMinZ;    // dequantization: offset and extent of the box
+    std::vector<float> boxExtentX, boxExtentY, boxExtentZ;
+    size_t count = 0;
+
+    void resize(size_t n) {
+        count = n;
+        size_t padded = (n + BATCH_TRANSFORMS_BATCH - 1) / BATCH_TRANSFORMS_BATCH * BATCH_TRANSFORMS_BATCH;
+        for (auto *v: {&posX, &posY, &posZ, &scaledSin, &boxMinX, &boxMinY, &boxMinZ}) {
+            v->assign(padded, 0.0f);
+        }
+        for (auto *v: {&scaledCos, &scale, &boxExtentX, &boxExtentY, &boxExtentZ}) {
+            v->assign(padded, 1.0f);
+        }
+    }
+
+    // dequantization must be a translation times a scale, as the matrices of packVertices
+    void set(size_t i, glm::vec3 position, float yaw, float s = 1.0f,
+             const glm::mat4 &dequantization = glm::mat4(1.0f)) {
+        posX[i] = position.x; posY[i] = position.y; posZ[i] = position.z;
+        scaledCos[i] = s * std::cos(yaw); scaledSin[i] = s * std::sin(yaw); scale[i] = s;
+        boxMinX[i] = dequantization[3].x; boxMinY[i] = dequantization[3].y; boxMinZ[i] = dequantization[3].z;
+        boxExtentX[i] = dequantization[0].x; boxExtentY[i] = dequantization[1].y; boxExtentZ[i] = dequantization[2].z;
+    }
+
+    // Writes the matrices of the objects [first, end) to out[first], ..., out[end - 1]
+    template <class Transform>
+    void compute(size_t first, size_t end, Transform *out) const {
+        // The 14 distinct values of the two matrices, for the 8 objects of a batch
+        enum { W00, W02, W11, W20, W22, W30, W31, W32, N00, N02, N11, N30, N31, N32, VALUES };
+        alignas(32) float v[VALUES][BATCH_TRANSFORMS_BATCH];
+        for (size_t b = first / BATCH_TRANSFORMS_BATCH * BATCH_TRANSFORMS_BATCH; b < end; b += BATCH_TRANSFORMS_BATCH) {
+#if defined(__AVX__)
+            __m256 px = _mm256_loadu_ps(&posX[b]), py = _mm256_loadu_ps(&posY[b]), pz = _mm256_loadu_ps(&posZ[b]);
+            __m256 c = _mm256_loadu_ps(&scaledCos[b]), sn = _mm256_loadu_ps(&scaledSin[b]), s = _mm256_loadu_ps(&scale[b]);
+            __m256 mx = _mm256_loadu_ps(&boxMinX[b]), my = _mm256_loadu_ps(&boxMinY[b]), mz = _mm256_loadu_ps(&boxMinZ[b]);
+            __m256 ex = _mm256_loadu_ps(&boxExtentX[b]), ey = _mm256_loadu_ps(&boxExtentY[b]), ez = _mm256_loadu_ps(&boxExtentZ[b]);
+            __m256 invS2 = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(_mm256_mul_ps(c, c), _mm256_mul_ps(sn, sn)));
+            __m256 a = _mm256_mul_ps(c, invS2), d = _mm256_mul_ps(sn, invS2), invS = _mm256_mul_ps(s, invS2);
+            _mm256_store_ps(v[W00], _mm256_mul_ps(c, ex));
+            _mm256_store_ps(v[W02], _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(sn, ex)));
+            _mm256_store_ps(v[W11], _mm256_mul_ps(s, ey));
+            _mm256_store_ps(v[W20], _mm256_mul_ps(sn, ez));
+            _mm256_store_ps(v[W22], _mm256_mul_ps(c, ez));
+            _mm256_store_ps(v[W30], _mm256_add_ps(px, _mm256_add_ps(_mm256_mul_ps(c, mx), _mm256_mul_ps(sn, mz))));
+            _mm256_store_ps(v[W31], _mm256_add_ps(py, _mm256_mul_ps(s, my)));
+            _mm256_store_ps(v[W32], _mm256_add_ps(pz, _mm256_sub_ps(_mm256_mul_ps(c, mz), _mm256_mul_ps(sn, mx))));
+            _mm256_store_ps(v[N00], a);
+            _mm256_store_ps(v[N02], d);
+            _mm256_store_ps(v[N11], invS);
+            _mm256_store_ps(v[N30], _mm256_sub_ps(_mm256_mul_ps(d, pz), _mm256_mul_ps(a, px)));
+            _mm256_store_ps(v[N31], _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(invS, py)));
+            _mm256_store_ps(v[N32], _mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(_mm256_mul_ps(d, px), _mm256_mul_ps(a, pz))));
+#else
+            for (int k = 0; k < BATCH_TRANSFORMS_BATCH; k++) {
+                size_t i = b + k;
+                float c = scaledCos[i], sn = scaledSin[i], s = scale[i];
+                float invS2 = 1.0f / (c * c + sn * sn);
+                float a = c * invS2, d = sn * invS2;
+                v[W00][k] = c * boxExtentX[i];
+                v[W02][k] = -sn * boxExtentX[i];
+                v[W11][k] = s * boxExtentY[i];
+                v[W20][k] = sn * boxExtentZ[i];
+                v[W22][k] = c * boxExtentZ[i];
+                v[W30][k] = posX[i] + c * boxMinX[i] + sn * boxMinZ[i];
+                v[W31][k] = posY[i] + s * boxMinY[i];
+                v[W32][k] = posZ[i] + c * boxMinZ[i] - sn * boxMinX[i];
+                v[N00][k] = a;
+                v[N02][k] = d;
+                v[N11][k] = s * invS2;
+                v[N30][k] = d * posZ[i] - a * posX[i];
+                v[N31][k] = -s * invS2 * posY[i];
+                v[N32][k] = -(d * posX[i] + a * posZ[i]);
+            }
+#endif
+            size_t kFirst = (b < first) ? first - b : 0;
+            size_t kEnd = std::min<size_t>(BATCH_TRANSFORMS_BATCH, end - b);
+            for (size_t k = kFirst; k < kEnd; k++) {
+                Transform &T = out[b + k];
+                T.worldMat[0] = glm::vec4(v[W00][k], 0.0f, v[W02][k], 0.0f);
+                T.worldMat[1] = glm::vec4(0.0f, v[W11][k], 0.0f, 0.0f);
+                T.worldMat[2] = glm::vec4(v[W20][k], 0.0f, v[W22][k], 0.0f);
+                T.worldMat[3] = glm::vec4(v[W30][k], v[W31][k], v[W32][k], 1.0f);
+                T.nMat[0] = glm::vec4(v[N00][k], 0.0f, -v[N02][k], v[N30][k]);
+                T.nMat[1] = glm::vec4(0.0f, v[N11][k], 0.0f, v[N31][k]);
+                T.nMat[2] = glm::vec4(v[N02][k], 0.0f, v[N00][k], v[N32][k]);
+                T.nMat[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            }
+        }
+    }
+};
@@ -0,0 +1,393 @@
+#pragma once
+
+// Block compression
+// Offline encoder used by the asset baker: builds the mip chain of an RGBA8 image and compresses every
+// level to BC1 (opaque images, 4 bits per pixel) or BC7 (images with alpha, 8 bits per pixel), stored in a
+// DDS container (see DDSImage.hpp). The GPU samples the blocks directly, so a texture takes 4 to 8 times
+// less memory and bandwidth than RGBA8, and no mip level has to be generated at runtime.
+//  - Mip levels are averaged in linear space (the sources are sRGB colors), 2x2 boxes with clamped edges.
+//  - BC1 endpoints lie on the principal axis of the block colors, then refined with a least squares fit.
+//  - BC7 uses mode 6 only (one subset, RGBA endpoints with a p-bit each, 16 weights), with the same
+//    principal axis fit; the p-bits are chosen by trying the four combinations.
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "DDSImage.hpp"
+#include "JobSystem.hpp"
+
+// Principal axis of n points of dimension D (power iteration on the covariance matrix)
+template <int D>
+inline void bcPrincipalAxis(const float (*p)[4], int n, float mean[4], float axis[4]) {
+    for (int c = 0; c < D; c++) {
+        mean[c] = 0.0f;
+        for (int i = 0; i < n; i++) mean[c] += p[i][c];
+        mean[c] /= static_cast<float>(n);
+    }
+    float cov[D][D] = {};
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < D; a++) {
+            for (int b = 0; b < D; b++) cov[a][b] += (p[i][a] - mean[a]) * (p[i][b] - mean[b]);
+        }
+    }
+    for (int c = 0; c < D; c++) axis[c] = 1.0f;
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[D] = {};
+        for (int a = 0; a < D; a++) {
+            for (int b = 0; b < D; b++) next[a] += cov[a][b] * axis[b];
+        }
+        float len = 0.0f;
+        for (int c = 0; c < D; c++) len += next[c] * next[c];
+        if (len <= 1e-12f) break;
+        len = std::sqrt(len);
+        for (int c = 0; c < D; c++) axis[c] = next[c] / len;
+    }
+}
+
+// Extremes of the points projected on the axis
+template <int D>
+inline void bcAxisEndpoints(const float (*p)[4], int n, const float mean[4], const float axis[4],
+                            float e0[4], float e1[4]) {
+    float tMin = 0.0f, tMax = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float t = 0.0f;
+        for (int c = 0; c < D; c++) t += (p[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    for (int c = 0; c < D; c++) {
+        e0[c] = std::clamp(mean[c] + tMin * axis[c], 0.0f, 255.0f);
+        e1[c] = std::clamp(mean[c] + tMax * axis[c], 0.0f, 255.0f);
+    }
+}
+
+// Endpoints minimizing the squared error for the given interpolation weights (in [0, 1]) of each point
+template <int D>
+inline bool bcLeastSquares(const float (*p)[4], int n, const float *w, float e0[4], float e1[4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+    for (int i = 0; i < n; i++) {
+        float a = 1.0f - w[i], b = w[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < D; c++) {
+            ax[c] += a * p[i][c];
+            bx[c] += b * p[i][c];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f) return false;
+    for (int c = 0; c < D; c++) {
+        e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+        e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+
+// BC1
+
+inline uint16_t bc1Pack565(const float c[4]) {
+    auto q = [](float v, int max) { return static_cast<uint16_t>(std::clamp(std::lround(v * max / 255.0f), 0L, static_cast<long>(max))); };
+    return static_cast<uint16_t>((q(c[0], 31) << 11) | (q(c[1], 63) << 5) | q(c[2], 31));
+}
+
+inline void bc1Unpack565(uint16_t v, int c[3]) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+// Indices of the four color palette of two endpoints (color0 > color1); returns the squared error
+inline int bc1Indices(const float (*p)[4], uint16_t color0, uint16_t color1, uint32_t &indices) {
+    int palette[4][3];
+    bc1Unpack565(color0, palette[0]);
+    bc1Unpack565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    int total = 0;
+    indices = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0, bestError = INT32_MAX;
+        for (int k = 0; k < 4; k++) {
+            int error = 0;
+            for (int c = 0; c < 3; c++) {
+                int d = static_cast<int>(p[i][c]) - palette[k][c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                best = k;
+            }
+        }
+        indices |= static_cast<uint32_t>(best) << (2 * i);
+        total += bestError;
+    }
+    return total;
+}
+
+// Encodes a 4x4 RGBA8 block (alpha is ignored) in 8 bytes
+inline void bc1EncodeBlock(const uint8_t rgba[64], uint8_t out[8]) {
+    float p[16][4];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) p[i][c] = rgba[4 * i + c];
+    }
+    float mean[4], axis[4], e0[4], e1[4];
+    bcPrincipalAxis<3>(p, 16, mean, axis);
+    bcAxisEndpoints<3>(p, 16, mean, axis, e0, e1);
+
+    uint16_t color0 = bc1Pack565(e1), color1 = bc1Pack565(e0);
+    if (color0 < color1) std::swap(color0, color1);
+    uint32_t indices = 0;
+    int error = 0;
+    if (color0 != color1) {
+        error = bc1Indices(p, color0, color1, indices);
+        // One least squares refinement on the chosen indices
+        static const float weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+        float w[16];
+        for (int i = 0; i < 16; i++) w[i] = weights[(indices >> (2 * i)) & 3];
+        float r0[4], r1[4];
+        if (bcLeastSquares<3>(p, 16, w, r0, r1)) {
+            uint16_t c0 = bc1Pack565(r0), c1 = bc1Pack565(r1);
+            if (c0 < c1) std::swap(c0, c1);
+            uint32_t refined;
+            if (c0 != c1) {
+                int refinedError = bc1Indices(p, c0, c1, refined);
+                if (refinedError < error) {
+                    color0 = c0;
+                    color1 = c1;
+                    indices = refined;
+                }
+            }
+        }
+    }
+    // With equal endpoints all the indices stay 0 (color0)
+    out[0] = static_cast<uint8_t>(color0 & 0xff);
+    out[1] = static_cast<uint8_t>(color0 >> 8);
+    out[2] = static_cast<uint8_t>(color1 & 0xff);
+    out[3] = static_cast<uint8_t>(color1 >> 8);
+    for (int b = 0; b < 4; b++) out[4 + b] = static_cast<uint8_t>(indices >> (8 * b));
+}
+
+
+// BC7 (mode 6)
+
+static const int BC7_WEIGHTS4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+inline int bc7Interpolate(int e0, int e1, int w) {
+    return ((64 - w) * e0 + w * e1 + 32) >> 6;
+}
+
+// Quantizes an endpoint to 7 bits plus the given p-bit
+inline void bc7Quantize(const float e[4], int pBit, int q[4]) {
+    for (int c = 0; c < 4; c++) {
+        q[c] = std::clamp(static_cast<int>(std::lround((e[c] - pBit) / 2.0f)), 0, 127);
+    }
+}
+
+// Best weight of each pixel for the endpoints (expanded to 8 bits); returns the squared error
+inline int bc7Indices(const float (*p)[4], const int a[4], const int b[4], uint8_t indices[16]) {
+    int dir[4], len2 = 0;
+    for (int c = 0; c < 4; c++) {
+        dir[c] = b[c] - a[c];
+        len2 += dir[c] * dir[c];
+    }
+    int total = 0;
+    for (int i = 0; i < 16; i++) {
+        // The projection on the segment gives the neighbourhood of the best weight
+        int guess = 0;
+        if (len2 > 0) {
+            float t = 0.0f;
+            for (int c = 0; c < 4; c++) t += (p[i][c] - a[c]) * dir[c];
+            guess = std::clamp(static_cast<int>(std::lround(t / len2 * 15.0f)), 0, 15);
+        }
+        int best = guess, bestError = INT32_MAX;
+        for (int k = std::max(0, guess - 1); k <= std::min(15, guess + 1); k++) {
+            int error = 0;
+            for (int c = 0; c < 4; c++) {
+                int d = static_cast<int>(p[i][c]) - bc7Interpolate(a[c], b[c], BC7_WEIGHTS4[k]);
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                best = k;
+            }
+        }
+        indices[i] = static_cast<uint8_t>(best);
+        total += bestError;
+    }
+    return total;
+}
+
+struct BC7Mode6 {
+    int q0[4], q1[4];
+    int p0, p1;
+    uint8_t indices[16];
+    int error = INT32_MAX;
+};
+
+// Tries the four p-bit combinations for the float endpoints, keeping the best in M
+inline void bc7Fit(const float (*p)[4], const float e0[4], const float e1[4], BC7Mode6 &M) {
+    for (int pBits = 0; pBits < 4; pBits++) {
+        BC7Mode6 T;
+        T.p0 = pBits & 1;
+        T.p1 = pBits >> 1;
+        bc7Quantize(e0, T.p0, T.q0);
+        bc7Quantize(e1, T.p1, T.q1);
+        int a[4], b[4];
+        for (int c = 0; c < 4; c++) {
+            a[c] = (T.q0[c] << 1) | T.p0;
+            b[c] = (T.q1[c] << 1) | T.p1;
+        }
+        T.error = bc7Indices(p, a, b, T.indices);
+        if (T.error < M.error) M = T;
+    }
+}
+
+// Encodes a 4x4 RGBA8 block in 16 bytes
+inline void bc7EncodeBlock(const uint8_t rgba[64], uint8_t out[16]) {
+    float p[16][4];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) p[i][c] = rgba[4 * i + c];
+    }
+    float mean[4], axis[4], e0[4], e1[4];
+    bcPrincipalAxis<4>(p, 16, mean, axis);
+    bcAxisEndpoints<4>(p, 16, mean, axis, e0, e1);
+
+    BC7Mode6 M;
+    bc7Fit(p, e0, e1, M);
+    for (int iteration = 0; iteration < 2 && M.error > 0; iteration++) {
+        float w[16];
+        for (int i = 0; i < 16; i++) w[i] = BC7_WEIGHTS4[M.indices[i]] / 64.0f;
+        if (!bcLeastSquares<4>(p, 16, w, e0, e1)) break;
+        int before = M.error;
+        bc7Fit(p, e0, e1, M);
+        if (M.error >= before) break;
+    }
+
+    // The most significant bit of the first index is implicit (0): swap the endpoints otherwise
+    if (M.indices[0] & 8) {
+        std::swap(M.q0, M.q1);
+        std::swap(M.p0, M.p1);
+        for (auto &index: M.indices) index = static_cast<uint8_t>(15 - index);
+    }
+
+    memset(out, 0, 16);
+    int bit = 0;
+    auto put = [&](uint32_t value, int bits) {
+        for (int b = 0; b < bits; b++, bit++) {
+            out[bit >> 3] |= static_cast<uint8_t>(((value >> b) & 1) << (bit & 7));
+        }
+    };
+    put(1u << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        put(M.q0[c], 7);
+        put(M.q1[c], 7);
+    }
+    put(M.p0, 1);
+    put(M.p1, 1);
+    put(M.indices[0], 3);
+    for (int i = 1; i < 16; i++) put(M.indices[i], 4);
+}
+
+
+// Mip chain and container
+
+// Compresses one level (blocks on the image edges repeat the last row and column)
+inline void bcCompressLevel(DDSBlockFormat format, const uint8_t *rgba, uint32_t width, uint32_t height, char *out) {
+    uint32_t blocksX = std::max(1u, (width + 3) / 4), blocksY = std::max(1u, (height + 3) / 4);
+    uint32_t blockBytes = ddsBlockBytes(format);
+    JobSystem::shared().parallelFor(blocksY, 4, [&](size_t begin, size_t end) {
+        uint8_t block[64];
+        for (size_t by = begin; by < end; by++) {
+            for (uint32_t bx = 0; bx < blocksX; bx++) {
+                for (uint32_t y = 0; y < 4; y++) {
+                    for (uint32_t x = 0; x < 4; x++) {
+                        uint32_t sx = std::min(bx * 4 + x, width - 1);
+                        uint32_t sy = std::min(static_cast<uint32_t>(by) * 4 + y, height - 1);
+                        memcpy(block + 4 * (4 * y + x), rgba + 4 * (static_cast<size_t>(sy) * width + sx), 4);
+                    }
+                }
+                uint8_t *dst = reinterpret_cast<uint8_t *>(out) + (by * blocksX + bx) * blockBytes;
+                if (format == DDS_BC1) {
+                    bc1EncodeBlock(block, dst);
+                } else {
+                    bc7EncodeBlock(block, dst);
+                }
+            }
+        }
+    });
+}
+
+// sRGB <-> linear conversions of the mip filter
+inline float bcSRGBToLinear(float c) {
+    return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline uint8_t bcLinearToSRGB8(float c) {
+    c = std::clamp(c, 0.0f, 1.0f);
+    float s = (c <= 0.0031308f) ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::lround(s * 255.0f));
+}
+
+// Full mip chain of an sRGB RGBA8 image, compressed and wrapped in a DDS file. The format is BC7 when
+// the image has transparent pixels and BC1 otherwise.
+inline std::vector<char> bcEncodeTexture(const uint8_t *rgba, uint32_t width, uint32_t height) {
+    bool alpha = false;
+    for (size_t i = 0; i < static_cast<size_t>(width) * height && !alpha; i++) alpha = (rgba[4 * i + 3] != 255);
+    DDSBlockFormat format = alpha ? DDS_BC7 : DDS_BC1;
+    uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+    size_t total = 0;
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        total += ddsLevelSize(format, std::max(1u, width >> level), std::max(1u, height >> level));
+    }
+    std::vector<char> levels(total);
+
+    // Each level is filtered from the previous one in linear space, then converted back to sRGB to be encoded
+    float toLinear[256];
+    for (int i = 0; i < 256; i++) toLinear[i] = bcSRGBToLinear(i / 255.0f);
+    std::vector<float> linear(static_cast<size_t>(width) * height * 4);
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+        for (int c = 0; c < 3; c++) linear[4 * i + c] = toLinear[rgba[4 * i + c]];
+        linear[4 * i + 3] = rgba[4 * i + 3] / 255.0f;
+    }
+
+    std::vector<uint8_t> level8(rgba, rgba + static_cast<size_t>(width) * height * 4);
+    uint32_t w = width, h = height;
+    size_t offset = 0;
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        bcCompressLevel(format, level8.data(), w, h, levels.data() + offset);
+        offset += ddsLevelSize(format, w, h);
+        if (level + 1 == mipLevels) break;
+
+        uint32_t nw = std::max(1u, w / 2), nh = std::max(1u, h / 2);
+        std::vector<float> next(static_cast<size_t>(nw) * nh * 4);
+        for (uint32_t y = 0; y < nh; y++) {
+            for (uint32_t x = 0; x < nw; x++) {
+                uint32_t x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                uint32_t y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+                for (int c = 0; c < 4; c++) {
+                    next[4 * (static_cast<size_t>(y) * nw + x) + c] = 0.25f * (
+                            linear[4 * (static_cast<size_t>(y0) * w + x0) + c] + linear[4 * (static_cast<size_t>(y0) * w + x1) + c] +
+                            linear[4 * (static_cast<size_t>(y1) * w + x0) + c] + linear[4 * (static_cast<size_t>(y1) * w + x1) + c]);
+                }
+            }
+        }
+        linear.swap(next);
+        w = nw;
+        h = nh;
+        level8.resize(static_cast<size_t>(w) * h * 4);
+        for (size_t i = 0; i < static_cast<size_t>(w) * h; i++) {
+            for (int c = 0; c < 3; c++) level8[4 * i + c] = bcLinearToSRGB8(linear[4 * i + c]);
+            level8[4 * i + 3] = static_cast<uint8_t>(std::lround(std::clamp(linear[4 * i + 3], 0.0f, 1.0f) * 255.0f));
+        }
+    }
+
+    return ddsWrite(format, true, width, height, mipLevels, levels);
+}
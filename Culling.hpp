@@ -0,0 +1,257 @@
+#pragma once
+
+// Culling
+// View frustum of a view projection matrix, as six planes (a, b, c, d) with the normal (a, b, c) pointing
+// inside: a point p is inside a plane when dot(a b c, p) + d >= 0. The planes are extracted from the rows of
+// the matrix (Gribb and Hartmann), for the [0, 1] depth range of Vulkan (GLM_FORCE_DEPTH_ZERO_TO_ONE).
+// Bounds are axis aligned boxes in world space: a box is outside when all of it is behind one of the planes.
+// The same test is done on the GPU by shaders/Cull.comp.
+// A frustum can also be limited to a rectangle of the screen, as seen through a portal (see portalVisibility).
+// CullingBoxes keeps many boxes as a structure of arrays (centers and half extents), and tests them 8 at a
+// time: with AVX in one register, with SSE in two, otherwise with a plain loop the compiler can vectorize.
+
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#define FRUSTUM_PLANES 6
+
+struct Frustum {
+    glm::vec4 planes[FRUSTUM_PLANES];
+};
+
+// Rectangle of the screen in normalized device coordinates, the whole screen by default
+struct ScreenRect {
+    glm::vec2 min = glm::vec2(-1.0f);
+    glm::vec2 max = glm::vec2(1.0f);
+
+    bool empty() const { return (min.x >= max.x) || (min.y >= max.y); }
+};
+
+inline Frustum frustumFromViewProjection(const glm::mat4 &M, const ScreenRect &R = ScreenRect()) {
+    // glm matrices are column major: row i is (M[0][i], M[1][i], M[2][i], M[3][i])
+    glm::vec4 row0(M[0][0], M[1][0], M[2][0], M[3][0]);
+    glm::vec4 row1(M[0][1], M[1][1], M[2][1], M[3][1]);
+    glm::vec4 row2(M[0][2], M[1][2], M[2][2], M[3][2]);
+    glm::vec4 row3(M[0][3], M[1][3], M[2][3], M[3][3]);
+
+    // x / w >= R.min.x is x - R.min.x * w >= 0, and so on
+    Frustum F;
+    F.planes[0] = row0 - R.min.x * row3;  // left
+    F.planes[1] = R.max.x * row3 - row0;  // right
+    F.planes[2] = row1 - R.min.y * row3;  // bottom (top with the flipped Y of the projection)
+    F.planes[3] = R.max.y * row3 - row1;
+    F.planes[4] = row2;         // near: 0 <= z
+    F.planes[5] = row3 - row2;  // far: z <= w
+    for (auto &plane: F.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return F;
+}
+
+// Bounds of a box after a transformation (Arvo's method: the extent is multiplied by the absolute matrix)
+inline void transformBounds(const glm::mat4 &M, glm::vec3 minCoords, glm::vec3 maxCoords,
+                            glm::vec3 &outMin, glm::vec3 &outMax) {
+    glm::vec3 center = (minCoords + maxCoords) * 0.5f;
+    glm::vec3 extent = (maxCoords - minCoords) * 0.5f;
+    glm::vec3 c = glm::vec3(M * glm::vec4(center, 1.0f));
+    glm::vec3 e;
+    for (int i = 0; i < 3; i++) {
+        e[i] = std::abs(M[0][i]) * extent.x + std::abs(M[1][i]) * extent.y + std::abs(M[2][i]) * extent.z;
+    }
+    outMin = c - e;
+    outMax = c + e;
+}
+
+inline bool frustumContainsBounds(const Frustum &F, glm::vec3 minCoords, glm::vec3 maxCoords) {
+    glm::vec3 center = (minCoords + maxCoords) * 0.5f;
+    glm::vec3 extent = (maxCoords - minCoords) * 0.5f;
+    for (const auto &plane: F.planes) {
+        glm::vec3 n(plane);
+        if (glm::dot(n, center) + glm::dot(glm::abs(n), extent) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Portals
+// The scene is split in cells (the rooms of a building) connected by portals (the openings of their doors).
+// From the cell of the camera, the portals are crossed while the part of the screen through which the next
+// cell can be seen shrinks to the rectangle of each portal: a cell is visible when it is reached with a
+// rectangle that is not empty. Cells are never entered twice along the same path.
+
+#define PORTAL_MAX_DEPTH 16
+
+struct Portal {
+    uint32_t cells[2];
+    glm::vec3 minCoords;    // box of the opening, across the whole thickness of the wall
+    glm::vec3 maxCoords;
+};
+
+// Rectangle of the screen covered by a portal, inside R: a portal crossing the plane of the camera keeps all of R
+inline ScreenRect portalScreenRect(const glm::mat4 &M, const Portal &P, const ScreenRect &R) {
+    ScreenRect S;
+    S.min = glm::vec2(std::numeric_limits<float>::max());
+    S.max = glm::vec2(std::numeric_limits<float>::lowest());
+    int behind = 0;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? P.maxCoords.x : P.minCoords.x, (i & 2) ? P.maxCoords.y : P.minCoords.y,
+                         (i & 4) ? P.maxCoords.z : P.minCoords.z);
+        glm::vec4 c = M * glm::vec4(corner, 1.0f);
+        if (c.w <= 1e-4f) {
+            behind++;
+            continue;
+        }
+        S.min = glm::min(S.min, glm::vec2(c) / c.w);
+        S.max = glm::max(S.max, glm::vec2(c) / c.w);
+    }
+    if (behind == 8) {
+        return ScreenRect{glm::vec2(0.0f), glm::vec2(0.0f)};
+    }
+    if (behind > 0) {
+        return R;
+    }
+    S.min = glm::max(S.min, R.min);
+    S.max = glm::min(S.max, R.max);
+    return S;
+}
+
+inline void portalVisit(const glm::mat4 &M, uint32_t cell, const ScreenRect &R, const std::vector<Portal> &portals,
+                        std::vector<ScreenRect> &rects, std::vector<uint8_t> &onPath, int depth) {
+    if (rects[cell].empty()) {
+        rects[cell] = R;
+    } else {
+        rects[cell].min = glm::min(rects[cell].min, R.min);
+        rects[cell].max = glm::max(rects[cell].max, R.max);
+    }
+    if (depth >= PORTAL_MAX_DEPTH) {
+        return;
+    }
+    onPath[cell] = 1;
+    for (const auto &P: portals) {
+        if ((P.cells[0] != cell) && (P.cells[1] != cell)) {
+            continue;
+        }
+        uint32_t next = (P.cells[0] == cell) ? P.cells[1] : P.cells[0];
+        if (onPath[next]) {
+            continue;
+        }
+        ScreenRect through = portalScreenRect(M, P, R);
+        if (!through.empty()) {
+            portalVisit(M, next, through, portals, rects, onPath, depth + 1);
+        }
+    }
+    onPath[cell] = 0;
+}
+
+// Sets rects[c] (rects must already have one element per cell) to the part of the screen through which cell c
+// is seen from cell start, empty when it is not visible; frustumFromViewProjection(M, rects[c]) then culls
+// what is inside the cell
+inline void portalVisibility(const glm::mat4 &M, uint32_t start, const std::vector<Portal> &portals,
+                             std::vector<ScreenRect> &rects) {
+    std::fill(rects.begin(), rects.end(), ScreenRect{glm::vec2(0.0f), glm::vec2(0.0f)});
+    std::vector<uint8_t> onPath(rects.size(), 0);
+    portalVisit(M, start, ScreenRect(), portals, rects, onPath, 0);
+}
+
+#define CULLING_BATCH 8
+
+struct CullingBoxes {
+    // Padded to a multiple of CULLING_BATCH, the padding is never reported as visible
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    size_t count = 0;
+
+    void resize(size_t n) {
+        count = n;
+        size_t padded = (n + CULLING_BATCH - 1) / CULLING_BATCH * CULLING_BATCH;
+        for (auto *v: {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ}) {
+            v->assign(padded, 0.0f);
+        }
+    }
+
+    void set(size_t i, glm::vec3 minCoords, glm::vec3 maxCoords) {
+        glm::vec3 c = (minCoords + maxCoords) * 0.5f;
+        glm::vec3 e = (maxCoords - minCoords) * 0.5f;
+        centerX[i] = c.x; centerY[i] = c.y; centerZ[i] = c.z;
+        extentX[i] = e.x; extentY[i] = e.y; extentZ[i] = e.z;
+    }
+
+    // Sets visible[i] to 1 for the boxes intersecting the frustum, to 0 for the others, and returns how many are visible
+    size_t cull(const Frustum &F, std::vector<uint8_t> &visible) const {
+        visible.resize(centerX.size());
+        size_t n = centerX.size();
+#if defined(__AVX__)
+        for (size_t i = 0; i < n; i += CULLING_BATCH) {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+            __m256 outside = _mm256_setzero_ps();
+            for (const auto &p: F.planes) {
+                __m256 d = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(p.x)), _mm256_set1_ps(p.w));
+                d = _mm256_add_ps(d, _mm256_mul_ps(cy, _mm256_set1_ps(p.y)));
+                d = _mm256_add_ps(d, _mm256_mul_ps(cz, _mm256_set1_ps(p.z)));
+                d = _mm256_add_ps(d, _mm256_mul_ps(ex, _mm256_set1_ps(std::abs(p.x))));
+                d = _mm256_add_ps(d, _mm256_mul_ps(ey, _mm256_set1_ps(std::abs(p.y))));
+                d = _mm256_add_ps(d, _mm256_mul_ps(ez, _mm256_set1_ps(std::abs(p.z))));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            int mask = _mm256_movemask_ps(outside);
+            for (int k = 0; k < CULLING_BATCH; k++) {
+                visible[i + k] = ((mask >> k) & 1) ? 0 : 1;
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        for (size_t i = 0; i < n; i += CULLING_BATCH) {
+            for (size_t h = i; h < i + CULLING_BATCH; h += 4) {
+                __m128 cx = _mm_loadu_ps(&centerX[h]), cy = _mm_loadu_ps(&centerY[h]), cz = _mm_loadu_ps(&centerZ[h]);
+                __m128 ex = _mm_loadu_ps(&extentX[h]), ey = _mm_loadu_ps(&extentY[h]), ez = _mm_loadu_ps(&extentZ[h]);
+                __m128 outside = _mm_setzero_ps();
+                for (const auto &p: F.planes) {
+                    __m128 d = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(p.x)), _mm_set1_ps(p.w));
+                    d = _mm_add_ps(d, _mm_mul_ps(cy, _mm_set1_ps(p.y)));
+                    d = _mm_add_ps(d, _mm_mul_ps(cz, _mm_set1_ps(p.z)));
+                    d = _mm_add_ps(d, _mm_mul_ps(ex, _mm_set1_ps(std::abs(p.x))));
+                    d = _mm_add_ps(d, _mm_mul_ps(ey, _mm_set1_ps(std::abs(p.y))));
+                    d = _mm_add_ps(d, _mm_mul_ps(ez, _mm_set1_ps(std::abs(p.z))));
+                    outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+                }
+                int mask = _mm_movemask_ps(outside);
+                for (int k = 0; k < 4; k++) {
+                    visible[h + k] = ((mask >> k) & 1) ? 0 : 1;
+                }
+            }
+        }
+#else
+        for (size_t i = 0; i < n; i += CULLING_BATCH) {
+            uint8_t inside[CULLING_BATCH];
+            for (int k = 0; k < CULLING_BATCH; k++) {
+                inside[k] = 1;
+            }
+            for (const auto &p: F.planes) {
+                float ax = std::abs(p.x), ay = std::abs(p.y), az = std::abs(p.z);
+                for (int k = 0; k < CULLING_BATCH; k++) {
+                    float d = centerX[i + k] * p.x + centerY[i + k] * p.y + centerZ[i + k] * p.z + p.w +
+                              extentX[i + k] * ax + extentY[i + k] * ay + extentZ[i + k] * az;
+                    inside[k] &= (d >= 0.0f) ? 1 : 0;
+                }
+            }
+            for (int k = 0; k < CULLING_BATCH; k++) {
+                visible[i + k] = inside[k];
+            }
+        }
+#endif
+        visible.resize(count);
+        size_t visibleCount = 0;
+        for (uint8_t v: visible) {
+            visibleCount += v;
+        }
+        return visibleCount;
+    }
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+// DDS container for block compressed textures
+// Holds a 2D texture with its whole mip chain, each level stored as rows of 4x4 blocks, the largest first.
+// Only the formats written by the baker are read back: BC1 (8 bytes per block, opaque) and BC7 (16 bytes
+// per block, with alpha), from the DX10 extended header, or BC1 from the legacy "DXT1" FourCC.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define DDS_MAGIC 0x20534444u // "DDS "
+#define DDS_FOURCC_DX10 0x30315844u // "DX10"
+#define DDS_FOURCC_DXT1 0x31545844u // "DXT1"
+
+// DXGI_FORMAT values of the DX10 header
+#define DDS_DXGI_BC1_UNORM 71u
+#define DDS_DXGI_BC1_UNORM_SRGB 72u
+#define DDS_DXGI_BC7_UNORM 98u
+#define DDS_DXGI_BC7_UNORM_SRGB 99u
+
+enum DDSBlockFormat : uint32_t { DDS_BC1 = 1, DDS_BC7 = 7 };
+
+struct DDSPixelFormat {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t bitMask[4];
+};
+
+struct DDSHeader {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];
+    DDSPixelFormat pixelFormat;
+    uint32_t caps[4];
+    uint32_t reserved2;
+};
+
+struct DDSHeaderDX10 {
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+inline uint32_t ddsBlockBytes(DDSBlockFormat format) {
+    return (format == DDS_BC1) ? 8 : 16;
+}
+
+// Bytes of a mip level of the given size
+inline size_t ddsLevelSize(DDSBlockFormat format, uint32_t width, uint32_t height) {
+    return static_cast<size_t>(std::max(1u, (width + 3) / 4)) * std::max(1u, (height + 3) / 4) * ddsBlockBytes(format);
+}
+
+// View of a DDS file in memory: levels point inside the parsed buffer
+struct DDSImage {
+    DDSBlockFormat format = DDS_BC1;
+    bool sRGB = true;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+    const char *data = nullptr;          // first byte of level 0
+    size_t size = 0;                     // bytes of all the levels
+    std::vector<size_t> levelOffsets;    // from data
+
+    // Returns false if the buffer is not a DDS of a supported format
+    bool parse(const char *file, size_t fileSize) {
+        uint32_t magic;
+        DDSHeader H;
+        if (fileSize < sizeof(magic) + sizeof(H)) return false;
+        memcpy(&magic, file, sizeof(magic));
+        memcpy(&H, file + sizeof(magic), sizeof(H));
+        if (magic != DDS_MAGIC || H.size != sizeof(DDSHeader) || H.pixelFormat.size != sizeof(DDSPixelFormat))
+            return false;
+        size_t offset = sizeof(magic) + sizeof(H);
+
+        if (H.pixelFormat.fourCC == DDS_FOURCC_DX10) {
+            DDSHeaderDX10 D;
+            if (fileSize < offset + sizeof(D)) return false;
+            memcpy(&D, file + offset, sizeof(D));
+            offset += sizeof(D);
+            if (D.arraySize > 1) return false;
+            switch (D.dxgiFormat) {
+                case DDS_DXGI_BC1_UNORM: format = DDS_BC1; sRGB = false; break;
+                case DDS_DXGI_BC1_UNORM_SRGB: format = DDS_BC1; sRGB = true; break;
+                case DDS_DXGI_BC7_UNORM: format = DDS_BC7; sRGB = false; break;
+                case DDS_DXGI_BC7_UNORM_SRGB: format = DDS_BC7; sRGB = true; break;
+                default: return false;
+            }
+        } else if (H.pixelFormat.fourCC == DDS_FOURCC_DXT1) {
+            format = DDS_BC1;
+            sRGB = true;
+        } else {
+            return false;
+        }
+
+        width = H.width;
+        height = H.height;
+        mipLevels = std::max(1u, H.mipMapCount);
+        if (width == 0 || height == 0) return false;
+        levelOffsets.clear();
+        size = 0;
+        for (uint32_t level = 0; level < mipLevels; level++) {
+            levelOffsets.push_back(size);
+            size += ddsLevelSize(format, std::max(1u, width >> level), std::max(1u, height >> level));
+        }
+        if (fileSize < offset + size) return false;
+        data = file + offset;
+        return true;
+    }
+};
+
+// Writes a DDS file (DX10 header) around the levels, stored one after the other in levels
+inline std::vector<char> ddsWrite(DDSBlockFormat format, bool sRGB, uint32_t width, uint32_t height,
+                                  uint32_t mipLevels, const std::vector<char> &levels) {
+    uint32_t magic = DDS_MAGIC;
+    DDSHeader H{};
+    H.size = sizeof(DDSHeader);
+    H.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;  // CAPS, HEIGHT, WIDTH, PIXELFORMAT, MIPMAPCOUNT, LINEARSIZE
+    H.height = height;
+    H.width = width;
+    H.pitchOrLinearSize = static_cast<uint32_t>(ddsLevelSize(format, width, height));
+    H.mipMapCount = mipLevels;
+    H.pixelFormat.size = sizeof(DDSPixelFormat);
+    H.pixelFormat.flags = 0x4;  // FOURCC
+    H.pixelFormat.fourCC = DDS_FOURCC_DX10;
+    H.caps[0] = 0x1000 | 0x400000 | 0x8;  // TEXTURE, MIPMAP, COMPLEX
+    DDSHeaderDX10 D{};
+    D.dxgiFormat = (format == DDS_BC1) ? (sRGB ? DDS_DXGI_BC1_UNORM_SRGB : DDS_DXGI_BC1_UNORM)
+                                       : (sRGB ? DDS_DXGI_BC7_UNORM_SRGB : DDS_DXGI_BC7_UNORM);
+    D.resourceDimension = 3;  // TEXTURE2D
+    D.arraySize = 1;
+
+    std::vector<char> file(sizeof(magic) + sizeof(H) + sizeof(D) + levels.size());
+    memcpy(file.data(), &magic, sizeof(magic));
+    memcpy(file.data() + sizeof(magic), &H, sizeof(H));
+    memcpy(file.data() + sizeof(magic) + sizeof(H), &D, sizeof(D));
+    memcpy(file.data() + sizeof(magic) + sizeof(H) + sizeof(D), levels.data(), levels.size());
+    return file;
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+// glTF reading
+// Reader for the subset of glTF used by the models: meshes whose primitives have float POSITION, NORMAL,
+// TANGENT and TEXCOORD_0 attributes, and unsigned indices. Only the JSON document is parsed: buffers
+// embedded as base64 data URIs are decoded (with SSSE3 when the CPU supports it) straight into a buffer
+// of their exact size, external buffers are read from disk, and the accessors point directly into them.
+// Loaders copy from the accessors into their own vertex layout, so no other copy of the mesh is made.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GLTF_SSSE3 1
+#include <tmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define GLTF_TARGET_SSSE3
+#else
+#define GLTF_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+#define GLTF_COMPONENT_UNSIGNED_BYTE 5121
+#define GLTF_COMPONENT_UNSIGNED_SHORT 5123
+#define GLTF_COMPONENT_UNSIGNED_INT 5125
+#define GLTF_COMPONENT_FLOAT 5126
+
+// Base64 decoding
+// Returns the number of bytes encoded by a base64 string of the given length (padding included)
+inline size_t base64DecodedSize(const char *src, size_t length) {
+    if (length % 4 != 0) {
+        throw std::runtime_error("invalid base64 data length!");
+    }
+    size_t size = length / 4 * 3;
+    if (length > 0 && src[length - 1] == '=') size--;
+    if (length > 1 && src[length - 2] == '=') size--;
+    return size;
+}
+
+class Base64Decoder {
+    uint8_t lut[256];
+    bool ssse3 = false;
+
+    // Four characters into three bytes, throws on characters outside of the alphabet
+    void decodeScalar(const char *src, size_t length, uint8_t *dst) const {
+        for (size_t i = 0; i < length; i += 4) {
+            uint32_t a = lut[static_cast<uint8_t>(src[i])], b = lut[static_cast<uint8_t>(src[i + 1])];
+            uint32_t c = lut[static_cast<uint8_t>(src[i + 2])], d = lut[static_cast<uint8_t>(src[i + 3])];
+            bool last = (i + 4 == length);
+            if (last && src[i + 3] == '=') {
+                d = 0;
+                if (src[i + 2] == '=') c = 0;
+            }
+            if ((a | b | c | d) > 63) {
+                throw std::runtime_error("invalid base64 data!");
+            }
+            uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+            *dst++ = static_cast<uint8_t>(v >> 16);
+            if (last && src[i + 2] == '=') break;
+            *dst++ = static_cast<uint8_t>(v >> 8);
+            if (last && src[i + 3] == '=') break;
+            *dst++ = static_cast<uint8_t>(v);
+        }
+    }
+
+#ifdef GLTF_SSSE3
+    static bool cpuHasSSSE3() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;
+#else
+        return __builtin_cpu_supports("ssse3");
+#endif
+    }
+
+    // Sixteen characters into twelve bytes at a time: the characters are classified by their high and low
+    // nibbles with two shuffles, turned into 6-bit values adding a per-class offset, and then packed.
+    // Each step stores 16 bytes, so it stops while at least 24 characters are left; returns the number of
+    // characters it decoded.
+    GLTF_TARGET_SSSE3
+    static size_t decodeSSSE3(const char *src, size_t length, uint8_t *dst) {
+        const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        const __m128i slash = _mm_set1_epi8(0x2f);
+        const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; i + 24 <= length; i += 16, dst += 12) {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+            __m128i lo = _mm_and_si128(in, nibble);
+            __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, lo), _mm_shuffle_epi8(lutHi, hi));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xffff) {
+                throw std::runtime_error("invalid base64 data!");
+            }
+            __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(_mm_cmpeq_epi8(in, slash), hi));
+            __m128i values = _mm_add_epi8(in, roll);
+            __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+            merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(merged, pack));
+        }
+        return i;
+    }
+#endif
+
+public:
+    explicit Base64Decoder(bool allowSSSE3 = true) {
+        memset(lut, 0xff, sizeof(lut));
+        const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; i++) {
+            lut[static_cast<uint8_t>(alphabet[i])] = static_cast<uint8_t>(i);
+        }
+#ifdef GLTF_SSSE3
+        ssse3 = allowSSSE3 && cpuHasSSSE3();
+#endif
+    }
+
+    bool usesSSSE3() const { return ssse3; }
+
+    // dst must hold base64DecodedSize(src, length) bytes
+    void decode(const char *src, size_t length, uint8_t *dst) const {
+        base64DecodedSize(src, length);
+        size_t done = 0;
+#ifdef GLTF_SSSE3
+        if (ssse3) {
+            done = decodeSSSE3(src, length, dst);
+        }
+#endif
+        decodeScalar(src + done, length - done, dst + done / 4 * 3);
+    }
+
+    static const Base64Decoder &shared() {
+        static Base64Decoder decoder;
+        return decoder;
+    }
+};
+
+
+// Typed view over a buffer: element i starts at data + i * stride
+struct GLTFAccessor {
+    const uint8_t *data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int componentType = 0;
+    int components = 0;
+
+    bool isValid() const { return data != nullptr; }
+};
+
+struct GLTFPrimitive {
+    GLTFAccessor position;
+    GLTFAccessor normal;
+    GLTFAccessor tangent;
+    GLTFAccessor texCoord;
+    GLTFAccessor indices;
+};
+
+class GLTFReader {
+    std::vector<std::vector<uint8_t>> buffers;
+
+    static int componentSize(int componentType) {
+        switch (componentType) {
+            case 5120:
+            case GLTF_COMPONENT_UNSIGNED_BYTE:
+                return 1;
+            case 5122:
+            case GLTF_COMPONENT_UNSIGNED_SHORT:
+                return 2;
+            case GLTF_COMPONENT_UNSIGNED_INT:
+            case GLTF_COMPONENT_FLOAT:
+                return 4;
+            default:
+                throw std::runtime_error("unknown glTF component type " + std::to_string(componentType));
+        }
+    }
+
+    static int componentCount(const std::string &type) {
+        if (type == "SCALAR") return 1;
+        if (type == "VEC2") return 2;
+        if (type == "VEC3") return 3;
+        if (type == "VEC4") return 4;
+        if (type == "MAT4") return 16;
+        throw std::runtime_error("unsupported glTF accessor type " + type);
+    }
+
+    void loadBuffer(nlohmann::json &buffer, const std::string &baseDir) {
+        size_t byteLength = buffer.at("byteLength").get<size_t>();
+        std::vector<uint8_t> data;
+        if (!buffer.contains("uri")) {
+            throw std::runtime_error("glTF buffers without uri (GLB) are not supported!");
+        }
+        const std::string &uri = buffer["uri"].get_ref<const std::string &>();
+        if (uri.compare(0, 5, "data:") == 0) {
+            size_t comma = uri.find(";base64,");
+            if (comma == std::string::npos) {
+                throw std::runtime_error("glTF data uri is not base64 encoded!");
+            }
+            const char *src = uri.data() + comma + 8;
+            size_t length = uri.size() - comma - 8;
+            data.resize(base64DecodedSize(src, length));
+            Base64Decoder::shared().decode(src, length, data.data());
+        } else {
+            std::string path = baseDir + uri;
+            std::ifstream in(path, std::ios::ate | std::ios::binary);
+            if (!in.is_open()) {
+                throw std::runtime_error("failed to open glTF buffer " + path);
+            }
+            data.resize(static_cast<size_t>(in.tellg()));
+            in.seekg(0);
+            in.read(reinterpret_cast<char *>(data.data()), data.size());
+        }
+        if (data.size() < byteLength) {
+            throw std::runtime_error("glTF buffer shorter than its byteLength!");
+        }
+        // The base64 text is not needed anymore
+        buffer["uri"] = nullptr;
+        buffers.push_back(std::move(data));
+    }
+
+    GLTFAccessor accessor(const nlohmann::json &doc, int index) const {
+        const nlohmann::json &A = doc.at("accessors").at(index);
+        GLTFAccessor R;
+        R.count = A.at("count").get<size_t>();
+        R.componentType = A.at("componentType").get<int>();
+        R.components = componentCount(A.at("type").get<std::string>());
+        size_t elementSize = static_cast<size_t>(componentSize(R.componentType)) * R.components;
+        if (!A.contains("bufferView")) {
+            throw std::runtime_error("glTF accessors without bufferView are not supported!");
+        }
+        const nlohmann::json &V = doc.at("bufferViews").at(A["bufferView"].get<int>());
+        const std::vector<uint8_t> &B = buffers.at(V.at("buffer").get<size_t>());
+        size_t offset = V.value("byteOffset", static_cast<size_t>(0)) + A.value("byteOffset", static_cast<size_t>(0));
+        R.stride = V.value("byteStride", elementSize);
+        if (R.count > 0 && offset + (R.count - 1) * R.stride + elementSize > B.size()) {
+            throw std::runtime_error("glTF accessor out of the bounds of its buffer!");
+        }
+        R.data = B.data() + offset;
+        return R;
+    }
+
+public:
+    std::vector<GLTFPrimitive> primitives;
+
+    // Parses a glTF document; text is released once parsed. External buffers are looked up in baseDir.
+    void parse(std::vector<char> &text, const std::string &baseDir) {
+        nlohmann::json doc = nlohmann::json::parse(text.begin(), text.end(), nullptr, false);
+        text.clear();
+        text.shrink_to_fit();
+        if (doc.is_discarded()) {
+            throw std::runtime_error("failed to parse glTF document!");
+        }
+
+        buffers.clear();
+        primitives.clear();
+        if (doc.contains("buffers")) {
+            for (auto &buffer: doc["buffers"]) {
+                loadBuffer(buffer, baseDir);
+            }
+        }
+
+        if (!doc.contains("meshes")) return;
+        for (const auto &mesh: doc["meshes"]) {
+            for (const auto &primitive: mesh.at("primitives")) {
+                // Only indexed primitives are drawn
+                if (!primitive.contains("indices")) continue;
+                GLTFPrimitive P;
+                const nlohmann::json &attributes = primitive.at("attributes");
+                if (attributes.contains("POSITION")) P.position = accessor(doc, attributes["POSITION"].get<int>());
+                if (attributes.contains("NORMAL")) P.normal = accessor(doc, attributes["NORMAL"].get<int>());
+                if (attributes.contains("TANGENT")) P.tangent = accessor(doc, attributes["TANGENT"].get<int>());
+                if (attributes.contains("TEXCOORD_0")) P.texCoord = accessor(doc, attributes["TEXCOORD_0"].get<int>());
+                P.indices = accessor(doc, primitive["indices"].get<int>());
+                primitives.push_back(P);
+            }
+        }
+    }
+
+    void parseFile(const std::string &file) {
+        std::ifstream in(file, std::ios::ate | std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("failed to open " + file);
+        }
+        std::vector<char> text(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(text.data(), text.size());
+        size_t slash = file.find_last_of("/\\");
+        parse(text, (slash == std::string::npos) ? "" : file.substr(0, slash + 1));
+    }
+};
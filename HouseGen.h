@@ -11,6 +11,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "Vertex.h"
+#include "Culling.hpp"
+#include "OcclusionCulling.hpp"
 
 #define WALL_TEXTURES_PER_PIXEL (1.0f/4.0)
 #define N_ROOMS 5
@@ -72,12 +74,15 @@ class VertexStorage {
     std::vector<VertexWithTextID> &vPos;
     std::vector<uint32_t> &vIdx;
     std::vector<OpenableDoor> &openableDoors;
+    // Occlusion culling: every rectangle drawn is also an occluder
+    std::vector<Occluder> *occluders;
 public:
     VertexStorage(
             std::vector<VertexWithTextID> &vPos,
             std::vector<uint32_t> &vIdx,
-            std::vector<OpenableDoor> &openableDoors
-    ) : vPos(vPos), vIdx(vIdx), vertexCurIdx(vPos.size()), openableDoors(openableDoors) {}
+            std::vector<OpenableDoor> &openableDoors,
+            std::vector<Occluder> *occluders = nullptr
+    ) : vPos(vPos), vIdx(vIdx), vertexCurIdx(vPos.size()), openableDoors(openableDoors), occluders(occluders) {}
 
     uint32_t addVertex(VertexWithTextID color) {
         vPos.push_back(color);
@@ -102,6 +107,10 @@ public:
 
         addIndex(i0, i1, i2);
         addIndex(i2, i3, i0);
+
+        if (occluders != nullptr) {
+            occluders->push_back(Occluder{{bottomLeft, bottomRight, topRight, topLeft}});
+        }
     }
 
     void drawDoorFrame(glm::vec3 hingeCorner, Direction doorDirection, uint8_t tex) {
@@ -291,12 +300,13 @@ inline void
 floorPlanToVerIndexes(const std::vector<Room> &rooms, std::vector<VertexWithTextID> &vPos, std::vector<uint32_t> &vIdx,
                       std::vector<OpenableDoor> &openableDoors, std::vector<BoundingRectangle> *bounds,
                       std::vector<glm::vec3> *positionedLightPos, std::vector<glm::vec3> *roomCenters,
-                      std::vector<BoundingRectangle> *roomOccupiedArea) {
+                      std::vector<BoundingRectangle> *roomOccupiedArea, std::vector<uint32_t> *roomIndexEnds = nullptr,
+                      std::vector<Occluder> *occluders = nullptr) {
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_int_distribution<int> floorTexDistribution(1, 4);
 
-    VertexStorage storage(vPos, vIdx, openableDoors);
+    VertexStorage storage(vPos, vIdx, openableDoors, occluders);
     int test = 0;
 
     for (auto &room: rooms) {
@@ -485,10 +495,53 @@ floorPlanToVerIndexes(const std::vector<Room> &rooms, std::vector<VertexWithText
             );
         }
 
+        // Room/portal visibility: the indices of each room are drawn only when the room is visible
+        if (roomIndexEnds != nullptr) {
+            roomIndexEnds->push_back(static_cast<uint32_t>(vIdx.size()));
+        }
+
         test++;
     }
 }
 
+// Portal graph of the floorplan: one portal for each north or east door, in the same order of the OpenableDoors
+// made by floorPlanToVerIndexes. A door leading outside has the same room on both sides.
+inline std::vector<Portal> buildRoomPortals(const std::vector<Room> &rooms) {
+    std::vector<Portal> portals;
+    for (uint32_t i = 0; i < rooms.size(); i++) {
+        const Room &room = rooms[i];
+        for (Direction direction: {NORTH, EAST}) {
+            for (auto &door: room.doors) {
+                if (door.direction != direction) {
+                    continue;
+                }
+                Portal portal{{i, i}, glm::vec3(0.0f), glm::vec3(0.0f)};
+                glm::vec3 across;
+                if (direction == NORTH) {
+                    float z = room.startY + room.depth;
+                    portal.minCoords = glm::vec3(room.startX + door.offset - DOOR_HWIDTH, 0.0f, z);
+                    portal.maxCoords = glm::vec3(room.startX + door.offset + DOOR_HWIDTH, DOOR_HEIGHT, z + WALL_WIDTH);
+                    across = glm::vec3(room.startX + door.offset, 0.0f, z + 2 * WALL_WIDTH);
+                } else {
+                    float x = room.startX + room.width;
+                    portal.minCoords = glm::vec3(x, 0.0f, room.startY + door.offset - DOOR_HWIDTH);
+                    portal.maxCoords = glm::vec3(x + WALL_WIDTH, DOOR_HEIGHT, room.startY + door.offset + DOOR_HWIDTH);
+                    across = glm::vec3(x + 2 * WALL_WIDTH, 0.0f, room.startY + door.offset);
+                }
+                for (uint32_t j = 0; j < rooms.size(); j++) {
+                    const Room &other = rooms[j];
+                    if (across.x >= other.startX && across.x <= other.startX + other.width &&
+                        across.z >= other.startY && across.z <= other.startY + other.depth) {
+                        portal.cells[1] = j;
+                    }
+                }
+                portals.push_back(portal);
+            }
+        }
+    }
+    return portals;
+}
+
 
 inline void
 insertRectVertices(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 v3, std::vector<Vertex> *vPos,
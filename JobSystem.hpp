@@ -0,0 +1,148 @@
+#pragma once
+
+// Jobs
+// Minimal thread pool used to spread the CPU side of the loading over the available cores.
+// Jobs are grouped by a JobCounter: wait() returns once every job of that counter has run. The waiting
+// thread executes queued jobs in the meantime, so a job can itself start and wait for other jobs.
+// An exception thrown by a job is rethrown by wait().
+// threadIndex() tells the workers apart (from 1), so that a job can use data of its own thread.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+struct JobCounter {
+    std::atomic<int> pending{0};
+    std::exception_ptr error;
+};
+
+class JobSystem {
+    struct Job {
+        std::function<void()> f;
+        JobCounter *counter;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Job> queue;
+    std::mutex m;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobDone;
+    bool stopping = false;
+
+    void execute(Job &job) {
+        try {
+            job.f();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m);
+            if (!job.counter->error) job.counter->error = std::current_exception();
+        }
+        if (job.counter->pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(m);
+            jobDone.notify_all();
+        }
+    }
+
+    static unsigned &currentThread() {
+        static thread_local unsigned index = 0;
+        return index;
+    }
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(m);
+        while (true) {
+            jobAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            Job job = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            execute(job);
+            lock.lock();
+        }
+    }
+
+public:
+    explicit JobSystem(unsigned threads) {
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back([this, i] {
+                currentThread() = i + 1;
+                workerLoop();
+            });
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (auto &t: workers) t.join();
+    }
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // One worker per core, the thread calling wait() being the last one
+    static JobSystem &shared() {
+        static JobSystem js(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return js;
+    }
+
+    unsigned threadCount() const { return static_cast<unsigned>(workers.size()) + 1; }
+    // In [0, threadCount()): 0 for the threads that are not workers, as the one calling wait()
+    static unsigned threadIndex() { return currentThread(); }
+
+    void run(JobCounter &counter, std::function<void()> f) {
+        counter.pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            queue.push_back({std::move(f), &counter});
+        }
+        jobAvailable.notify_one();
+        jobDone.notify_all(); // lets a waiting thread pick it up as well
+    }
+
+    // Calls f(begin, end) on consecutive ranges covering [0, count): at most four ranges per thread,
+    // each one at least minChunk elements long. Returns when all of them are done.
+    template <class F>
+    void parallelFor(size_t count, size_t minChunk, F f) {
+        size_t chunks = std::min(count / std::max<size_t>(minChunk, 1), static_cast<size_t>(threadCount()) * 4);
+        if (chunks <= 1) {
+            f(static_cast<size_t>(0), count);
+            return;
+        }
+        JobCounter counter;
+        size_t step = (count + chunks - 1) / chunks;
+        for (size_t begin = 0; begin < count; begin += step) {
+            size_t end = std::min(count, begin + step);
+            run(counter, [&f, begin, end] { f(begin, end); });
+        }
+        wait(counter);
+    }
+
+    void wait(JobCounter &counter) {
+        std::unique_lock<std::mutex> lock(m);
+        while (counter.pending.load() > 0) {
+            if (!queue.empty()) {
+                Job job = std::move(queue.front());
+                queue.pop_front();
+                lock.unlock();
+                execute(job);
+                lock.lock();
+            } else {
+                jobDone.wait(lock);
+            }
+        }
+        if (counter.error) {
+            std::exception_ptr error = counter.error;
+            counter.error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+};
@@ -0,0 +1,326 @@
+#pragma once
+
+// MGCG decoding
+// An MGCG file is a glTF, deflated and then encrypted with AES-128 in CBC mode. Once decrypted, the
+// first 16 bytes hold the size of the inflated glTF as decimal text, and the deflate stream follows.
+//
+// CBC decryption has no serial dependency (P[i] = D(C[i]) ^ C[i-1]), so the blocks are decrypted in
+// place, in parallel chunks on the JobSystem, using AES-NI when the CPU supports it and a table based
+// implementation otherwise. The deflate stream is then inflated straight from the decrypted file buffer
+// into an output of the exact size: no other full size copy of the file is made.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include "JobSystem.hpp"
+// sinfl.h defines its implementation again at every inclusion when SINFL_IMPLEMENTATION is set
+#ifndef SINFL_H_INCLUDED
+#include <sinfl.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MGCG_AESNI 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MGCG_TARGET_AES
+#else
+#define MGCG_TARGET_AES __attribute__((target("aes,sse2")))
+#endif
+#endif
+
+#define MGCG_BLOCK 16
+#define MGCG_ROUNDS 10
+// Blocks decrypted by a single job: smaller files are decrypted directly by the calling thread
+#define MGCG_MIN_BLOCKS_PER_JOB 4096
+
+class MGCGDecoder {
+    // Encryption and decryption round keys, as bytes in memory order
+    uint8_t encKeys[MGCG_ROUNDS + 1][MGCG_BLOCK];
+    uint8_t decKeys[MGCG_ROUNDS + 1][MGCG_BLOCK];
+    // Tables of the portable path
+    uint8_t sbox[256];
+    uint8_t invSbox[256];
+    uint32_t Td[4][256];
+    uint32_t decWords[(MGCG_ROUNDS + 1) * 4];
+    bool aesni = false;
+
+    static uint8_t mul(uint8_t a, uint8_t b) {
+        uint8_t r = 0;
+        while (b) {
+            if (b & 1) r ^= a;
+            a = static_cast<uint8_t>((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+            b >>= 1;
+        }
+        return r;
+    }
+
+    static uint32_t load32(const uint8_t *p) {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    static void store32(uint8_t *p, uint32_t v) {
+        p[0] = uint8_t(v >> 24);
+        p[1] = uint8_t(v >> 16);
+        p[2] = uint8_t(v >> 8);
+        p[3] = uint8_t(v);
+    }
+
+    void initTables() {
+        // S-box from the multiplicative inverse in GF(2^8) followed by the affine transformation
+        uint8_t p = 1, q = 1;
+        do {
+            p = static_cast<uint8_t>(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));
+            q ^= q << 1;
+            q ^= q << 2;
+            q ^= q << 4;
+            if (q & 0x80) q ^= 0x09;
+            uint8_t x = q ^ static_cast<uint8_t>((q << 1) | (q >> 7)) ^ static_cast<uint8_t>((q << 2) | (q >> 6)) ^
+                        static_cast<uint8_t>((q << 3) | (q >> 5)) ^ static_cast<uint8_t>((q << 4) | (q >> 4));
+            sbox[p] = x ^ 0x63;
+        } while (p != 1);
+        sbox[0] = 0x63;
+        for (int i = 0; i < 256; i++) {
+            invSbox[sbox[i]] = static_cast<uint8_t>(i);
+        }
+        for (int i = 0; i < 256; i++) {
+            uint8_t s = invSbox[i];
+            uint32_t t = (uint32_t(mul(s, 0x0e)) << 24) | (uint32_t(mul(s, 0x09)) << 16) |
+                         (uint32_t(mul(s, 0x0d)) << 8) | uint32_t(mul(s, 0x0b));
+            for (int k = 0; k < 4; k++) {
+                Td[k][i] = t;
+                t = (t >> 8) | (t << 24);
+            }
+        }
+    }
+
+    void expandKey(const uint8_t key[MGCG_BLOCK]) {
+        static const uint8_t rcon[MGCG_ROUNDS] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+        uint32_t w[(MGCG_ROUNDS + 1) * 4];
+        for (int i = 0; i < 4; i++) {
+            w[i] = load32(key + 4 * i);
+        }
+        for (int i = 4; i < (MGCG_ROUNDS + 1) * 4; i++) {
+            uint32_t t = w[i - 1];
+            if (i % 4 == 0) {
+                t = (uint32_t(sbox[(t >> 16) & 0xff]) << 24) | (uint32_t(sbox[(t >> 8) & 0xff]) << 16) |
+                    (uint32_t(sbox[t & 0xff]) << 8) | uint32_t(sbox[t >> 24]);
+                t ^= uint32_t(rcon[i / 4 - 1]) << 24;
+            }
+            w[i] = w[i - 4] ^ t;
+        }
+        for (int r = 0; r <= MGCG_ROUNDS; r++) {
+            for (int i = 0; i < 4; i++) {
+                store32(encKeys[r] + 4 * i, w[4 * r + i]);
+            }
+        }
+
+        // Equivalent inverse cipher: keys in reverse order, InvMixColumns applied to the inner rounds
+        for (int r = 0; r <= MGCG_ROUNDS; r++) {
+            for (int i = 0; i < 4; i++) {
+                uint32_t k = w[4 * (MGCG_ROUNDS - r) + i];
+                if (r > 0 && r < MGCG_ROUNDS) {
+                    k = Td[0][sbox[k >> 24]] ^ Td[1][sbox[(k >> 16) & 0xff]] ^
+                        Td[2][sbox[(k >> 8) & 0xff]] ^ Td[3][sbox[k & 0xff]];
+                }
+                decWords[4 * r + i] = k;
+                store32(decKeys[r] + 4 * i, k);
+            }
+        }
+    }
+
+    // Decrypts n blocks in place; prev is the ciphertext block preceding the first one
+    void decryptPortable(uint8_t *data, size_t n, const uint8_t prev[MGCG_BLOCK]) const {
+        uint8_t chain[MGCG_BLOCK], cipher[MGCG_BLOCK];
+        memcpy(chain, prev, MGCG_BLOCK);
+        const uint32_t *rk = decWords;
+        for (size_t b = 0; b < n; b++) {
+            uint8_t *block = data + b * MGCG_BLOCK;
+            memcpy(cipher, block, MGCG_BLOCK);
+            uint32_t s0 = load32(block) ^ rk[0];
+            uint32_t s1 = load32(block + 4) ^ rk[1];
+            uint32_t s2 = load32(block + 8) ^ rk[2];
+            uint32_t s3 = load32(block + 12) ^ rk[3];
+            for (int r = 1; r < MGCG_ROUNDS; r++) {
+                const uint32_t *k = rk + 4 * r;
+                uint32_t t0 = Td[0][s0 >> 24] ^ Td[1][(s3 >> 16) & 0xff] ^ Td[2][(s2 >> 8) & 0xff] ^ Td[3][s1 & 0xff] ^ k[0];
+                uint32_t t1 = Td[0][s1 >> 24] ^ Td[1][(s0 >> 16) & 0xff] ^ Td[2][(s3 >> 8) & 0xff] ^ Td[3][s2 & 0xff] ^ k[1];
+                uint32_t t2 = Td[0][s2 >> 24] ^ Td[1][(s1 >> 16) & 0xff] ^ Td[2][(s0 >> 8) & 0xff] ^ Td[3][s3 & 0xff] ^ k[2];
+                uint32_t t3 = Td[0][s3 >> 24] ^ Td[1][(s2 >> 16) & 0xff] ^ Td[2][(s1 >> 8) & 0xff] ^ Td[3][s0 & 0xff] ^ k[3];
+                s0 = t0;
+                s1 = t1;
+                s2 = t2;
+                s3 = t3;
+            }
+            const uint32_t *k = rk + 4 * MGCG_ROUNDS;
+            uint32_t s[4] = {s0, s1, s2, s3};
+            for (int i = 0; i < 4; i++) {
+                uint32_t v = (uint32_t(invSbox[s[i] >> 24]) << 24) |
+                             (uint32_t(invSbox[(s[(i + 3) % 4] >> 16) & 0xff]) << 16) |
+                             (uint32_t(invSbox[(s[(i + 2) % 4] >> 8) & 0xff]) << 8) |
+                             uint32_t(invSbox[s[(i + 1) % 4] & 0xff]);
+                store32(block + 4 * i, v ^ k[i]);
+            }
+            for (int i = 0; i < MGCG_BLOCK; i++) {
+                block[i] ^= chain[i];
+            }
+            memcpy(chain, cipher, MGCG_BLOCK);
+        }
+    }
+
+#ifdef MGCG_AESNI
+    static bool cpuHasAESNI() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 25)) != 0;
+#else
+        return __builtin_cpu_supports("aes");
+#endif
+    }
+
+    // Four blocks at a time, to hide the latency of aesdec
+    MGCG_TARGET_AES
+    void decryptAESNI(uint8_t *data, size_t n, const uint8_t prev[MGCG_BLOCK]) const {
+        __m128i k[MGCG_ROUNDS + 1];
+        for (int r = 0; r <= MGCG_ROUNDS; r++) {
+            k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(decKeys[r]));
+        }
+        __m128i chain = _mm_loadu_si128(reinterpret_cast<const __m128i *>(prev));
+        __m128i *p = reinterpret_cast<__m128i *>(data);
+        size_t b = 0;
+        for (; b + 4 <= n; b += 4) {
+            __m128i c0 = _mm_loadu_si128(p + b), c1 = _mm_loadu_si128(p + b + 1);
+            __m128i c2 = _mm_loadu_si128(p + b + 2), c3 = _mm_loadu_si128(p + b + 3);
+            __m128i x0 = _mm_xor_si128(c0, k[0]), x1 = _mm_xor_si128(c1, k[0]);
+            __m128i x2 = _mm_xor_si128(c2, k[0]), x3 = _mm_xor_si128(c3, k[0]);
+            for (int r = 1; r < MGCG_ROUNDS; r++) {
+                x0 = _mm_aesdec_si128(x0, k[r]);
+                x1 = _mm_aesdec_si128(x1, k[r]);
+                x2 = _mm_aesdec_si128(x2, k[r]);
+                x3 = _mm_aesdec_si128(x3, k[r]);
+            }
+            x0 = _mm_aesdeclast_si128(x0, k[MGCG_ROUNDS]);
+            x1 = _mm_aesdeclast_si128(x1, k[MGCG_ROUNDS]);
+            x2 = _mm_aesdeclast_si128(x2, k[MGCG_ROUNDS]);
+            x3 = _mm_aesdeclast_si128(x3, k[MGCG_ROUNDS]);
+            _mm_storeu_si128(p + b, _mm_xor_si128(x0, chain));
+            _mm_storeu_si128(p + b + 1, _mm_xor_si128(x1, c0));
+            _mm_storeu_si128(p + b + 2, _mm_xor_si128(x2, c1));
+            _mm_storeu_si128(p + b + 3, _mm_xor_si128(x3, c2));
+            chain = c3;
+        }
+        for (; b < n; b++) {
+            __m128i c = _mm_loadu_si128(p + b);
+            __m128i x = _mm_xor_si128(c, k[0]);
+            for (int r = 1; r < MGCG_ROUNDS; r++) {
+                x = _mm_aesdec_si128(x, k[r]);
+            }
+            x = _mm_aesdeclast_si128(x, k[MGCG_ROUNDS]);
+            _mm_storeu_si128(p + b, _mm_xor_si128(x, chain));
+            chain = c;
+        }
+    }
+#endif
+
+    void decryptRange(uint8_t *data, size_t n, const uint8_t prev[MGCG_BLOCK]) const {
+#ifdef MGCG_AESNI
+        if (aesni) {
+            decryptAESNI(data, n, prev);
+            return;
+        }
+#endif
+        decryptPortable(data, n, prev);
+    }
+
+public:
+    explicit MGCGDecoder(const std::string &key = "CG2023SkelKey128", bool allowAESNI = true) {
+        if (key.size() != MGCG_BLOCK) {
+            throw std::runtime_error("MGCG key must be 128 bit long!");
+        }
+        initTables();
+        expandKey(reinterpret_cast<const uint8_t *>(key.data()));
+#ifdef MGCG_AESNI
+        aesni = allowAESNI && cpuHasAESNI();
+#endif
+    }
+
+    bool usesAESNI() const { return aesni; }
+
+    // Decrypts in place a whole CBC buffer
+    void decrypt(uint8_t *data, size_t size, const uint8_t iv[MGCG_BLOCK]) const {
+        if (size % MGCG_BLOCK != 0) {
+            throw std::runtime_error("MGCG data is not a multiple of the AES block size!");
+        }
+        size_t blocks = size / MGCG_BLOCK;
+        if (blocks < 2 * MGCG_MIN_BLOCKS_PER_JOB) {
+            decryptRange(data, blocks, iv);
+            return;
+        }
+
+        // Each chunk needs the last ciphertext block of the previous one, which is going to be
+        // overwritten concurrently: keep a copy of all of them before starting
+        JobSystem &jobs = JobSystem::shared();
+        size_t chunks = std::min(blocks / MGCG_MIN_BLOCKS_PER_JOB, static_cast<size_t>(jobs.threadCount()) * 4);
+        size_t step = (blocks + chunks - 1) / chunks;
+        std::vector<uint8_t> chains(chunks * MGCG_BLOCK);
+        memcpy(chains.data(), iv, MGCG_BLOCK);
+        for (size_t c = 1; c < chunks; c++) {
+            memcpy(&chains[c * MGCG_BLOCK], data + (c * step - 1) * MGCG_BLOCK, MGCG_BLOCK);
+        }
+        jobs.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                size_t first = c * step;
+                size_t last = std::min(blocks, first + step);
+                if (first < last) {
+                    decryptRange(data + first * MGCG_BLOCK, last - first, &chains[c * MGCG_BLOCK]);
+                }
+            }
+        });
+    }
+
+    // Decodes an MGCG file already in memory: data is decrypted in place, and the glTF text is returned
+    std::vector<char> decode(std::vector<char> &data) const {
+        static const uint8_t iv[MGCG_BLOCK] = {
+                0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+        };
+        if (data.size() < 2 * MGCG_BLOCK) {
+            throw std::runtime_error("MGCG file too short!");
+        }
+        uint8_t *bytes = reinterpret_cast<uint8_t *>(data.data());
+        decrypt(bytes, data.size(), iv);
+
+        int size = 0;
+        for (int i = 0; i < MGCG_BLOCK && bytes[i] >= '0' && bytes[i] <= '9'; i++) {
+            size = size * 10 + (bytes[i] - '0');
+        }
+        std::vector<char> out(size);
+        int n = sinflate(out.data(), size, bytes + MGCG_BLOCK, static_cast<int>(data.size()) - MGCG_BLOCK);
+        if (size == 0 || n != size) {
+            throw std::runtime_error("failed to inflate MGCG data!");
+        }
+        return out;
+    }
+
+    std::vector<char> decodeFile(const std::string &file) const {
+        std::ifstream in(file, std::ios::ate | std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("failed to open " + file);
+        }
+        std::vector<char> data(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(data.data(), data.size());
+        return decode(data);
+    }
+
+    // Key schedules and tables are built once
+    static const MGCGDecoder &shared() {
+        static MGCGDecoder decoder;
+        return decoder;
+    }
+};
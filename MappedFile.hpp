@@ -0,0 +1,76 @@
+#pragma once
+
+// Read-only view of a whole file: memory mapped on POSIX systems, read in memory at once elsewhere
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    std::vector<char> fileData;
+#else
+    int fd = -1;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    // Returns false if the file cannot be opened or is empty
+    bool open(const std::string &path) {
+        close();
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) return false;
+        fileData.resize(static_cast<size_t>(file.tellg()));
+        if (fileData.empty()) return false;
+        file.seekg(0);
+        file.read(fileData.data(), fileData.size());
+        data = fileData.data();
+        size = fileData.size();
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            close();
+            return false;
+        }
+        data = static_cast<const char *>(m);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        fileData.clear();
+        fileData.shrink_to_fit();
+#else
+        if (data != nullptr) munmap(const_cast<char *>(data), size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    bool isOpen() const { return data != nullptr; }
+};
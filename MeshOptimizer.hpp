@@ -0,0 +1,313 @@
+#pragma once
+
+// Mesh optimization
+// Applied to every model once its vertices and indices are known:
+//  1. identical vertices (same attributes) are welded, so that triangles share them through the index buffer;
+//  2. triangles are reordered for the post-transform vertex cache (Tipsify, Sander et al. 2007);
+//  3. the clusters found by Tipsify are sorted so that the outward facing ones are drawn first, reducing
+//     overdraw without giving up the cache locality inside each cluster;
+//  4. vertices are renumbered in the order the index buffer first references them, for fetch locality.
+// A mesh can be made of ranges of indices drawn separately (the rooms of the building): steps 2 and 3 are then
+// done inside each range, so that the triangles never leave the range they were in.
+// The quality of the index buffer is reported as ACMR (vertex shader invocations per triangle, for a FIFO
+// cache of MESH_OPTIMIZER_CACHE_SIZE entries): 3 without any reuse, around 0.6 for a good ordering.
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "Vertex.h"
+
+#define MESH_OPTIMIZER_CACHE_SIZE 16
+
+struct MeshOptimizerStats {
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    float acmrBefore = 0.0f;
+    float acmrAfter = 0.0f;
+};
+
+// Average cache miss ratio of a triangle list
+inline float meshACMR(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                      unsigned cacheSize = MESH_OPTIMIZER_CACHE_SIZE) {
+    if (indexCount < 3) return 0.0f;
+    std::vector<uint32_t> cachedAt(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (time - cachedAt[v] > cacheSize) {
+            cachedAt[v] = time++;
+            misses++;
+        }
+    }
+    return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+}
+
+// Fills remap with the index of the first vertex with the same bytes, and returns the number of distinct vertices
+inline size_t meshWeldVertices(uint32_t *remap, const void *vertices, size_t vertexCount, size_t stride) {
+    const auto *bytes = static_cast<const unsigned char *>(vertices);
+    size_t tableSize = 1;
+    while (tableSize < vertexCount * 2) tableSize *= 2;
+    std::vector<uint32_t> table(tableSize, UINT32_MAX);
+
+    size_t unique = 0;
+    for (size_t v = 0; v < vertexCount; v++) {
+        const unsigned char *vertex = bytes + v * stride;
+        uint32_t h = 2166136261u;
+        for (size_t b = 0; b < stride; b++) {
+            h = (h ^ vertex[b]) * 16777619u;
+        }
+        // Open addressing with linear probing
+        size_t slot = h & (tableSize - 1);
+        while (table[slot] != UINT32_MAX && memcmp(bytes + table[slot] * stride, vertex, stride) != 0) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = static_cast<uint32_t>(v);
+            unique++;
+        }
+        remap[v] = table[slot];
+    }
+    return unique;
+}
+
+// Welding key: the attributes of a vertex described by its VertexTraits, packed one after the other so that the
+// padding of the struct (as the one after the texture ID of VertexWithTextID) never takes part in the comparison
+template <class Vert>
+constexpr size_t meshVertexKeySize() {
+    using VT = VertexTraits<Vert>;
+    size_t size = 0;
+    if constexpr (VT::defined) {
+        if constexpr (VT::hasPosition) size += sizeof(glm::vec3);
+        if constexpr (VT::hasNormal) size += sizeof(glm::vec3);
+        if constexpr (VT::hasUV) size += sizeof(glm::vec2);
+        if constexpr (VT::hasColor) size += sizeof(glm::vec3);
+        if constexpr (VT::hasTexID) size += sizeof(uint8_t);
+    }
+    return size;
+}
+
+template <class Vert>
+void meshVertexKey(const Vert &vertex, unsigned char *key) {
+    using VT = VertexTraits<Vert>;
+    auto append = [&key](const void *attribute, size_t size) {
+        memcpy(key, attribute, size);
+        key += size;
+    };
+    if constexpr (VT::hasPosition) append(&(vertex.*VT::position), sizeof(glm::vec3));
+    if constexpr (VT::hasNormal) append(&(vertex.*VT::normal), sizeof(glm::vec3));
+    if constexpr (VT::hasUV) append(&(vertex.*VT::uv), sizeof(glm::vec2));
+    if constexpr (VT::hasColor) append(&(vertex.*VT::color), sizeof(glm::vec3));
+    if constexpr (VT::hasTexID) append(&(vertex.*VT::texID), sizeof(uint8_t));
+}
+
+// Tipsify: fans around the most recently used vertex that still has triangles, jumping elsewhere only at dead ends.
+// The output triangle where each jump happens starts a new cluster (clusters receives their first triangle).
+inline void meshOptimizeVertexCache(uint32_t *destination, const uint32_t *indices, size_t indexCount,
+                                    size_t vertexCount, std::vector<uint32_t> &clusters,
+                                    unsigned cacheSize = MESH_OPTIMIZER_CACHE_SIZE) {
+    size_t triangleCount = indexCount / 3;
+    clusters.clear();
+    if (triangleCount == 0) return;
+
+    // Triangles using each vertex
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++) live[indices[i]]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + live[v];
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; i++) adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+    std::vector<uint32_t> cachedAt(vertexCount, 0);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0, written = 0;
+    int64_t fan = indices[0];
+    clusters.push_back(0);
+
+    while (fan >= 0) {
+        candidates.clear();
+        for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; a++) {
+            uint32_t t = adjacency[a];
+            if (emitted[t]) continue;
+            emitted[t] = 1;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[3 * t + k];
+                destination[written++] = v;
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cachedAt[v] > cacheSize) cachedAt[v] = time++;
+            }
+        }
+
+        // Next fan: the candidate that stays in the cache while its remaining triangles are emitted, the oldest first
+        fan = -1;
+        int64_t priority = -1;
+        for (uint32_t v: candidates) {
+            if (live[v] == 0) continue;
+            int64_t p = 0;
+            if (time - cachedAt[v] + 2 * live[v] <= cacheSize) p = time - cachedAt[v];
+            if (p > priority) {
+                priority = p;
+                fan = v;
+            }
+        }
+        if (fan >= 0) continue;
+
+        while (!deadEnd.empty() && fan < 0) {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) fan = v;
+        }
+        if (fan >= 0) continue;
+
+        while (cursor < vertexCount && live[cursor] == 0) cursor++;
+        if (cursor < vertexCount) {
+            fan = static_cast<int64_t>(cursor);
+            clusters.push_back(static_cast<uint32_t>(written / 3));
+        }
+    }
+}
+
+// Sorts the clusters by how much they face away from the center of the mesh: those are the most likely to
+// occlude the others, so drawing them first lets the depth test reject more fragments
+inline void meshOptimizeOverdraw(uint32_t *indices, size_t indexCount, const std::vector<uint32_t> &clusters,
+                                 const void *vertices, size_t stride, size_t positionOffset) {
+    size_t triangleCount = indexCount / 3;
+    if (clusters.size() < 2) return;
+    const auto *bytes = static_cast<const unsigned char *>(vertices);
+    auto position = [&](uint32_t v, float p[3]) {
+        memcpy(p, bytes + v * stride + positionOffset, 3 * sizeof(float));
+    };
+
+    float meshCenter[3] = {0.0f, 0.0f, 0.0f};
+    float meshArea = 0.0f;
+    struct Cluster {
+        uint32_t first, end;
+        float center[3], normal[3], area;
+        float sortKey;
+    };
+    std::vector<Cluster> C(clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++) {
+        Cluster &K = C[c];
+        K = Cluster{clusters[c], (c + 1 < clusters.size()) ? clusters[c + 1] : static_cast<uint32_t>(triangleCount),
+                    {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0.0f, 0.0f};
+        for (uint32_t t = K.first; t < K.end; t++) {
+            float a[3], b[3], d[3];
+            position(indices[3 * t], a);
+            position(indices[3 * t + 1], b);
+            position(indices[3 * t + 2], d);
+            float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            float e2[3] = {d[0] - a[0], d[1] - a[1], d[2] - a[2]};
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            // |n| is twice the area: the normals are area weighted
+            float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; k++) {
+                K.center[k] += (a[k] + b[k] + d[k]) / 3.0f * area;
+                K.normal[k] += n[k];
+            }
+            K.area += area;
+        }
+        for (int k = 0; k < 3; k++) meshCenter[k] += K.center[k];
+        meshArea += K.area;
+        if (K.area > 0.0f) {
+            for (int k = 0; k < 3; k++) K.center[k] /= K.area;
+        }
+    }
+    if (meshArea <= 0.0f) return;
+    for (int k = 0; k < 3; k++) meshCenter[k] /= meshArea;
+
+    for (auto &K: C) {
+        float len = std::sqrt(K.normal[0] * K.normal[0] + K.normal[1] * K.normal[1] + K.normal[2] * K.normal[2]);
+        K.sortKey = 0.0f;
+        if (len > 0.0f) {
+            for (int k = 0; k < 3; k++) K.sortKey += (K.center[k] - meshCenter[k]) * K.normal[k] / len;
+        }
+    }
+    std::stable_sort(C.begin(), C.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(triangleCount * 3);
+    for (const auto &K: C) {
+        sorted.insert(sorted.end(), indices + 3 * K.first, indices + 3 * K.end);
+    }
+    std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+// Optimizes the mesh in place; positionOffset < 0 when the layout has no position (overdraw is then skipped).
+// rangeEnds, when not empty, holds the end of each range of indices (the last one is indices.size())
+template <class Vert>
+MeshOptimizerStats meshOptimize(std::vector<Vert> &vertices, std::vector<uint32_t> &indices, int positionOffset,
+                                const std::vector<uint32_t> &rangeEnds = {}) {
+    MeshOptimizerStats S;
+    S.verticesBefore = S.verticesAfter = vertices.size();
+    if (indices.empty() || indices.size() % 3 != 0 || vertices.empty()) return S;
+    S.acmrBefore = meshACMR(indices.data(), indices.size(), vertices.size());
+
+    // 1. Welding, on the attributes when they are all the struct holds besides its tail padding; the structs with
+    // members their traits do not describe (the screen position of VertexOverlay) have no padding and are compared
+    // as they are
+    std::vector<uint32_t> remap(vertices.size());
+    constexpr size_t keySize = meshVertexKeySize<Vert>();
+    if constexpr (keySize + alignof(Vert) > sizeof(Vert)) {
+        std::vector<unsigned char> keys(vertices.size() * keySize);
+        for (size_t v = 0; v < vertices.size(); v++) {
+            meshVertexKey(vertices[v], keys.data() + v * keySize);
+        }
+        meshWeldVertices(remap.data(), keys.data(), vertices.size(), keySize);
+    } else {
+        meshWeldVertices(remap.data(), vertices.data(), vertices.size(), sizeof(Vert));
+    }
+    for (auto &i: indices) i = remap[i];
+
+    // 2. and 3. Triangle order
+    std::vector<uint32_t> ordered(indices.size());
+    std::vector<uint32_t> clusters;
+    size_t rangeBegin = 0;
+    for (size_t r = 0; r < std::max<size_t>(rangeEnds.size(), 1); r++) {
+        size_t rangeEnd = rangeEnds.empty() ? indices.size() : rangeEnds[r];
+        if (rangeEnd == rangeBegin) {
+            continue;
+        }
+        if ((rangeEnd < rangeBegin) || (rangeEnd > indices.size()) || ((rangeEnd - rangeBegin) % 3 != 0)) {
+            // Not a list of triangles: the rest of the indices stays as it is
+            std::copy(indices.begin() + rangeBegin, indices.end(), ordered.begin() + rangeBegin);
+            break;
+        }
+        clusters.clear();
+        meshOptimizeVertexCache(ordered.data() + rangeBegin, indices.data() + rangeBegin, rangeEnd - rangeBegin,
+                                vertices.size(), clusters);
+        if (positionOffset >= 0) {
+            meshOptimizeOverdraw(ordered.data() + rangeBegin, rangeEnd - rangeBegin, clusters, vertices.data(),
+                                 sizeof(Vert), static_cast<size_t>(positionOffset));
+        }
+        rangeBegin = rangeEnd;
+    }
+    // Indices after the last range, if it ends before indices.size(), stay as they are
+    std::copy(indices.begin() + rangeBegin, indices.end(), ordered.begin() + rangeBegin);
+
+    // 4. Vertex order (this also drops the vertices merged by the welding)
+    std::fill(remap.begin(), remap.end(), UINT32_MAX);
+    std::vector<Vert> fetched;
+    fetched.reserve(vertices.size());
+    for (size_t i = 0; i < ordered.size(); i++) {
+        uint32_t &v = ordered[i];
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = static_cast<uint32_t>(fetched.size());
+            fetched.push_back(vertices[v]);
+        }
+        v = remap[v];
+    }
+    vertices.swap(fetched);
+    indices.swap(ordered);
+
+    S.verticesAfter = vertices.size();
+    S.acmrAfter = meshACMR(indices.data(), indices.size(), vertices.size());
+    return S;
+}
@@ -0,0 +1,368 @@
+#pragma once
+
+// Mesh simplification (levels of detail)
+// Quadric error metrics (Garland and Heckbert 1997): every vertex accumulates the planes of its triangles, weighted
+// by their area, in a quadric Q such that Q(p) is the sum of the squared distances of p from those planes. An edge
+// (a, b) is collapsed by moving a onto b, at the cost (Qa + Qb)(b): vertices only move onto other vertices, so a
+// level of detail is another range of indices over the same vertices, and all the levels of a Model share its
+// buffers. The collapses are done in passes: each pass sorts the edges by cost and takes the cheapest ones, as
+// long as the ring of the vertex they move has not been changed by another collapse of the same pass and none of
+// its triangles flips (or turns by more than about 75 degrees, since a few turns in a row would flip it), until
+// the target number of triangles (or the error limit) is reached.
+// The simplification works on positions: vertices with the same position but other attributes (the seams of
+// normals and UVs) move together, each corner taking the vertex of the destination with the closest normal.
+// Vertices on the open borders of the mesh, and on edges shared by more than two triangles, never move.
+// The error of a level is the square root of its largest collapse cost, an estimate of how far its surface is
+// from the original one in model units. Projected on the screen, it selects the level drawn (see lodSelect).
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include "MeshOptimizer.hpp"
+
+// Levels of a Model, the full mesh included
+#define MESH_LOD_COUNT 4
+// Triangles kept by each level, from the full mesh: 1/2, 1/4, 1/8
+#define MESH_LOD_RATIO 0.5f
+// A level is kept only if it has at most this fraction of the triangles of the previous one
+#define MESH_LOD_MIN_REDUCTION 0.8f
+// Error limit of the levels, relative to the radius of the mesh
+#define MESH_LOD_MAX_ERROR 0.1f
+// A level is drawn when its error covers at most LOD_PIXEL_ERROR pixels, with a margin of LOD_HYSTERESIS around
+// the threshold so that objects at the switching distance do not change level every frame
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS 0.25f
+
+struct MeshLod {
+    uint32_t firstIndex = 0;    // in the index buffer of the mesh
+    uint32_t indexCount = 0;
+    float error = 0.0f;         // in model units, 0 for the full mesh
+};
+
+// Symmetric 4x4 matrix of a quadric, Q(p) = p A p + 2 b p + c, and the sum of the weights of its planes: the
+// cost of a position is the average of the squared distances, weighted by the areas of the triangles
+struct MeshQuadric {
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0, c = 0;
+    double weight = 0;
+
+    // Plane n p + d = 0 (n unit length), with a weight
+    static MeshQuadric plane(glm::dvec3 n, double d, double w) {
+        MeshQuadric Q;
+        Q.a00 = w * n.x * n.x; Q.a01 = w * n.x * n.y; Q.a02 = w * n.x * n.z;
+        Q.a11 = w * n.y * n.y; Q.a12 = w * n.y * n.z; Q.a22 = w * n.z * n.z;
+        Q.b0 = w * d * n.x; Q.b1 = w * d * n.y; Q.b2 = w * d * n.z;
+        Q.c = w * d * d;
+        Q.weight = w;
+        return Q;
+    }
+
+    MeshQuadric &operator+=(const MeshQuadric &o) {
+        a00 += o.a00; a01 += o.a01; a02 += o.a02; a11 += o.a11; a12 += o.a12; a22 += o.a22;
+        b0 += o.b0; b1 += o.b1; b2 += o.b2; c += o.c;
+        weight += o.weight;
+        return *this;
+    }
+
+    double operator()(glm::vec3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                   2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return (weight > 0.0) ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+// Simplifies the triangles of indices (indexCount of them), returning at most about targetIndexCount indices
+// (fewer collapses are done when they would exceed maxError). error receives the error of the result.
+// positionOffset and normalOffset are the byte offsets of the position and of the normal (a glm::vec3) in a
+// vertex; normalOffset < 0 when there is none
+template <class Vert>
+std::vector<uint32_t> meshSimplify(const std::vector<Vert> &vertices, const uint32_t *indices, size_t indexCount,
+                                   size_t positionOffset, int normalOffset, size_t targetIndexCount, float maxError,
+                                   float &error) {
+    error = 0.0f;
+    std::vector<uint32_t> result(indices, indices + indexCount);
+    if (indexCount % 3 != 0 || vertices.empty()) return result;
+    const char *bytes = reinterpret_cast<const char *>(vertices.data());
+    auto attribute = [&](uint32_t v, size_t offset) {
+        glm::vec3 a;
+        memcpy(&a, bytes + v * sizeof(Vert) + offset, sizeof(a));
+        return a;
+    };
+
+    // Positions shared by the vertices (seams), and the vertices of each one
+    std::vector<uint32_t> positionOf(vertices.size());
+    std::vector<glm::vec3> positions;
+    std::vector<std::vector<uint32_t>> wedges;
+    {
+        std::vector<uint32_t> remap(vertices.size());
+        std::vector<glm::vec3> all(vertices.size());
+        for (uint32_t v = 0; v < vertices.size(); v++) all[v] = attribute(v, positionOffset);
+        meshWeldVertices(remap.data(), all.data(), all.size(), sizeof(glm::vec3));
+        std::vector<uint32_t> id(vertices.size(), UINT32_MAX);
+        for (uint32_t v = 0; v < vertices.size(); v++) {
+            uint32_t r = remap[v];
+            if (id[r] == UINT32_MAX) {
+                id[r] = static_cast<uint32_t>(positions.size());
+                positions.push_back(all[r]);
+                wedges.emplace_back();
+            }
+            positionOf[v] = id[r];
+            wedges[id[r]].push_back(v);
+        }
+    }
+    for (auto &i: result) {
+        if (i >= vertices.size()) return std::vector<uint32_t>(indices, indices + indexCount);
+    }
+
+    // Quadrics of the planes of the triangles, and the vertices that cannot move
+    size_t positionCount = positions.size();
+    std::vector<MeshQuadric> quadrics(positionCount);
+    std::unordered_map<uint64_t, uint32_t> edgeTriangles;
+    auto edgeKey = [](uint32_t a, uint32_t b) {
+        return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+    };
+    for (size_t t = 0; t < indexCount; t += 3) {
+        uint32_t p[3] = {positionOf[result[t]], positionOf[result[t + 1]], positionOf[result[t + 2]]};
+        glm::dvec3 a(positions[p[0]]), b(positions[p[1]]), c(positions[p[2]]);
+        glm::dvec3 n = glm::cross(b - a, c - a);
+        double area = glm::length(n);
+        if (area > 0.0) {
+            n /= area;
+            MeshQuadric Q = MeshQuadric::plane(n, -glm::dot(n, a), area * 0.5);
+            for (uint32_t k: p) quadrics[k] += Q;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (p[k] != p[(k + 1) % 3]) edgeTriangles[edgeKey(p[k], p[(k + 1) % 3])]++;
+        }
+    }
+    std::vector<uint8_t> locked(positionCount, 0);
+    for (const auto &E: edgeTriangles) {
+        if (E.second != 2) {
+            locked[E.first >> 32] = 1;
+            locked[E.first & 0xFFFFFFFFu] = 1;
+        }
+    }
+
+    // Position each position has been moved onto, followed to the end
+    std::vector<uint32_t> collapsedTo(positionCount);
+    for (uint32_t p = 0; p < positionCount; p++) collapsedTo[p] = p;
+    auto find = [&](uint32_t p) {
+        uint32_t root = p;
+        while (collapsedTo[root] != root) root = collapsedTo[root];
+        while (collapsedTo[p] != root) {
+            uint32_t next = collapsedTo[p];
+            collapsedTo[p] = root;
+            p = next;
+        }
+        return root;
+    };
+
+    double maxCost = static_cast<double>(maxError) * maxError;
+    double worstCost = 0.0;
+    size_t targetTriangles = targetIndexCount / 3;
+    std::vector<uint32_t> triangles(result);     // corners as positions, updated at each pass
+    for (auto &i: triangles) i = positionOf[i];
+    std::vector<uint32_t> alive;                 // triangles not yet degenerate
+    for (uint32_t t = 0; t < indexCount / 3; t++) {
+        if (triangles[3 * t] != triangles[3 * t + 1] && triangles[3 * t + 1] != triangles[3 * t + 2] &&
+            triangles[3 * t + 2] != triangles[3 * t]) {
+            alive.push_back(t);
+        }
+    }
+
+    struct Collapse {
+        uint32_t from, to;
+        double cost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> ringFirst(positionCount + 1), ring;
+    std::vector<uint8_t> touched(positionCount);
+    while (alive.size() > targetTriangles) {
+        // Triangles around each position
+        std::fill(ringFirst.begin(), ringFirst.end(), 0);
+        for (uint32_t t: alive) {
+            for (int k = 0; k < 3; k++) ringFirst[triangles[3 * t + k] + 1]++;
+        }
+        for (size_t p = 0; p < positionCount; p++) ringFirst[p + 1] += ringFirst[p];
+        ring.resize(ringFirst[positionCount]);
+        std::vector<uint32_t> fill(ringFirst.begin(), ringFirst.end() - 1);
+        for (uint32_t t: alive) {
+            for (int k = 0; k < 3; k++) ring[fill[triangles[3 * t + k]]++] = t;
+        }
+
+        // Cheapest direction of each edge
+        collapses.clear();
+        for (uint32_t t: alive) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = triangles[3 * t + k], b = triangles[3 * t + (k + 1) % 3];
+                if (a > b) continue;  // once per edge in a consistently oriented mesh (twice does no harm)
+                MeshQuadric Q = quadrics[a];
+                Q += quadrics[b];
+                double toB = locked[a] ? -1.0 : Q(positions[b]);
+                double toA = locked[b] ? -1.0 : Q(positions[a]);
+                if (toB < 0.0 && toA < 0.0) continue;
+                if (toA < 0.0 || (toB >= 0.0 && toB <= toA)) {
+                    collapses.push_back({a, b, toB});
+                } else {
+                    collapses.push_back({b, a, toA});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t remaining = alive.size();
+        size_t done = 0;
+        for (const auto &C: collapses) {
+            if (remaining <= targetTriangles || C.cost > maxCost) break;
+            if (touched[C.from] || touched[C.to]) continue;
+
+            // The triangles of from that stay must not flip, nor turn too much
+            bool flips = false;
+            size_t removed = 0;
+            for (uint32_t r = ringFirst[C.from]; r < ringFirst[C.from + 1] && !flips; r++) {
+                const uint32_t *T = &triangles[3 * ring[r]];
+                if (T[0] == C.to || T[1] == C.to || T[2] == C.to) {
+                    removed++;
+                    continue;
+                }
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++) {
+                    before[k] = positions[T[k]];
+                    after[k] = positions[(T[k] == C.from) ? C.to : T[k]];
+                }
+                glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+                flips = glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1);
+            }
+            if (flips) continue;
+
+            collapsedTo[C.from] = C.to;
+            quadrics[C.to] += quadrics[C.from];
+            worstCost = std::max(worstCost, C.cost);
+            for (uint32_t r = ringFirst[C.from]; r < ringFirst[C.from + 1]; r++) {
+                for (int k = 0; k < 3; k++) touched[triangles[3 * ring[r] + k]] = 1;
+            }
+            remaining -= removed;
+            done++;
+        }
+        if (done == 0) break;
+
+        // Moves the corners and drops the degenerate triangles
+        size_t kept = 0;
+        for (uint32_t t: alive) {
+            uint32_t *T = &triangles[3 * t];
+            for (int k = 0; k < 3; k++) T[k] = find(T[k]);
+            if (T[0] != T[1] && T[1] != T[2] && T[2] != T[0]) alive[kept++] = t;
+        }
+        alive.resize(kept);
+    }
+
+    // Each corner takes the vertex at its final position with the normal closest to its own
+    result.clear();
+    for (uint32_t t: alive) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[3 * t + k];
+            uint32_t p = triangles[3 * t + k];
+            if (positionOf[v] != p) {
+                uint32_t best = wedges[p][0];
+                if (normalOffset >= 0) {
+                    glm::vec3 n = attribute(v, normalOffset);
+                    float bestDot = -2.0f;
+                    for (uint32_t w: wedges[p]) {
+                        float d = glm::dot(n, attribute(w, normalOffset));
+                        if (d > bestDot) {
+                            bestDot = d;
+                            best = w;
+                        }
+                    }
+                }
+                v = best;
+            }
+            result.push_back(v);
+        }
+    }
+    error = static_cast<float>(std::sqrt(worstCost));
+    return result;
+}
+
+// Appends to indices the levels of detail of the mesh (the full mesh is level 0), each one optimized for the vertex
+// cache and for overdraw, and returns their ranges. Levels stop when they no longer reduce the triangles enough
+template <class Vert>
+std::vector<MeshLod> meshBuildLods(const std::vector<Vert> &vertices, std::vector<uint32_t> &indices,
+                                   size_t positionOffset, int normalOffset, uint32_t levels = MESH_LOD_COUNT) {
+    std::vector<MeshLod> lods;
+    MeshLod full;
+    full.indexCount = static_cast<uint32_t>(indices.size());
+    lods.push_back(full);
+    if (indices.empty() || indices.size() % 3 != 0) return lods;
+
+    glm::vec3 boxMin(std::numeric_limits<float>::max()), boxMax(std::numeric_limits<float>::lowest());
+    for (uint32_t i: indices) {
+        glm::vec3 p;
+        memcpy(&p, reinterpret_cast<const char *>(&vertices[i]) + positionOffset, sizeof(p));
+        boxMin = glm::min(boxMin, p);
+        boxMax = glm::max(boxMax, p);
+    }
+    float maxError = MESH_LOD_MAX_ERROR * glm::length(boxMax - boxMin) * 0.5f;
+
+    size_t fullCount = indices.size();
+    float ratio = 1.0f;
+    std::vector<uint32_t> clusters;
+    for (uint32_t level = 1; level < levels; level++) {
+        ratio *= MESH_LOD_RATIO;
+        size_t target = static_cast<size_t>(static_cast<float>(fullCount / 3) * ratio) * 3;
+        float error;
+        std::vector<uint32_t> simplified = meshSimplify(vertices, indices.data(), fullCount, positionOffset,
+                                                        normalOffset, target, maxError, error);
+        if (simplified.empty() ||
+            static_cast<float>(simplified.size()) > MESH_LOD_MIN_REDUCTION * static_cast<float>(lods.back().indexCount)) {
+            break;
+        }
+
+        std::vector<uint32_t> ordered(simplified.size());
+        clusters.clear();
+        meshOptimizeVertexCache(ordered.data(), simplified.data(), simplified.size(), vertices.size(), clusters);
+        meshOptimizeOverdraw(ordered.data(), ordered.size(), clusters, vertices.data(), sizeof(Vert), positionOffset);
+
+        MeshLod L;
+        L.firstIndex = static_cast<uint32_t>(indices.size());
+        L.indexCount = static_cast<uint32_t>(ordered.size());
+        L.error = error;
+        indices.insert(indices.end(), ordered.begin(), ordered.end());
+        lods.push_back(L);
+    }
+    return lods;
+}
+
+// Pixels covered by a length of one unit of the model, at the nearest point of its bounding sphere (in world
+// space). The scale of the projection is the length of the second row of the view projection (its view part is
+// a rotation); w is the distance from the camera along the view direction
+inline float lodPixelsPerUnit(const glm::mat4 &viewProjection, float screenHeight, glm::vec3 center, float radius,
+                              float modelScale = 1.0f) {
+    float projection = glm::length(glm::vec3(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]));
+    glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    float w = glm::dot(row3, glm::vec4(center, 1.0f)) - radius;
+    return modelScale * projection * screenHeight * 0.5f / std::max(w, 1e-3f);
+}
+
+// Level to draw, from the one drawn in the previous frame: the coarsest whose error stays under LOD_PIXEL_ERROR
+// pixels, moving to a finer one only beyond the threshold plus the hysteresis, to a coarser one only below minus it
+inline uint32_t lodSelect(const std::vector<MeshLod> &lods, float pixelsPerUnit, uint32_t current) {
+    if (lods.empty()) return 0;
+    uint32_t lod = std::min(current, static_cast<uint32_t>(lods.size() - 1));
+    while (lod > 0 && lods[lod].error * pixelsPerUnit > LOD_PIXEL_ERROR * (1.0f + LOD_HYSTERESIS)) {
+        lod--;
+    }
+    while (lod + 1 < lods.size() && lods[lod + 1].error * pixelsPerUnit <= LOD_PIXEL_ERROR * (1.0f - LOD_HYSTERESIS)) {
+        lod++;
+    }
+    return lod;
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+// Meshlets
+// A mesh is split into clusters of consecutive triangles (meshlets) with at most MESHLET_MAX_VERTICES distinct
+// vertices and MESHLET_MAX_TRIANGLES triangles, following the index buffer: once optimized for the vertex cache
+// (see MeshOptimizer.hpp) its triangles come in compact patches, so each meshlet is a range of the indices and
+// the mesh needs no other index buffer. For culling, each meshlet keeps:
+//  - a bounding sphere, centered in the bounding box of its vertices;
+//  - a normal cone, whose axis is the average normal of its triangles and whose cutoff is the sine of the angle
+//    between the axis and the farthest normal (1 when the normals are too spread, so that it is never culled).
+// Seen from a camera in e, every triangle of a meshlet faces away when
+//     dot(center - e, axis) >= cutoff * length(center - e) + radius
+// which holds for every point of the sphere and every normal of the cone. The triangles are oriented as the
+// vertex normals of the mesh, not by their winding. The test only holds for meshes drawn with back faces
+// culled: the meshlets of a double sided mesh (drawn with VK_CULL_MODE_NONE) get no cone, as their back
+// faces are visible. meshClosed() tells which meshes can be drawn with back faces culled.
+// The test is done on the GPU by shaders/Meshlets.comp, together with the frustum test of the sphere.
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// Below this dot product between the axis and a normal, the cone is disabled
+#define MESHLET_CONE_MIN_DOT 0.1f
+
+// Same layout as the std430 buffer of shaders/Meshlets.comp
+struct Meshlet {
+    alignas(16) glm::vec4 sphere;   // center and radius, in model space
+    alignas(16) glm::vec4 cone;     // axis and cutoff
+    alignas(4) uint32_t firstIndex; // first index of its triangles in the index buffer of the mesh
+    alignas(4) uint32_t triangleCount;
+    alignas(4) uint32_t vertexCount;
+};
+
+struct MeshletStats {
+    size_t meshlets = 0;
+    size_t triangles = 0;
+    size_t vertices = 0;    // vertices of the meshlets: the shared ones are counted once per meshlet
+    size_t withCone = 0;    // meshlets that can be culled by their cone
+};
+
+// Sphere and cone of the triangles of indices [first, end)
+inline void meshletBounds(Meshlet &M, const uint32_t *indices, size_t first, size_t end, const char *vertices,
+                          size_t stride, size_t positionOffset, int normalOffset, bool doubleSided) {
+    auto attribute = [&](uint32_t v, size_t offset) {
+        glm::vec3 a;
+        memcpy(&a, vertices + v * stride + offset, sizeof(a));
+        return a;
+    };
+
+    glm::vec3 boxMin(std::numeric_limits<float>::max()), boxMax(std::numeric_limits<float>::lowest());
+    for (size_t i = first; i < end; i++) {
+        glm::vec3 p = attribute(indices[i], positionOffset);
+        boxMin = glm::min(boxMin, p);
+        boxMax = glm::max(boxMax, p);
+    }
+    glm::vec3 center = (boxMin + boxMax) * 0.5f;
+    float radius = 0.0f;
+    for (size_t i = first; i < end; i++) {
+        radius = std::max(radius, glm::length(attribute(indices[i], positionOffset) - center));
+    }
+    M.sphere = glm::vec4(center, radius);
+    M.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    if (doubleSided) return;
+
+    // Unit normals of the triangles with an area
+    std::vector<glm::vec3> normals;
+    normals.reserve((end - first) / 3);
+    glm::vec3 sum(0.0f);
+    for (size_t i = first; i < end; i += 3) {
+        glm::vec3 a = attribute(indices[i], positionOffset);
+        glm::vec3 n = glm::cross(attribute(indices[i + 1], positionOffset) - a,
+                                 attribute(indices[i + 2], positionOffset) - a);
+        float length = glm::length(n);
+        if (!(length > 0.0f)) continue;
+        n /= length;
+        if (normalOffset >= 0) {
+            glm::vec3 vertexNormals = attribute(indices[i], normalOffset) + attribute(indices[i + 1], normalOffset) +
+                                      attribute(indices[i + 2], normalOffset);
+            if (glm::dot(n, vertexNormals) < 0.0f) n = -n;
+        }
+        normals.push_back(n);
+        sum += n;
+    }
+
+    float sumLength = glm::length(sum);
+    if (normals.empty() || !(sumLength > 0.0f)) return;
+    glm::vec3 axis = sum / sumLength;
+    float minDot = 1.0f;
+    for (const auto &n: normals) {
+        minDot = std::min(minDot, glm::dot(axis, n));
+    }
+    if (minDot <= MESHLET_CONE_MIN_DOT) return;
+    M.cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+}
+
+// Whether the triangles of indices [first, end) enclose a volume with their counterclockwise side outwards, so
+// that their back faces are never seen from outside: every edge is shared by exactly two triangles, in opposite
+// directions, and the signed volume is positive. The vertices are identified by their position, as the copies
+// of a point with other normals or UVs do not open the surface
+template <class Vert>
+bool meshClosed(const std::vector<Vert> &vertices, const std::vector<uint32_t> &indices, size_t positionOffset,
+                size_t first = 0, size_t end = SIZE_MAX) {
+    end = std::min(end, indices.size());
+    if (first >= end || (end - first) % 3 != 0) return false;
+    auto position = [&](uint32_t v) {
+        glm::vec3 p;
+        memcpy(&p, reinterpret_cast<const char *>(vertices.data()) + v * sizeof(Vert) + positionOffset, sizeof(p));
+        return p;
+    };
+
+    // Each vertex is replaced by the first one with the same position
+    std::vector<uint32_t> order(vertices.size()), point(vertices.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&](uint32_t a, uint32_t b) {
+        glm::vec3 pa = position(a), pb = position(b);
+        return std::tie(pa.x, pa.y, pa.z) < std::tie(pb.x, pb.y, pb.z);
+    };
+    std::sort(order.begin(), order.end(), less);
+    for (size_t i = 0; i < order.size(); i++) {
+        point[order[i]] = (i > 0 && !less(order[i - 1], order[i])) ? point[order[i - 1]] : order[i];
+    }
+
+    // Directed edges, (from << 32) | to
+    std::unordered_map<uint64_t, uint32_t> edges;
+    float volume = 0.0f;
+    for (size_t i = first; i < end; i += 3) {
+        if (indices[i] >= vertices.size() || indices[i + 1] >= vertices.size() || indices[i + 2] >= vertices.size()) {
+            return false;
+        }
+        uint32_t v[3] = {point[indices[i]], point[indices[i + 1]], point[indices[i + 2]]};
+        if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) continue;
+        for (int k = 0; k < 3; k++) {
+            edges[(static_cast<uint64_t>(v[k]) << 32) | v[(k + 1) % 3]]++;
+        }
+        volume += glm::dot(position(v[0]), glm::cross(position(v[1]), position(v[2])));
+    }
+    for (const auto &edge: edges) {
+        auto opposite = edges.find((edge.first << 32) | (edge.first >> 32));
+        if (edge.second != 1 || opposite == edges.end() || opposite->second != 1) return false;
+    }
+    return !edges.empty() && volume > 0.0f;
+}
+
+// Splits the triangle list indices [first, end) into meshlets (their firstIndex is still from the beginning of
+// indices). positionOffset and normalOffset are the byte offsets of the position and of the normal (a glm::vec3)
+// in a vertex; normalOffset < 0 when there is none: the triangles are then oriented by their winding
+// (counterclockwise). doubleSided meshes get no normal cone. The meshlets are added to stats
+template <class Vert>
+std::vector<Meshlet> meshletBuild(const std::vector<Vert> &vertices, const std::vector<uint32_t> &indices,
+                                  size_t positionOffset, int normalOffset, bool doubleSided,
+                                  MeshletStats *stats = nullptr, size_t first = 0, size_t end = SIZE_MAX) {
+    std::vector<Meshlet> meshlets;
+    end = std::min(end, indices.size());
+    if (first > end || (end - first) % 3 != 0) return meshlets;
+
+    // Meshlet in which each vertex has last been counted
+    std::vector<uint32_t> countedIn(vertices.size(), UINT32_MAX);
+    uint32_t vertexCount = 0;
+    auto emit = [&](size_t meshletEnd) {
+        Meshlet M{};
+        M.firstIndex = static_cast<uint32_t>(first);
+        M.triangleCount = static_cast<uint32_t>((meshletEnd - first) / 3);
+        M.vertexCount = vertexCount;
+        meshletBounds(M, indices.data(), first, meshletEnd, reinterpret_cast<const char *>(vertices.data()),
+                      sizeof(Vert), positionOffset, normalOffset, doubleSided);
+        meshlets.push_back(M);
+        first = meshletEnd;
+        vertexCount = 0;
+    };
+    // Vertices of triangle t not yet in the current meshlet
+    auto newVertices = [&](size_t t) {
+        uint32_t id = static_cast<uint32_t>(meshlets.size());
+        const uint32_t *v = &indices[3 * t];
+        uint32_t count = (countedIn[v[0]] != id) ? 1 : 0;
+        count += (countedIn[v[1]] != id && v[1] != v[0]) ? 1 : 0;
+        count += (countedIn[v[2]] != id && v[2] != v[0] && v[2] != v[1]) ? 1 : 0;
+        return count;
+    };
+
+    for (size_t t = first / 3; t < end / 3; t++) {
+        if (indices[3 * t] >= vertices.size() || indices[3 * t + 1] >= vertices.size() ||
+            indices[3 * t + 2] >= vertices.size()) {
+            return {};
+        }
+        uint32_t added = newVertices(t);
+        if ((3 * t > first) && ((vertexCount + added > MESHLET_MAX_VERTICES) ||
+                                (3 * t - first >= 3 * MESHLET_MAX_TRIANGLES))) {
+            emit(3 * t);
+            added = newVertices(t);
+        }
+        for (int k = 0; k < 3; k++) {
+            countedIn[indices[3 * t + k]] = static_cast<uint32_t>(meshlets.size());
+        }
+        vertexCount += added;
+    }
+    if (end > first) {
+        emit(end);
+    }
+
+    if (stats != nullptr) {
+        stats->meshlets += meshlets.size();
+        for (const auto &M: meshlets) {
+            stats->triangles += M.triangleCount;
+            stats->vertices += M.vertexCount;
+            stats->withCone += (M.cone.w < 1.0f) ? 1 : 0;
+        }
+    }
+    return meshlets;
+}
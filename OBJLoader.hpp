@@ -0,0 +1,436 @@
+#pragma once
+
+// OBJ loading
+// Parallel parser for the subset of OBJ used by the models: positions (with the vertex colors extension),
+// normals, texture coordinates and faces; every other statement is ignored. The file is split in line
+// aligned chunks parsed on the JobSystem, and the chunks are merged in file order, so the result does not
+// depend on the number of threads.
+// The result is the same tinyobj::LoadObj gave to Model::loadModelOBJ: numbers are parsed with the same
+// arithmetic, quads are split along the same diagonal and larger polygons with the same ear clipping.
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "JobSystem.hpp"
+
+// Chunks smaller than this are not worth a job
+#define OBJ_MIN_CHUNK_SIZE (64 * 1024)
+
+struct OBJCorner {
+    int32_t v, vt, vn; // -1 when missing
+};
+
+struct OBJData {
+    std::vector<float> positions;   // xyz
+    std::vector<float> colors;      // rgb, white for the vertices without color
+    std::vector<float> normals;     // xyz
+    std::vector<float> texCoords;   // uv
+    std::vector<OBJCorner> corners; // three per triangle
+};
+
+class OBJParser {
+    // Relative (negative) indices of a chunk are resolved once the elements of the previous chunks are known
+    enum : uint8_t { RELATIVE_V = 1, RELATIVE_VT = 2, RELATIVE_VN = 4 };
+
+    struct Chunk {
+        const char *begin, *end;
+        std::vector<float> positions, colors, normals, texCoords;
+        std::vector<OBJCorner> faceCorners;
+        std::vector<uint8_t> relative;
+        std::vector<uint32_t> faceSizes;
+        std::vector<OBJCorner> triangles;
+        size_t positionBase = 0, normalBase = 0, texCoordBase = 0;
+    };
+
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    // Same algorithm as tinyobj's tryParseDouble
+    static bool parseDouble(const char *s, const char *end, double &result) {
+        if (s >= end) return false;
+        double mantissa = 0.0;
+        int exponent = 0;
+        char sign = '+', expSign = '+';
+        const char *p = s;
+        int read = 0;
+        bool leadingDot = false;
+
+        if (*p == '+' || *p == '-') {
+            sign = *p++;
+            if (p != end && *p == '.') leadingDot = true;
+        } else if (*p == '.') {
+            leadingDot = true;
+        } else if (!isDigit(*p)) {
+            return false;
+        }
+
+        if (!leadingDot) {
+            while (p != end && isDigit(*p)) {
+                mantissa *= 10;
+                mantissa += static_cast<int>(*p - '0');
+                p++;
+                read++;
+            }
+            if (read == 0) return false;
+        }
+        if (p != end && *p == '.') {
+            static const double powLut[] = {1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001};
+            p++;
+            read = 1;
+            while (p != end && isDigit(*p)) {
+                mantissa += static_cast<int>(*p - '0') * (read < 8 ? powLut[read] : std::pow(10.0, -read));
+                read++;
+                p++;
+            }
+        } else if (p == end || (*p != 'e' && *p != 'E')) {
+            result = (sign == '+' ? 1 : -1) * mantissa;
+            return true;
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (p != end && (*p == '+' || *p == '-')) {
+                expSign = *p++;
+            } else if (p == end || !isDigit(*p)) {
+                return false;
+            }
+            read = 0;
+            while (p != end && isDigit(*p)) {
+                if (exponent > 2147483647 / 10) return false;
+                exponent = exponent * 10 + static_cast<int>(*p - '0');
+                p++;
+                read++;
+            }
+            exponent *= (expSign == '+' ? 1 : -1);
+            if (read == 0) return false;
+        }
+        result = (sign == '+' ? 1 : -1) *
+                 (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+        return true;
+    }
+
+    // Parses the next blank separated token of the line; ok is false (and the value is the default) if it is not a number
+    static float parseReal(const char *&p, const char *lineEnd, double defaultValue, bool *ok = nullptr) {
+        while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+        const char *tokenEnd = p;
+        while (tokenEnd < lineEnd && *tokenEnd != ' ' && *tokenEnd != '\t' && *tokenEnd != '\r') tokenEnd++;
+        double value = defaultValue;
+        bool parsed = parseDouble(p, tokenEnd, value);
+        if (ok != nullptr) *ok = parsed;
+        p = tokenEnd;
+        return static_cast<float>(parsed ? value : defaultValue);
+    }
+
+    // atoi, bounded by the end of the line
+    static int parseInt(const char *p, const char *lineEnd) {
+        while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) p++;
+        int sign = 1;
+        if (p < lineEnd && (*p == '+' || *p == '-')) {
+            if (*p == '-') sign = -1;
+            p++;
+        }
+        int value = 0;
+        while (p < lineEnd && isDigit(*p)) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        return sign * value;
+    }
+
+    static void skipIndex(const char *&p, const char *lineEnd) {
+        while (p < lineEnd && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    }
+
+    static void fixIndex(const char *p, const char *lineEnd, size_t count, int32_t &index, uint8_t &relative,
+                         uint8_t flag) {
+        int i = parseInt(p, lineEnd);
+        if (i > 0) {
+            index = i - 1;
+        } else if (i < 0) {
+            index = static_cast<int32_t>(count) + i;
+            relative |= flag;
+        } else {
+            throw std::runtime_error("Failed parse `f' line(e.g. zero value for face index)");
+        }
+    }
+
+    // v, v/vt, v//vn or v/vt/vn
+    static void parseCorner(const char *&p, const char *lineEnd, Chunk &C) {
+        OBJCorner corner{-1, -1, -1};
+        uint8_t relative = 0;
+        fixIndex(p, lineEnd, C.positions.size() / 3, corner.v, relative, RELATIVE_V);
+        skipIndex(p, lineEnd);
+        if (p < lineEnd && *p == '/') {
+            p++;
+            if (p < lineEnd && *p == '/') {
+                p++;
+                fixIndex(p, lineEnd, C.normals.size() / 3, corner.vn, relative, RELATIVE_VN);
+                skipIndex(p, lineEnd);
+            } else {
+                fixIndex(p, lineEnd, C.texCoords.size() / 2, corner.vt, relative, RELATIVE_VT);
+                skipIndex(p, lineEnd);
+                if (p < lineEnd && *p == '/') {
+                    p++;
+                    fixIndex(p, lineEnd, C.normals.size() / 3, corner.vn, relative, RELATIVE_VN);
+                    skipIndex(p, lineEnd);
+                }
+            }
+        }
+        C.faceCorners.push_back(corner);
+        C.relative.push_back(relative);
+    }
+
+    static void parseChunk(Chunk &C) {
+        const char *p = C.begin;
+        while (p < C.end) {
+            const char *lineEnd = static_cast<const char *>(memchr(p, '\n', C.end - p));
+            const char *next = (lineEnd == nullptr) ? C.end : lineEnd + 1;
+            if (lineEnd == nullptr) lineEnd = C.end;
+            if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+
+            while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+            if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                p += 2;
+                for (int k = 0; k < 3; k++) C.positions.push_back(parseReal(p, lineEnd, 0.0));
+                bool r, g = false, b = false;
+                float color[3];
+                color[0] = parseReal(p, lineEnd, 0.0, &r);
+                if (r) color[1] = parseReal(p, lineEnd, 0.0, &g);
+                if (g) color[2] = parseReal(p, lineEnd, 0.0, &b);
+                for (int k = 0; k < 3; k++) C.colors.push_back(b ? color[k] : 1.0f);
+            } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+                p += 3;
+                for (int k = 0; k < 3; k++) C.normals.push_back(parseReal(p, lineEnd, 0.0));
+            } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+                p += 3;
+                for (int k = 0; k < 2; k++) C.texCoords.push_back(parseReal(p, lineEnd, 0.0));
+            } else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                p += 2;
+                while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+                size_t first = C.faceCorners.size();
+                while (p < lineEnd && *p != '\r') {
+                    parseCorner(p, lineEnd, C);
+                    while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+                }
+                C.faceSizes.push_back(static_cast<uint32_t>(C.faceCorners.size() - first));
+            }
+            p = next;
+        }
+    }
+
+    static void emit(std::vector<OBJCorner> &out, const OBJCorner &a, const OBJCorner &b, const OBJCorner &c) {
+        out.push_back(a);
+        out.push_back(b);
+        out.push_back(c);
+    }
+
+    static bool pointInTriangle(const float *x, const float *y, float px, float py) {
+        bool inside = false;
+        for (int i = 0, j = 2; i < 3; j = i++) {
+            if (((y[i] > py) != (y[j] > py)) && (px < (x[j] - x[i]) * (py - y[i]) / (y[j] - y[i]) + x[i]))
+                inside = !inside;
+        }
+        return inside;
+    }
+
+    // Ear clipping on the plane the polygon is most aligned with
+    static void triangulatePolygon(std::vector<OBJCorner> &out, const OBJCorner *face, size_t n,
+                                   const std::vector<float> &v) {
+        auto valid = [&](const OBJCorner &c, size_t component) {
+            return static_cast<size_t>(c.v) * 3 + component < v.size();
+        };
+
+        size_t axes[2] = {1, 2};
+        for (size_t k = 0; k < n; k++) {
+            const OBJCorner &i0 = face[k], &i1 = face[(k + 1) % n], &i2 = face[(k + 2) % n];
+            if (!valid(i0, 2) || !valid(i1, 2) || !valid(i2, 2)) continue;
+            const float *v0 = &v[3 * i0.v], *v1 = &v[3 * i1.v], *v2 = &v[3 * i2.v];
+            float e0x = v1[0] - v0[0], e0y = v1[1] - v0[1], e0z = v1[2] - v0[2];
+            float e1x = v2[0] - v1[0], e1y = v2[1] - v1[1], e1z = v2[2] - v1[2];
+            float cx = std::fabs(e0y * e1z - e0z * e1y);
+            float cy = std::fabs(e0z * e1x - e0x * e1z);
+            float cz = std::fabs(e0x * e1y - e0y * e1x);
+            const float epsilon = std::numeric_limits<float>::epsilon();
+            if (cx > epsilon || cy > epsilon || cz > epsilon) {
+                if (!(cx > cy && cx > cz)) {
+                    axes[0] = 0;
+                    if (cz > cx && cz > cy) axes[1] = 1;
+                }
+                break;
+            }
+        }
+
+        std::vector<OBJCorner> remaining(face, face + n);
+        size_t guess = 0;
+        size_t iterations = n, previousSize = n;
+        OBJCorner ind[3];
+        float vx[3], vy[3];
+        while (remaining.size() > 3 && iterations > 0) {
+            n = remaining.size();
+            if (guess >= n) guess -= n;
+            if (previousSize != n) {
+                previousSize = n;
+                iterations = n;
+            } else {
+                iterations--;
+            }
+
+            for (size_t k = 0; k < 3; k++) {
+                ind[k] = remaining[(guess + k) % n];
+                bool inside = valid(ind[k], axes[0]) && valid(ind[k], axes[1]);
+                vx[k] = inside ? v[ind[k].v * 3 + axes[0]] : 0.0f;
+                vy[k] = inside ? v[ind[k].v * 3 + axes[1]] : 0.0f;
+            }
+            float e0x = vx[1] - vx[0], e0y = vy[1] - vy[0];
+            float e1x = vx[2] - vx[1], e1y = vy[2] - vy[1];
+            float cross = e0x * e1y - e0y * e1x;
+            float area = (vx[0] * vy[1] - vy[0] * vx[1]) * 0.5f;
+            // Internal angle
+            if (cross * area < 0.0f) {
+                guess++;
+                continue;
+            }
+
+            // The ear must not contain any other vertex
+            bool overlap = false;
+            for (size_t other = 3; other < n; other++) {
+                const OBJCorner &o = remaining[(guess + other) % n];
+                if (!valid(o, axes[0]) || !valid(o, axes[1])) continue;
+                if (pointInTriangle(vx, vy, v[o.v * 3 + axes[0]], v[o.v * 3 + axes[1]])) {
+                    overlap = true;
+                    break;
+                }
+            }
+            if (overlap) {
+                guess++;
+                continue;
+            }
+
+            emit(out, ind[0], ind[1], ind[2]);
+            remaining.erase(remaining.begin() + static_cast<std::ptrdiff_t>((guess + 1) % n));
+        }
+        if (remaining.size() == 3) {
+            emit(out, remaining[0], remaining[1], remaining[2]);
+        }
+    }
+
+    // Faces with less than three vertices are skipped, quads are split along their shortest diagonal
+    static void triangulate(Chunk &C, const std::vector<float> &v) {
+        size_t corner = 0;
+        C.triangles.reserve(C.faceCorners.size());
+        for (uint32_t n: C.faceSizes) {
+            const OBJCorner *f = C.faceCorners.data() + corner;
+            corner += n;
+            if (n == 3) {
+                emit(C.triangles, f[0], f[1], f[2]);
+            } else if (n == 4) {
+                bool valid = true;
+                for (int k = 0; k < 4; k++) valid &= (f[k].v >= 0 && 3 * size_t(f[k].v) + 2 < v.size());
+                if (!valid) continue;
+                const float *v0 = &v[3 * f[0].v], *v1 = &v[3 * f[1].v], *v2 = &v[3 * f[2].v], *v3 = &v[3 * f[3].v];
+                float e02x = v2[0] - v0[0], e02y = v2[1] - v0[1], e02z = v2[2] - v0[2];
+                float e13x = v3[0] - v1[0], e13y = v3[1] - v1[1], e13z = v3[2] - v1[2];
+                float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+                float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+                if (sqr02 < sqr13) {
+                    emit(C.triangles, f[0], f[1], f[2]);
+                    emit(C.triangles, f[0], f[2], f[3]);
+                } else {
+                    emit(C.triangles, f[0], f[1], f[3]);
+                    emit(C.triangles, f[1], f[2], f[3]);
+                }
+            } else if (n > 4) {
+                triangulatePolygon(C.triangles, f, n, v);
+            }
+        }
+        C.faceCorners.clear();
+        C.faceCorners.shrink_to_fit();
+    }
+
+    template <class T>
+    static void append(std::vector<T> &dst, size_t offset, const std::vector<T> &src) {
+        if (!src.empty()) memcpy(dst.data() + offset, src.data(), src.size() * sizeof(T));
+    }
+
+public:
+    // Throws on malformed faces
+    static void parse(const char *data, size_t size, OBJData &out, JobSystem &jobs = JobSystem::shared()) {
+        // Line aligned chunks
+        size_t count = std::max<size_t>(1, std::min<size_t>(size / OBJ_MIN_CHUNK_SIZE, jobs.threadCount() * 4));
+        std::vector<Chunk> chunks(count);
+        const char *begin = data, *end = data + size;
+        for (size_t c = 0; c < count; c++) {
+            const char *chunkEnd = (c + 1 == count) ? end : data + size * (c + 1) / count;
+            if (chunkEnd < begin) chunkEnd = begin;
+            const char *newline = static_cast<const char *>(memchr(chunkEnd, '\n', end - chunkEnd));
+            chunkEnd = (c + 1 == count || newline == nullptr) ? end : newline + 1;
+            chunks[c].begin = begin;
+            chunks[c].end = chunkEnd;
+            begin = chunkEnd;
+        }
+        jobs.parallelFor(count, 1, [&](size_t b, size_t e) {
+            for (size_t c = b; c < e; c++) parseChunk(chunks[c]);
+        });
+
+        // Merge, in file order
+        size_t positions = 0, normals = 0, texCoords = 0;
+        for (auto &C: chunks) {
+            C.positionBase = positions;
+            C.normalBase = normals;
+            C.texCoordBase = texCoords;
+            positions += C.positions.size();
+            normals += C.normals.size();
+            texCoords += C.texCoords.size();
+        }
+        out.positions.resize(positions);
+        out.colors.resize(positions);
+        out.normals.resize(normals);
+        out.texCoords.resize(texCoords);
+        jobs.parallelFor(count, 1, [&](size_t b, size_t e) {
+            for (size_t c = b; c < e; c++) {
+                Chunk &C = chunks[c];
+                append(out.positions, C.positionBase, C.positions);
+                append(out.colors, C.positionBase, C.colors);
+                append(out.normals, C.normalBase, C.normals);
+                append(out.texCoords, C.texCoordBase, C.texCoords);
+                for (size_t i = 0; i < C.faceCorners.size(); i++) {
+                    OBJCorner &corner = C.faceCorners[i];
+                    if (C.relative[i] & RELATIVE_V) corner.v += static_cast<int32_t>(C.positionBase / 3);
+                    if (C.relative[i] & RELATIVE_VT) corner.vt += static_cast<int32_t>(C.texCoordBase / 2);
+                    if (C.relative[i] & RELATIVE_VN) corner.vn += static_cast<int32_t>(C.normalBase / 3);
+                }
+                C.positions = std::vector<float>();
+                C.colors = std::vector<float>();
+                C.normals = std::vector<float>();
+                C.texCoords = std::vector<float>();
+                C.relative = std::vector<uint8_t>();
+            }
+        });
+
+        // Triangulation needs every position, since quads are split according to their shape
+        jobs.parallelFor(count, 1, [&](size_t b, size_t e) {
+            for (size_t c = b; c < e; c++) triangulate(chunks[c], out.positions);
+        });
+        size_t corners = 0;
+        for (const auto &C: chunks) corners += C.triangles.size();
+        out.corners.resize(corners);
+        corners = 0;
+        for (const auto &C: chunks) {
+            append(out.corners, corners, C.triangles);
+            corners += C.triangles.size();
+        }
+
+        auto inRange = [](int32_t index, size_t size, size_t components) {
+            return index >= 0 && static_cast<size_t>(index) * components + components <= size;
+        };
+        for (const auto &corner: out.corners) {
+            if (!inRange(corner.v, out.positions.size(), 3) ||
+                (corner.vn != -1 && !inRange(corner.vn, out.normals.size(), 3)) ||
+                (corner.vt != -1 && !inRange(corner.vt, out.texCoords.size(), 2))) {
+                throw std::runtime_error("OBJ face index out of bounds!");
+            }
+        }
+    }
+};
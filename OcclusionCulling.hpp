@@ -0,0 +1,273 @@
+#pragma once
+
+// Occlusion culling
+// A small depth buffer (OCCLUSION_WIDTH x OCCLUSION_HEIGHT) rendered on the CPU every frame with a few large
+// occluders (the walls, floors and ceilings of the building), against which the bounding boxes of the objects
+// are tested before their draws are recorded. Pixels are processed in rows of 8 with AVX, of 4 with SSE, one
+// at a time otherwise.
+// Both sides are conservative, so that no visible object is ever culled: an occluder writes only the pixels it
+// covers entirely, with the farthest depth it has inside them (the pieces of a wall leave thin cracks between
+// them), while a box is tested on every pixel it touches with its nearest depth. Depths are the z / w of
+// Vulkan, in [0, 1]: the buffer is cleared to 1 and keeps the nearest occluder of each pixel.
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+
+// A quad, with its corners in order around it
+struct Occluder {
+    glm::vec3 corners[4];
+};
+
+// Lanes of the rasterizer: a float per pixel, and a mask of the pixels being written or tested
+#if defined(__AVX__)
+#define OCCLUSION_LANES 8
+typedef __m256 OcclusionFloats;
+inline OcclusionFloats occlusionSet(float x) { return _mm256_set1_ps(x); }
+inline OcclusionFloats occlusionRamp() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+inline OcclusionFloats occlusionLoad(const float *p) { return _mm256_loadu_ps(p); }
+inline void occlusionStore(float *p, OcclusionFloats a) { _mm256_storeu_ps(p, a); }
+inline OcclusionFloats occlusionAdd(OcclusionFloats a, OcclusionFloats b) { return _mm256_add_ps(a, b); }
+inline OcclusionFloats occlusionMul(OcclusionFloats a, OcclusionFloats b) { return _mm256_mul_ps(a, b); }
+inline OcclusionFloats occlusionMin(OcclusionFloats a, OcclusionFloats b) { return _mm256_min_ps(a, b); }
+inline OcclusionFloats occlusionGE(OcclusionFloats a, OcclusionFloats b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline OcclusionFloats occlusionLE(OcclusionFloats a, OcclusionFloats b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline OcclusionFloats occlusionAnd(OcclusionFloats a, OcclusionFloats b) { return _mm256_and_ps(a, b); }
+inline OcclusionFloats occlusionSelect(OcclusionFloats mask, OcclusionFloats a, OcclusionFloats b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+inline bool occlusionAny(OcclusionFloats mask) { return _mm256_movemask_ps(mask) != 0; }
+#elif defined(__SSE2__) || defined(_M_X64)
+#define OCCLUSION_LANES 4
+typedef __m128 OcclusionFloats;
+inline OcclusionFloats occlusionSet(float x) { return _mm_set1_ps(x); }
+inline OcclusionFloats occlusionRamp() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+inline OcclusionFloats occlusionLoad(const float *p) { return _mm_loadu_ps(p); }
+inline void occlusionStore(float *p, OcclusionFloats a) { _mm_storeu_ps(p, a); }
+inline OcclusionFloats occlusionAdd(OcclusionFloats a, OcclusionFloats b) { return _mm_add_ps(a, b); }
+inline OcclusionFloats occlusionMul(OcclusionFloats a, OcclusionFloats b) { return _mm_mul_ps(a, b); }
+inline OcclusionFloats occlusionMin(OcclusionFloats a, OcclusionFloats b) { return _mm_min_ps(a, b); }
+inline OcclusionFloats occlusionGE(OcclusionFloats a, OcclusionFloats b) { return _mm_cmpge_ps(a, b); }
+inline OcclusionFloats occlusionLE(OcclusionFloats a, OcclusionFloats b) { return _mm_cmple_ps(a, b); }
+inline OcclusionFloats occlusionAnd(OcclusionFloats a, OcclusionFloats b) { return _mm_and_ps(a, b); }
+inline OcclusionFloats occlusionSelect(OcclusionFloats mask, OcclusionFloats a, OcclusionFloats b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+inline bool occlusionAny(OcclusionFloats mask) { return _mm_movemask_ps(mask) != 0; }
+#else
+#define OCCLUSION_LANES 1
+typedef float OcclusionFloats;  // masks are 1 or 0
+inline OcclusionFloats occlusionSet(float x) { return x; }
+inline OcclusionFloats occlusionRamp() { return 0.0f; }
+inline OcclusionFloats occlusionLoad(const float *p) { return *p; }
+inline void occlusionStore(float *p, OcclusionFloats a) { *p = a; }
+inline OcclusionFloats occlusionAdd(OcclusionFloats a, OcclusionFloats b) { return a + b; }
+inline OcclusionFloats occlusionMul(OcclusionFloats a, OcclusionFloats b) { return a * b; }
+inline OcclusionFloats occlusionMin(OcclusionFloats a, OcclusionFloats b) { return std::min(a, b); }
+inline OcclusionFloats occlusionGE(OcclusionFloats a, OcclusionFloats b) { return (a >= b) ? 1.0f : 0.0f; }
+inline OcclusionFloats occlusionLE(OcclusionFloats a, OcclusionFloats b) { return (a <= b) ? 1.0f : 0.0f; }
+inline OcclusionFloats occlusionAnd(OcclusionFloats a, OcclusionFloats b) { return a * b; }
+inline OcclusionFloats occlusionSelect(OcclusionFloats mask, OcclusionFloats a, OcclusionFloats b) {
+    return (mask != 0.0f) ? a : b;
+}
+inline bool occlusionAny(OcclusionFloats mask) { return mask != 0.0f; }
+#endif
+
+static_assert(OCCLUSION_WIDTH % 8 == 0, "Rows of the occlusion buffer are processed 8 pixels at a time");
+
+// Pixel of a coordinate, inside [first, last]
+inline int occlusionPixel(float v, int first, int last) {
+    return static_cast<int>(std::clamp(v, static_cast<float>(first), static_cast<float>(last)));
+}
+
+struct OcclusionStats {
+    uint32_t occluders = 0;     // drawn, after the near plane
+    uint32_t triangles = 0;
+    uint32_t tested = 0;        // boxes
+    uint32_t occluded = 0;
+};
+
+struct OcclusionBuffer {
+    std::vector<float> depth = std::vector<float>(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    OcclusionStats stats;
+
+    // Starts a frame seen through M
+    void clear(const glm::mat4 &M) {
+        viewProjection = M;
+        std::fill(depth.begin(), depth.end(), 1.0f);
+        stats = OcclusionStats();
+    }
+
+    void render(const std::vector<Occluder> &occluders) {
+        for (const auto &O: occluders) {
+            renderQuad(O);
+        }
+    }
+
+    void renderQuad(const Occluder &O) {
+        // Clipping against the near plane (z >= 0), in clip space
+        glm::vec4 clip[4], polygon[5];
+        for (int i = 0; i < 4; i++) {
+            clip[i] = viewProjection * glm::vec4(O.corners[i], 1.0f);
+        }
+        int n = 0;
+        for (int i = 0; i < 4; i++) {
+            const glm::vec4 &a = clip[i], &b = clip[(i + 1) % 4];
+            if (a.z >= 0.0f) {
+                polygon[n++] = a;
+            }
+            if ((a.z >= 0.0f) != (b.z >= 0.0f)) {
+                polygon[n++] = a + (b - a) * (a.z / (a.z - b.z));
+            }
+        }
+        if (n < 3) {
+            return;
+        }
+        glm::vec3 screen[5];
+        for (int i = 0; i < n; i++) {
+            float w = std::max(polygon[i].w, 1e-6f);
+            screen[i] = glm::vec3((polygon[i].x / w * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+                                  (polygon[i].y / w * 0.5f + 0.5f) * OCCLUSION_HEIGHT, polygon[i].z / w);
+        }
+        stats.occluders++;
+        for (int i = 2; i < n; i++) {
+            rasterizeTriangle(screen[0], screen[i - 1], screen[i]);
+        }
+    }
+
+    // x and y in pixels, z the depth
+    void rasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (std::abs(area) < 1e-6f) {
+            return;
+        }
+        // Occluders are seen from both sides
+        if (area < 0.0f) {
+            std::swap(v1, v2);
+            area = -area;
+        }
+        float left = std::floor(std::min({v0.x, v1.x, v2.x})), right = std::ceil(std::max({v0.x, v1.x, v2.x}));
+        float bottom = std::floor(std::min({v0.y, v1.y, v2.y})), top = std::ceil(std::max({v0.y, v1.y, v2.y}));
+        if (right < 0.0f || left >= OCCLUSION_WIDTH || top < 0.0f || bottom >= OCCLUSION_HEIGHT) {
+            return;
+        }
+        int minX = occlusionPixel(left, 0, OCCLUSION_WIDTH - 1), maxX = occlusionPixel(right, 0, OCCLUSION_WIDTH - 1);
+        int minY = occlusionPixel(bottom, 0, OCCLUSION_HEIGHT - 1), maxY = occlusionPixel(top, 0, OCCLUSION_HEIGHT - 1);
+        stats.triangles++;
+
+        // Edge functions A x + B y + C, positive inside: edge i is opposite to vertex i
+        const glm::vec3 *v[3] = {&v0, &v1, &v2};
+        float A[3], B[3], C[3];
+        for (int i = 0; i < 3; i++) {
+            const glm::vec3 &a = *v[(i + 1) % 3], &b = *v[(i + 2) % 3];
+            A[i] = a.y - b.y;
+            B[i] = b.x - a.x;
+            C[i] = a.x * b.y - b.x * a.y;
+        }
+        // Depth as a plane, from the barycentric coordinates (edge function / area)
+        float dzdx = (A[0] * v0.z + A[1] * v1.z + A[2] * v2.z) / area;
+        float dzdy = (B[0] * v0.z + B[1] * v1.z + B[2] * v2.z) / area;
+        float z0 = (C[0] * v0.z + C[1] * v1.z + C[2] * v2.z) / area;
+        // Pixel centers, moved to the corner of the pixel farthest inside each edge (for the coverage) and to the
+        // farthest depth of the pixel
+        float zMax = std::max({v0.z, v1.z, v2.z});
+        z0 += 0.5f * (dzdx + dzdy) + 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+        for (int i = 0; i < 3; i++) {
+            C[i] += 0.5f * (A[i] + B[i]) - 0.5f * (std::abs(A[i]) + std::abs(B[i]));
+        }
+
+        OcclusionFloats ramp = occlusionRamp(), zero = occlusionSet(0.0f), far = occlusionSet(zMax);
+        OcclusionFloats stepX = occlusionSet(static_cast<float>(OCCLUSION_LANES));
+        OcclusionFloats a[3], dz = occlusionSet(dzdx);
+        for (int i = 0; i < 3; i++) {
+            a[i] = occlusionSet(A[i]);
+        }
+        int startX = minX - minX % OCCLUSION_LANES;
+        for (int y = minY; y <= maxY; y++) {
+            OcclusionFloats x = occlusionAdd(occlusionSet(static_cast<float>(startX)), ramp);
+            float *row = &depth[y * OCCLUSION_WIDTH];
+            for (int px = startX; px <= maxX; px += OCCLUSION_LANES) {
+                OcclusionFloats inside = occlusionGE(occlusionAdd(occlusionMul(a[0], x), occlusionSet(B[0] * y + C[0])), zero);
+                inside = occlusionAnd(inside, occlusionGE(occlusionAdd(occlusionMul(a[1], x), occlusionSet(B[1] * y + C[1])), zero));
+                inside = occlusionAnd(inside, occlusionGE(occlusionAdd(occlusionMul(a[2], x), occlusionSet(B[2] * y + C[2])), zero));
+                if (occlusionAny(inside)) {
+                    OcclusionFloats z = occlusionMin(occlusionAdd(occlusionMul(dz, x), occlusionSet(dzdy * y + z0)), far);
+                    OcclusionFloats current = occlusionLoad(row + px);
+                    occlusionStore(row + px, occlusionSelect(inside, occlusionMin(current, z), current));
+                }
+                x = occlusionAdd(x, stepX);
+            }
+        }
+    }
+
+    // False only when the box is entirely behind the occluders
+    bool boxVisible(glm::vec3 minCoords, glm::vec3 maxCoords) {
+        stats.tested++;
+        glm::vec2 screenMin(std::numeric_limits<float>::max()), screenMax(std::numeric_limits<float>::lowest());
+        float nearest = 1.0f;
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner((i & 1) ? maxCoords.x : minCoords.x, (i & 2) ? maxCoords.y : minCoords.y,
+                             (i & 4) ? maxCoords.z : minCoords.z);
+            glm::vec4 c = viewProjection * glm::vec4(corner, 1.0f);
+            if (c.z < 0.0f || c.w <= 1e-6f) {
+                // Crossing the near plane: too close to be hidden
+                return true;
+            }
+            glm::vec2 p((c.x / c.w * 0.5f + 0.5f) * OCCLUSION_WIDTH, (c.y / c.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT);
+            screenMin = glm::min(screenMin, p);
+            screenMax = glm::max(screenMax, p);
+            nearest = std::min(nearest, c.z / c.w);
+        }
+        if (screenMax.x < 0.0f || screenMin.x >= OCCLUSION_WIDTH || screenMax.y < 0.0f ||
+            screenMin.y >= OCCLUSION_HEIGHT) {
+            // Outside the screen: left to frustum culling
+            return true;
+        }
+        int minX = occlusionPixel(std::floor(screenMin.x), 0, OCCLUSION_WIDTH - 1);
+        int maxX = occlusionPixel(std::floor(screenMax.x), 0, OCCLUSION_WIDTH - 1);
+        int minY = occlusionPixel(std::floor(screenMin.y), 0, OCCLUSION_HEIGHT - 1);
+        int maxY = occlusionPixel(std::floor(screenMax.y), 0, OCCLUSION_HEIGHT - 1);
+
+        OcclusionFloats ramp = occlusionRamp(), boxDepth = occlusionSet(nearest);
+        OcclusionFloats first = occlusionSet(static_cast<float>(minX)), last = occlusionSet(static_cast<float>(maxX));
+        int startX = minX - minX % OCCLUSION_LANES;
+        for (int y = minY; y <= maxY; y++) {
+            const float *row = &depth[y * OCCLUSION_WIDTH];
+            for (int px = startX; px <= maxX; px += OCCLUSION_LANES) {
+                OcclusionFloats x = occlusionAdd(occlusionSet(static_cast<float>(px)), ramp);
+                OcclusionFloats inRange = occlusionAnd(occlusionGE(x, first), occlusionLE(x, last));
+                if (occlusionAny(occlusionAnd(inRange, occlusionGE(occlusionLoad(row + px), boxDepth)))) {
+                    return true;
+                }
+            }
+        }
+        stats.occluded++;
+        return false;
+    }
+
+    // Debug view: the buffer as a grayscale image (near is dark), the first row at the bottom
+    bool writePGM(const std::string &file) const {
+        std::ofstream out(file, std::ios_base::binary);
+        out << "P5\n" << OCCLUSION_WIDTH << " " << OCCLUSION_HEIGHT << "\n255\n";
+        for (int y = OCCLUSION_HEIGHT - 1; y >= 0; y--) {
+            for (int x = 0; x < OCCLUSION_WIDTH; x++) {
+                // Perspective depths crowd near 1: the square root spreads them
+                float d = std::sqrt(std::clamp(depth[y * OCCLUSION_WIDTH + x], 0.0f, 1.0f));
+                out.put(static_cast<char>(static_cast<uint8_t>(d * 255.0f)));
+            }
+        }
+        return static_cast<bool>(out);
+    }
+};
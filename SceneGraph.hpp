@@ -0,0 +1,119 @@
+#pragma once
+
+// Scene graph
+// Nodes with a local transform and an optional parent, added after it. A node is given either a position, a
+// rotation around the y axis and a scale, or a whole matrix: set() compares them with the current ones and
+// marks the node dirty only when they changed, so it can be called every frame for everything. update()
+// recomputes the world and normal matrices of the dirty nodes and of their descendants, in the order of the
+// nodes, and stamps them with the serial of the update (version). Nodes whose normal matrix is taken from
+// elsewhere (as the furniture, from BatchTransforms) are added without one and skip the inverse. The data
+// derived from the nodes is then brought up to date only where it changed: a consumer keeps the serial it has
+// last seen (one for each copy of the data, for instance one per swap chain image) and visits the nodes changed
+// since then with changedSince(), in ranges of consecutive nodes.
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+struct SceneNode {
+    int parent = -1;
+    glm::vec3 position{0.0f};
+    float yaw = 0.0f;
+    glm::vec3 scale{1.0f};
+    glm::mat4 local{1.0f};
+    glm::mat4 world{1.0f};
+    glm::mat4 normal{1.0f};     // inverse transpose of world, only if hasNormal
+    uint64_t version = 0;       // serial of the update that last changed world
+    bool dirty = true;
+    bool hasNormal = true;
+};
+
+class SceneGraph {
+public:
+    int add(int parent = -1, bool hasNormal = true) {
+        SceneNode N;
+        N.parent = parent;
+        N.hasNormal = hasNormal;
+        nodes.push_back(N);
+        return static_cast<int>(nodes.size() - 1);
+    }
+
+    // Local transform translate(position) * rotate(yaw, y) * scale(scale), as MakeWorldMatrix
+    bool set(int node, glm::vec3 position, float yaw, glm::vec3 scale = glm::vec3(1.0f)) {
+        SceneNode &N = nodes[node];
+        if (!N.dirty && N.position == position && N.yaw == yaw && N.scale == scale) {
+            return false;
+        }
+        N.position = position;
+        N.yaw = yaw;
+        N.scale = scale;
+        N.local = glm::translate(glm::mat4(1.0f), position) *
+                  glm::rotate(glm::mat4(1.0f), yaw, glm::vec3(0.0f, 1.0f, 0.0f)) *
+                  glm::scale(glm::mat4(1.0f), scale);
+        N.dirty = true;
+        return true;
+    }
+
+    bool set(int node, const glm::mat4 &local) {
+        SceneNode &N = nodes[node];
+        if (!N.dirty && N.local == local) {
+            return false;
+        }
+        N.local = local;
+        N.dirty = true;
+        return true;
+    }
+
+    // Returns the number of nodes whose world matrix changed
+    size_t update() {
+        updateSerial++;
+        size_t changed = 0;
+        for (auto &N: nodes) {
+            bool parentChanged = (N.parent >= 0) && (nodes[N.parent].version == updateSerial);
+            if (!N.dirty && !parentChanged) {
+                continue;
+            }
+            N.world = (N.parent >= 0) ? nodes[N.parent].world * N.local : N.local;
+            if (N.hasNormal) {
+                N.normal = glm::inverse(glm::transpose(N.world));
+            }
+            N.version = updateSerial;
+            N.dirty = false;
+            changed++;
+        }
+        return changed;
+    }
+
+    // Calls f(first, end) for each range [first, end) of consecutive nodes changed by the updates after since
+    template <class F>
+    void changedSince(uint64_t since, F f) const {
+        for (size_t i = 0; i < nodes.size();) {
+            if (nodes[i].version <= since) {
+                i++;
+                continue;
+            }
+            size_t first = i;
+            while (i < nodes.size() && nodes[i].version > since) {
+                i++;
+            }
+            f(first, i);
+        }
+    }
+
+    bool changedSince(int node, uint64_t since) const { return nodes[node].version > since; }
+    // Changed by the last update
+    bool changed(int node) const { return nodes[node].version == updateSerial; }
+
+    const SceneNode &operator[](int node) const { return nodes[node]; }
+    size_t size() const { return nodes.size(); }
+    uint64_t serial() const { return updateSerial; }
+
+    void clear() {
+        nodes.clear();
+    }
+
+private:
+    std::vector<SceneNode> nodes;
+    uint64_t updateSerial = 0;
+};
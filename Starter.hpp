@@ -5,6 +5,21 @@
 // Light parameters
 // Instance rendering
 // MultiTexture
+// Baked assets
+// Vertex compression
+// Block compressed textures
+// Texture streaming
+// Batched uploads
+// GPU memory
+// Geometry pool
+// GPU culling
+// Meshlets
+// Levels of detail
+// Uniform arena
+// Push constants
+// Scene graph
+// Batch transforms
+// Parallel recording
 
 #include <iostream>
 #include <stdexcept>
@@ -17,6 +32,8 @@
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <map>
+#include <memory>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
@@ -27,19 +44,9 @@
 
 #include <chrono>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-#define TINYGLTF_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#define TINYGLTF_NOEXCEPTION
-#define JSON_NOEXCEPTION
-#define TINYGLTF_NO_INCLUDE_STB_IMAGE
-#include <tiny_gltf.h>
-
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
@@ -49,6 +56,23 @@
 #include <sinfl.h>
 #include <nlohmann/json.hpp>
 
+#include "AssetArchive.hpp"
+#include "JobSystem.hpp"
+#include "MGCGDecoder.hpp"
+#include "GLTFReader.hpp"
+#include "MeshOptimizer.hpp"
+#include "OBJLoader.hpp"
+#include "Vertex.h"
+#include "VertexCompression.hpp"
+#include "BlockCompression.hpp"
+#include "TextureStreaming.hpp"
+#include "Culling.hpp"
+#include "OcclusionCulling.hpp"
+#include "Meshlets.hpp"
+#include "MeshSimplifier.hpp"
+#include "SceneGraph.hpp"
+#include "BatchTransforms.hpp"
+
 using json = nlohmann::json;
 
 
@@ -65,6 +89,8 @@ const std::vector<const char*> validationLayers = {
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Batched uploads: a family with transfer but without graphics (a copy engine), if the device has one
+	std::optional<uint32_t> transferFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() &&
@@ -170,13 +196,277 @@ std::vector<char> readFile(const std::string& filename) {
 
 class BaseProject;
 
+// GPU memory
+// Buffers and images are not given a VkDeviceMemory each: they are placed in large blocks, one list of blocks
+// per memory type and kind of resource (buffers and images are kept apart, so bufferImageGranularity never
+// matters). Resources get a range of a block, aligned as the driver requires:
+//  - GPU_MEMORY_RESOURCE: best fit in the free ranges of the block, which are merged again when freed;
+//  - GPU_MEMORY_LINEAR: bump allocation, the block is reused as a whole once all its ranges are freed. It is
+//    used by the uniform buffers, all created and destroyed together with the swap chain.
+// Requests larger than half a block get a block of their own. Host visible blocks stay mapped.
+#define GPU_MEMORY_BLOCK_SIZE (64ull << 20)
+#define GPU_MEMORY_LINEAR_BLOCK_SIZE (1ull << 20)
+
+enum GpuMemoryUsage {GPU_MEMORY_RESOURCE, GPU_MEMORY_LINEAR};
+
+struct GpuMemoryBlock {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	char *mapped = nullptr;
+	bool dedicated = false;
+	uint32_t allocations = 0;
+	VkDeviceSize used = 0;
+	// GPU_MEMORY_RESOURCE: free ranges, offset -> size
+	std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+	// GPU_MEMORY_LINEAR: first free byte
+	VkDeviceSize head = 0;
+};
+
+struct GpuAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Host visible memory only: the first byte of the range
+	char *mapped = nullptr;
+	GpuMemoryBlock *block = nullptr;
+	int pool = -1;
+};
+
+class GpuMemoryAllocator {
+	struct Pool {
+		uint32_t memoryType;
+		bool image;
+		GpuMemoryUsage usage;
+		std::vector<std::unique_ptr<GpuMemoryBlock>> blocks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties{};
+	std::vector<Pool> pools;
+
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static bool allocateInBlock(GpuMemoryBlock &B, GpuMemoryUsage usage, VkDeviceSize size,
+								VkDeviceSize alignment, VkDeviceSize &offset) {
+		if(usage == GPU_MEMORY_LINEAR) {
+			VkDeviceSize start = alignUp(B.head, alignment);
+			if(start + size > B.size) {
+				return false;
+			}
+			offset = start;
+			B.head = start + size;
+			return true;
+		}
+		// Best fit: the smallest free range that holds the aligned request
+		auto best = B.freeRanges.end();
+		for(auto it = B.freeRanges.begin(); it != B.freeRanges.end(); ++it) {
+			VkDeviceSize start = alignUp(it->first, alignment);
+			if((start + size <= it->first + it->second) &&
+			   ((best == B.freeRanges.end()) || (it->second < best->second))) {
+				best = it;
+			}
+		}
+		if(best == B.freeRanges.end()) {
+			return false;
+		}
+		VkDeviceSize rangeStart = best->first, rangeEnd = best->first + best->second;
+		offset = alignUp(rangeStart, alignment);
+		B.freeRanges.erase(best);
+		if(offset > rangeStart) {
+			B.freeRanges[rangeStart] = offset - rangeStart;
+		}
+		if(offset + size < rangeEnd) {
+			B.freeRanges[offset + size] = rangeEnd - offset - size;
+		}
+		return true;
+	}
+
+	static void freeInBlock(GpuMemoryBlock &B, GpuMemoryUsage usage, VkDeviceSize offset, VkDeviceSize size) {
+		if(usage == GPU_MEMORY_LINEAR) {
+			if(B.allocations == 0) {
+				B.head = 0;
+			}
+			return;
+		}
+		auto it = B.freeRanges.emplace(offset, size).first;
+		auto next = std::next(it);
+		if((next != B.freeRanges.end()) && (it->first + it->second == next->first)) {
+			it->second += next->second;
+			B.freeRanges.erase(next);
+		}
+		if(it != B.freeRanges.begin()) {
+			auto prev = std::prev(it);
+			if(prev->first + prev->second == it->first) {
+				prev->second += it->second;
+				B.freeRanges.erase(it);
+			}
+		}
+	}
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) &&
+				(memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	GpuMemoryBlock *createBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated) {
+		auto B = std::make_unique<GpuMemoryBlock>();
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+		VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &B->memory);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to allocate device memory!");
+		}
+		if(memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+			void *data;
+			result = vkMapMemory(device, B->memory, 0, size, 0, &data);
+			if (result != VK_SUCCESS) {
+				vkFreeMemory(device, B->memory, nullptr);
+				PrintVkError(result);
+				throw std::runtime_error("failed to map device memory!");
+			}
+			B->mapped = static_cast<char *>(data);
+		}
+		B->size = size;
+		B->dedicated = dedicated;
+		B->freeRanges[0] = size;
+		return B.release();
+	}
+
+	void destroyBlock(GpuMemoryBlock &B) {
+		if(B.mapped != nullptr) {
+			vkUnmapMemory(device, B.memory);
+		}
+		vkFreeMemory(device, B.memory, nullptr);
+	}
+
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice dev) {
+		device = dev;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	}
+
+	GpuAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+						   bool image, GpuMemoryUsage usage = GPU_MEMORY_RESOURCE) {
+		uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+		size_t p = 0;
+		while((p < pools.size()) && !((pools[p].memoryType == memoryType) && (pools[p].image == image) &&
+									  (pools[p].usage == usage))) {
+			p++;
+		}
+		if(p == pools.size()) {
+			pools.push_back({memoryType, image, usage, {}});
+		}
+		Pool &P = pools[p];
+
+		VkDeviceSize blockSize = (usage == GPU_MEMORY_LINEAR) ? GPU_MEMORY_LINEAR_BLOCK_SIZE : GPU_MEMORY_BLOCK_SIZE;
+		GpuAllocation A;
+		A.size = requirements.size;
+		A.pool = static_cast<int>(p);
+		if(requirements.size > blockSize / 2) {
+			P.blocks.emplace_back(createBlock(memoryType, requirements.size, true));
+			A.block = P.blocks.back().get();
+			allocateInBlock(*A.block, usage, A.size, requirements.alignment, A.offset);
+		} else {
+			for(auto &B : P.blocks) {
+				if(!B->dedicated && allocateInBlock(*B, usage, A.size, requirements.alignment, A.offset)) {
+					A.block = B.get();
+					break;
+				}
+			}
+			if(A.block == nullptr) {
+				P.blocks.emplace_back(createBlock(memoryType, blockSize, false));
+				A.block = P.blocks.back().get();
+				allocateInBlock(*A.block, usage, A.size, requirements.alignment, A.offset);
+			}
+		}
+		A.block->allocations++;
+		A.block->used += A.size;
+		A.memory = A.block->memory;
+		if(A.block->mapped != nullptr) {
+			A.mapped = A.block->mapped + A.offset;
+		}
+		return A;
+	}
+
+	void free(GpuAllocation &A) {
+		if(A.block == nullptr) {
+			return;
+		}
+		Pool &P = pools[A.pool];
+		GpuMemoryBlock &B = *A.block;
+		B.allocations--;
+		B.used -= A.size;
+		freeInBlock(B, P.usage, A.offset, A.size);
+		// Empty blocks are released, except the last shared block of each pool
+		if(B.allocations == 0) {
+			size_t shared = std::count_if(P.blocks.begin(), P.blocks.end(),
+										  [](const std::unique_ptr<GpuMemoryBlock> &b) { return !b->dedicated; });
+			if(B.dedicated || (shared > 1)) {
+				destroyBlock(B);
+				P.blocks.erase(std::find_if(P.blocks.begin(), P.blocks.end(),
+											[&](const std::unique_ptr<GpuMemoryBlock> &b) { return b.get() == &B; }));
+			}
+		}
+		A = GpuAllocation{};
+	}
+
+	void printStats() const {
+		uint32_t blocks = 0, allocations = 0;
+		VkDeviceSize reserved = 0, used = 0;
+		for(const auto &P : pools) {
+			for(const auto &B : P.blocks) {
+				blocks++;
+				allocations += B->allocations;
+				reserved += B->size;
+				used += B->used;
+			}
+		}
+		std::cout << "GPU memory: " << allocations << " resources in " << blocks << " device allocations, "
+				  << used << " B used of " << reserved << " B\n";
+		for(const auto &P : pools) {
+			for(const auto &B : P.blocks) {
+				std::cout << "\ttype " << P.memoryType << (P.image ? " images" : " buffers")
+						  << ((P.usage == GPU_MEMORY_LINEAR) ? " linear" : "") << (B->dedicated ? " dedicated" : "")
+						  << ": " << B->allocations << " resources, " << B->used << "/" << B->size << " B";
+				if(P.usage == GPU_MEMORY_RESOURCE) {
+					VkDeviceSize largest = 0;
+					for(const auto &R : B->freeRanges) {
+						largest = std::max(largest, R.second);
+					}
+					std::cout << ", " << B->freeRanges.size() << " free ranges (largest " << largest << " B)";
+				}
+				std::cout << "\n";
+			}
+		}
+	}
+
+	void cleanup() {
+		for(auto &P : pools) {
+			for(auto &B : P.blocks) {
+				destroyBlock(*B);
+			}
+		}
+		pools.clear();
+	}
+};
+
 struct VertexBindingDescriptorElement {
 	uint32_t binding;
 	uint32_t stride;
 	VkVertexInputRate inputRate;
 };
 
-enum VertexDescriptorElementUsage {POSITION, NORMAL, UV, COLOR, TANGENT, OTHER};
+enum VertexDescriptorElementUsage {POSITION, NORMAL, UV, COLOR, TANGENT, PACKED_POSITION, PACKED_NORMAL, PACKED_UV, OTHER};
 
 struct VertexDescriptorElement {
 	uint32_t binding;
@@ -210,6 +500,8 @@ struct VertexDescriptor {
 	std::vector<VkVertexInputBindingDescription> getBindingDescription();
 	std::vector<VkVertexInputAttributeDescription>
 						getAttributeDescriptions();
+	// Baked assets
+	uint32_t layoutKey();
 };
 
 enum ModelType {OBJ, GLTF, MGCG};
@@ -240,22 +532,23 @@ struct LightParameters {
     } parameters;
 };
 
+std::string lightsFileName(const std::string &file) {
+	return "lights/" + file.substr(0, file.length() - 4) + "lights";
+}
+
 // Instance rendering
 class Empty {};
 template <class Vert, class Instance = Empty>
 class Model {
 	BaseProject *BP;
 
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-
 	// Instance rendering
     VkBuffer instanceBuffer;
-    VkDeviceMemory instanceBufferMemory;
+    GpuAllocation instanceBufferMemory;
 
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
 	VertexDescriptor *VD;
+	// Geometry pool: size of the vertices in the pool
+	uint32_t vertexStride = 0;
 
 	public:
 	// Light parameters
@@ -265,29 +558,86 @@ class Model {
     bool instanceBufferPresent = false;
     std::vector<Instance> instances{};
 	std::vector<uint32_t> indices{};
+	glm::vec3 minCoords{};
+	glm::vec3 maxCoords{};
+	// Vertex compression: when set before the upload, the vertex buffer holds VertexPacked vertices and the
+	// model must be drawn by a pipeline that decodes them, with dequantization applied to its world matrix
+	bool compressed = false;
+	glm::mat4 dequantization = glm::mat4(1.0f);
+	// Room/portal visibility: end of each range of indices drawn on its own (the rooms of the building), in
+	// which optimize() keeps the triangles
+	std::vector<uint32_t> indexRangeEnds{};
+	// Levels of detail: ranges of the index buffer, the full mesh first, filled by buildLods() (see MeshSimplifier.hpp)
+	std::vector<MeshLod> lods{};
+	// Meshlets: clusters of the index buffer, filled by buildMeshlets() (see Meshlets.hpp); those of level l go
+	// from lodMeshlets[l] to lodMeshlets[l + 1]
+	std::vector<Meshlet> meshlets{};
+	std::vector<uint32_t> lodMeshlets{};
+	// Drawn with VK_CULL_MODE_NONE: its meshlets get no normal cone. Cleared for closed meshes (see meshClosed),
+	// which can be drawn with back faces culled
+	bool doubleSided = true;
+	// 16 bit indices whenever the vertices allow it
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	// Geometry pool: range of the model in the shared buffers, for vkCmdDrawIndexed
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
 	void loadModelOBJ(std::string file);
+	void buildFromOBJ(const OBJData &obj);
 	void loadModelGLTF(std::string file, bool encoded);
+	void checkLayout() const;
+	void computeBounds();
+	void optimize();
+	void buildLods();
+	void buildMeshlets();
+	// Baked assets
+	bool loadBaked(const AssetArchive &A, const std::string &file);
+	void bake(AssetArchiveWriter &W, const std::string &file);
 	void createIndexBuffer();
 	void createVertexBuffer();
 	// instance rendering
     void createInstanceBuffer();
 
+	void load(VertexDescriptor *VD, std::string file, ModelType MT, const AssetArchive *A = nullptr);
+	void upload(BaseProject *bp);
 	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT);
 	void initMesh(BaseProject *bp, VertexDescriptor *VD);
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer);
+  	void bind(VkCommandBuffer commandBuffer, VkBuffer indexBuffer);
 };
 
 struct Texture {
 	BaseProject *BP;
 	uint32_t mipLevels;
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	GpuAllocation textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 	int imgs;
 	static const int maxImgs = 6;
-
+	// Block compressed textures: format of the image when it has been loaded from a DDS
+	VkFormat blockFormat = VK_FORMAT_UNDEFINED;
+	// Texture streaming (see TextureStreaming.hpp): the image holds the levels from streaming.residentLevel
+	// of streamSource, the DDS in streamFile or in the asset archive
+	bool streamed = false;
+	TextureStreamingState streaming;
+	DDSImage streamSource;
+	MappedFile streamFile;
+	// Levels read by the background thread, from streamLevel to the last one
+	std::vector<char> streamLevels;
+	uint32_t streamLevel = 0;
+	bool streamLoading = false;
+	JobCounter streamJob;
+	// Image made by createStreamedImage(), replacing the current one once its upload (streamTicket) completes
+	bool streamUploading = false;
+	uint64_t streamTicket = 0;
+	VkImage streamImage;
+	GpuAllocation streamMemory;
+	VkImageView streamView;
+
+	bool selectBlockFormat(DDSBlockFormat format, VkFormat Fmt);
+	void createCompressedImage(const DDSImage &I, uint32_t firstLevel, const char *const levels[]);
+	bool createCompressedTextureImage(const char *const files[], VkFormat Fmt);
 	void createTextureImage(const char *const files[], VkFormat Fmt);
 	void createTextureImageView(VkFormat Fmt);
 	void createTextureSampler(VkFilter magFilter,
@@ -302,7 +652,15 @@ struct Texture {
 
 	void init(BaseProject *bp, const char * file, VkFormat Fmt, bool initSampler);
 	void initCubic(BaseProject *bp, const char * files[6]);
+	// Texture streaming
+	void initStreaming(BaseProject *bp, const char *file, VkFormat Fmt);
+	void touch(float distance);
+	void loadStreamedLevels(uint32_t level);
+	void createStreamedImage();
+	void swapStreamedImage();
 	void cleanup();
+	// Baked assets
+	static void bake(AssetArchiveWriter &W, const char *file);
 };
 
 struct DescriptorSetLayoutBinding {
@@ -330,6 +688,8 @@ struct Pipeline {
 	VkShaderModule vertShaderModule;
 	VkShaderModule fragShaderModule;
 	std::vector<DescriptorSetLayout *> D;
+	// Push constants: ranges of the per draw data, set with push() before the draw calls
+	std::vector<VkPushConstantRange> PC;
 
 	VkCompareOp compareOp;
 	VkPolygonMode polyModel;
@@ -340,18 +700,40 @@ struct Pipeline {
 
   	void init(BaseProject *bp, VertexDescriptor *vd,
 			  const std::string& VertShader, const std::string& FragShader,
-  			  std::vector<DescriptorSetLayout *> D);
+  			  std::vector<DescriptorSetLayout *> D, std::vector<VkPushConstantRange> PC = {});
   	void setAdvancedFeatures(VkCompareOp _compareOp, VkPolygonMode _polyModel,
  						VkCullModeFlagBits _CM, bool _transp);
   	void create();
   	void destroy();
   	void bind(VkCommandBuffer commandBuffer);
+  	void push(VkCommandBuffer commandBuffer, const void *data, uint32_t size, uint32_t offset = 0);
 
   	VkShaderModule createShaderModule(const std::vector<char>& code);
 	void cleanup();
 };
 
-enum DescriptorSetElementType {UNIFORM, TEXTURE};
+// GPU culling
+// Pipeline running a compute shader: it is dispatched outside the render pass, in
+// BaseProject::populateComputeCommands(), and its descriptor sets can be bound to graphics pipelines too
+struct ComputePipeline {
+	BaseProject *BP;
+	VkPipeline computePipeline;
+	VkPipelineLayout pipelineLayout;
+
+	VkShaderModule compShaderModule;
+	std::vector<DescriptorSetLayout *> D;
+
+	void init(BaseProject *bp, const std::string& CompShader, std::vector<DescriptorSetLayout *> D);
+	void create();
+	void destroy();
+	void bind(VkCommandBuffer commandBuffer);
+	void dispatch(VkCommandBuffer commandBuffer, uint32_t groupCount);
+	void cleanup();
+};
+
+// STORAGE elements are buffers read and written by shaders: like the uniforms, there is one per swap chain
+// image, mapped for the CPU, and they can be used as the source of indirect draws and as index buffers
+enum DescriptorSetElementType {UNIFORM, TEXTURE, STORAGE};
 
 struct DescriptorSetElement {
 	int binding;
@@ -362,20 +744,172 @@ struct DescriptorSetElement {
     int texDstArrayElement = 0;
 };
 
+// Uniform arena
+// The UNIFORM elements have no buffers of their own: each swap chain image has one persistently mapped buffer,
+// in which every element gets a slot by bump allocation when its set is created. The descriptors are dynamic
+// uniform buffers, and the offsets of the slots are given when a set is bound: a set can then serve several
+// objects, each with its own block of slots (see DescriptorSet::addBlock). The slots are the same in the buffers
+// of all the images, and the arena is emptied with the swap chain, before the sets are created again.
+#define UNIFORM_ARENA_SIZE (256ull << 10)
+
+struct UniformArena {
+	BaseProject *BP;
+	std::vector<VkBuffer> buffers;
+	std::vector<GpuAllocation> memories;
+	VkDeviceSize alignment = 256;
+	VkDeviceSize head = 0;
+
+	void init(BaseProject *bp);
+	uint32_t allocate(VkDeviceSize size);
+	char *data(int currentImage, uint32_t offset) { return memories[currentImage].mapped + offset; }
+	void cleanup();
+};
+
 struct DescriptorSet {
 	BaseProject *BP;
 
+	// STORAGE elements only, the UNIFORM ones are in the uniform arena
 	std::vector<std::vector<VkBuffer>> uniformBuffers;
-	std::vector<std::vector<VkDeviceMemory>> uniformBuffersMemory;
+	std::vector<std::vector<GpuAllocation>> uniformBuffersMemory;
 	std::vector<VkDescriptorSet> descriptorSets;
+	// Uniform arena: for each block, the offsets of the UNIFORM elements in binding order (the order of the
+	// dynamic offsets of vkCmdBindDescriptorSets), and for each element its position in them (-1 if not UNIFORM)
+	std::vector<std::vector<uint32_t>> dynamicOffsets;
+	std::vector<int> dynamicIndex;
 
 	std::vector<bool> toFree;
+	// Texture streaming: kept to rewrite the descriptors of the streamed textures when their images change
+	std::vector<DescriptorSetElement> elements;
 
 	void init(BaseProject *bp, DescriptorSetLayout *L,
 		std::vector<DescriptorSetElement> E);
+	void updateTextures(int currentImage);
+	void cleanup();
+	int addBlock();
+  	void bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId, int currentImage, int block = 0);
+  	void bind(VkCommandBuffer commandBuffer, ComputePipeline &P, int setId, int currentImage, int block = 0);
+  	void map(int currentImage, void *src, int size, int slot, int block = 0);
+  	void mapRange(int currentImage, void *src, int offset, int size, int slot, int block = 0);
+  	char *data(int currentImage, int slot, int block = 0);
+	VkBuffer buffer(int currentImage, int slot);
+};
+
+// Batched uploads
+// All the transfers done while loading (buffer and image copies, layout transitions, mip blits) are recorded
+// in the command buffer of the current batch, and their source data is written to a persistently mapped
+// staging ring. flush() submits the batch with a fence: the ring is reused once the fences of the batches
+// reading it have been signaled, so the CPU never waits for the whole queue to become idle.
+// Sources larger than the ring get a staging buffer of their own, freed with their batch.
+// When the device has a transfer only queue family, the copies of uploadBuffer() and uploadImage() run on
+// it, overlapping the rendering: the resources are released by the transfer queue and acquired by the
+// graphics part of the same batch, which waits for a semaphore signaled by the transfer submission.
+// Whatever needs the graphics queue (mip blits, depth buffer transitions) is recorded with record().
+#define UPLOAD_RING_SIZE (32ull << 20)
+#define UPLOAD_ALIGNMENT 16
+
+struct UploadBatch {
+	VkCommandBuffer commandBuffer;
+	VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+	VkFence fence;
+	uint64_t serial = 0;
+	std::vector<VkBuffer> stagingBuffers;
+	std::vector<GpuAllocation> stagingMemories;
+};
+
+struct UploadManager {
+	BaseProject *BP;
+	VkCommandPool commandPool;
+	VkBuffer ringBuffer;
+	GpuAllocation ringMemory;
+	char *ringData;
+	VkDeviceSize ringHead = 0;
+
+	// Transfer queue
+	bool separateTransfer = false;
+	uint32_t graphicsFamily;
+	uint32_t transferFamily;
+	VkCommandPool transferPool = VK_NULL_HANDLE;
+	VkSemaphore transferDone = VK_NULL_HANDLE;
+	// Second halves of the queue family ownership transfers, recorded on the graphics queue at flush()
+	std::vector<VkBufferMemoryBarrier> bufferAcquires;
+	std::vector<VkImageMemoryBarrier> imageAcquires;
+
+	UploadBatch current;
+	bool recording = false;
+	bool recordingTransfer = false;
+	// Vertex, index and instance buffers were written by the current batch
+	bool buffersWritten = false;
+	std::vector<UploadBatch> submitted;
+	std::vector<UploadBatch> available;
+	uint64_t nextSerial = 1;
+	uint64_t completedSerial = 0;
+
+	// Statistics
+	uint32_t submissions = 0;
+	VkDeviceSize stagedBytes = 0;
+
+	void init(BaseProject *bp);
+	VkCommandBuffer record();
+	VkCommandBuffer recordTransfer();
+	void *stage(VkDeviceSize size, VkBuffer &buffer, VkDeviceSize &offset);
+	void uploadBuffer(VkBuffer dst, const void *src, VkDeviceSize size);
+	void uploadImage(VkImage image, uint32_t mipLevels, int layerCount, VkBuffer buffer,
+					 const std::vector<VkBufferImageCopy> &regions);
+	// Asynchronous uploads: serial of the batch being recorded, and whether a batch has been completed
+	uint64_t currentSerial();
+	bool completed(uint64_t serial);
+	void flush();
+	void wait();
+	void cleanup();
+
+	void poll();
+	void release(UploadBatch &B);
+};
+
+// Geometry pool
+// The vertices and indices of all the models are packed in a few shared device local buffers: one vertex
+// buffer per vertex size (the stride of the binding) and a single index buffer, with the 16 bit indices
+// first and the 32 bit ones after them. A model only keeps its range (firstIndex and vertexOffset, to be
+// passed to vkCmdDrawIndexed), and binding it does nothing when its buffers are already bound to the
+// command buffer being recorded. The data added while loading is uploaded by build(), after localInit().
+struct GeometryArena {
+	uint32_t stride;
+	std::vector<char> data;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	GpuAllocation memory;
+};
+
+struct GeometryPool {
+	BaseProject *BP;
+	std::vector<GeometryArena> arenas;
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	GpuAllocation indexMemory;
+	VkDeviceSize indices32Offset = 0;
+	bool built = false;
+
+	// Buffers bound to the command buffer being recorded, by each thread (Parallel recording)
+	struct Bindings {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkBuffer vertexBuffer = VK_NULL_HANDLE;
+		VkIndexType indexType = VK_INDEX_TYPE_MAX_ENUM;
+	};
+	static Bindings &bound() {
+		static thread_local Bindings bindings;
+		return bindings;
+	}
+
+	void init(BaseProject *bp);
+	// Return the vertexOffset and the firstIndex of the added range
+	int32_t addVertices(const void *vertices, size_t count, uint32_t stride);
+	uint32_t addIndices(const void *indices, size_t count, VkIndexType indexType);
+	void build();
+	void bind(VkCommandBuffer commandBuffer, uint32_t stride, VkIndexType indexType);
+	void bind(VkCommandBuffer commandBuffer, uint32_t stride, VkBuffer otherIndexBuffer);
+	void bindVertices(VkCommandBuffer commandBuffer, uint32_t stride);
+	void invalidate();
 	void cleanup();
-  	void bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId, int currentImage);
-  	void map(int currentImage, void *src, int size, int slot);
 };
 
 
@@ -388,6 +922,10 @@ class BaseProject {
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend class UniformArena;
+	friend class UploadManager;
+	friend class GeometryPool;
+	friend class ComputePipeline;
 public:
 	virtual void setWindowParameters() = 0;
     void run() {
@@ -409,6 +947,10 @@ protected:
 	int uniformBlocksInPool;
 	int texturesInPool;
 	int setsInPool;
+	int storageBlocksInPool = 0;
+	// When set, the command buffer of each image is recorded again every frame, after updateUniformBuffer(),
+	// so that populateCommandBuffer() can depend on what is visible from the current camera
+	bool recordCommandBuffersEveryFrame = false;
 
     GLFWwindow* window;
     VkInstance instance;
@@ -418,8 +960,22 @@ protected:
     VkDevice device;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue transferQueue = VK_NULL_HANDLE;
 	VkCommandPool commandPool;
 	std::vector<VkCommandBuffer> commandBuffers;
+	// Parallel recording
+	// When the application splits its draws in groups (drawGroupCount() > 0, for instance one per pipeline),
+	// the render pass is recorded by the jobs of JobSystem::shared(): each job records a range of consecutive
+	// groups in a secondary command buffer, and the primary one executes them in the order of the groups. Every
+	// thread allocates them from a command pool of its own for each swap chain image, reset when the image is
+	// recorded again (after its fence: none of them is still in use), so the jobs never share a pool. A
+	// secondary command buffer inherits no binding: each group binds its pipeline, sets and geometry.
+	struct RecordingPool {
+		VkCommandPool pool;
+		std::vector<VkCommandBuffer> buffers;   // allocated once, reused every frame
+		size_t used = 0;
+	};
+	std::vector<std::vector<RecordingPool>> recordingPools;    // for each image, one per thread
 
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
@@ -434,12 +990,12 @@ protected:
 	VkDebugUtilsMessengerEXT debugMessenger;
 
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	GpuAllocation depthImageMemory;
 	VkImageView depthImageView;
 
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 	VkImage colorImage;
-	VkDeviceMemory colorImageMemory;
+	GpuAllocation colorImageMemory;
 	VkImageView colorImageView;
 
 	std::vector<VkFramebuffer> swapChainFramebuffers;
@@ -451,6 +1007,40 @@ protected:
 	std::vector<VkFence> inFlightFences;
 	std::vector<VkFence> imagesInFlight;
 
+	// Baked assets
+	AssetArchive assets;
+	// Block compressed textures can be sampled
+	bool textureCompressionBC = false;
+	// GPU culling: indirect draws of several commands at once, and with a first instance other than 0
+	bool multiDrawIndirect = false;
+	bool drawIndirectFirstInstance = false;
+
+	// Batched uploads
+	UploadManager uploads;
+	// Geometry pool
+	GeometryPool geometry;
+	// GPU memory
+	GpuMemoryAllocator gpuMemory;
+	// Uniform arena
+	UniformArena uniforms;
+
+	// Texture streaming
+	// Each change of a streamed image starts a new generation: the descriptor sets and the command buffer
+	// of a swap chain image are brought up to date when the image is acquired, and the replaced images are
+	// destroyed once every command buffer has been recorded again
+	struct RetiredTexture {
+		VkImage image;
+		GpuAllocation memory;
+		VkImageView view;
+		uint64_t generation;
+	};
+	std::vector<Texture *> streamedTextures;
+	std::vector<DescriptorSet *> textureDescriptorSets;
+	std::vector<RetiredTexture> retiredTextures;
+	std::vector<uint64_t> recordedGeneration;
+	uint64_t textureGeneration = 0;
+	size_t textureStreamingBudget = TEXTURE_STREAMING_DEFAULT_BUDGET;
+
     void initWindow() {
         glfwInit();
 
@@ -483,16 +1073,39 @@ protected:
 		createSurface();
 		pickPhysicalDevice();
 		createLogicalDevice();
+		gpuMemory.init(physicalDevice, device);
 		createSwapChain();
 		createImageViews();
 		createRenderPass();
 		createCommandPool();
+		uploads.init(this);
+		geometry.init(this);
 		createColorResources();
 		createDepthResources();
 		createFramebuffers();
 		createDescriptorPool();
+		uniforms.init(this);
 
+		// Baked assets
+		// Models and textures found in the archive are copied from the mapped file,
+		// the others are loaded from their sources
+		if(!assets.open(ASSET_ARCHIVE_DEFAULT_PATH)) {
+			std::cout << "No asset archive found, loading the source assets\n";
+		}
+		auto loadStart = std::chrono::high_resolution_clock::now();
 		localInit();
+		std::cout << "Assets loaded in " << std::chrono::duration<float, std::chrono::milliseconds::period>(
+						std::chrono::high_resolution_clock::now() - loadStart).count() << " ms\n";
+		// Texture streaming: the levels not loaded yet are read from the archive while running
+		if(streamedTextures.empty()) {
+			assets.close();
+		}
+		geometry.build();
+		uploads.flush();
+		std::cout << "Uploads: " << uploads.submissions << " submissions, "
+				  << uploads.stagedBytes << " B staged\n";
+		gpuMemory.printStats();
+
 		pipelinesAndDescriptorSetsInit();
 
 		createCommandBuffers();
@@ -774,19 +1387,22 @@ protected:
 
 		int i=0;
 		for (const auto& queueFamily : queueFamilies) {
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) {
 				indices.graphicsFamily = i;
 			}
 
 			VkBool32 presentSupport = false;
 			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
 												 &presentSupport);
-			if (presentSupport) {
+			if (presentSupport && !indices.presentFamily.has_value()) {
 			 	indices.presentFamily = i;
 			}
 
-			if (indices.isComplete()) {
-				break;
+			// Batched uploads: a transfer only family is preferred to one that can also compute
+			if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+				!(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+				(!indices.transferFamily.has_value() || !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))) {
+				indices.transferFamily = i;
 			}
 			i++;
 		}
@@ -867,6 +1483,9 @@ protected:
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies =
 				{indices.graphicsFamily.value(), indices.presentFamily.value()};
+		if (indices.transferFamily.has_value()) {
+			uniqueQueueFamilies.insert(indices.transferFamily.value());
+		}
 
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -881,6 +1500,16 @@ protected:
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
 		deviceFeatures.sampleRateShading = VK_TRUE;
+		// Block compressed textures, when available (otherwise textures are decoded from their sources)
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		textureCompressionBC = supportedFeatures.textureCompressionBC;
+		deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		// GPU culling
+		multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
 
         VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -909,6 +1538,9 @@ protected:
 
 		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+		if (indices.transferFamily.has_value()) {
+			vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+		}
 	}
 
 	void createSwapChain() {
@@ -1168,7 +1800,8 @@ protected:
 		VkCommandPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
+		// Texture streaming: command buffers are recorded again when a streamed image changes
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
 		if (result != VK_SUCCESS) {
@@ -1244,7 +1877,7 @@ protected:
 				 	 VkImageTiling tiling, VkImageUsageFlags usage,
 				 	 VkImageCreateFlags cflags,
 				 	 VkMemoryPropertyFlags properties, VkImage& image,
-				 	 VkDeviceMemory& imageMemory) {
+				 	 GpuAllocation& imageMemory) {
 		VkImageCreateInfo imageInfo{};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -1270,17 +1903,9 @@ protected:
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
-											properties);
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
-								VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
-		}
-
-		vkBindImageMemory(device, image, imageMemory, 0);
+		// GPU memory
+		imageMemory = gpuMemory.allocate(memRequirements, properties, true);
+		vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 	}
 
 	void generateMipmaps(VkImage image, VkFormat imageFormat,
@@ -1295,7 +1920,7 @@ protected:
 			throw std::runtime_error("texture image format does not support linear blitting!");
 		}
 
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		VkCommandBuffer commandBuffer = uploads.record();
 
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1367,14 +1992,12 @@ protected:
 							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
 							 0, nullptr, 0, nullptr,
 							 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
 
 	void transitionImageLayout(VkImage image, VkFormat format,
 					VkImageLayout oldLayout, VkImageLayout newLayout,
 					uint32_t mipLevels, int layersCount) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		VkCommandBuffer commandBuffer = uploads.record();
 
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1427,16 +2050,14 @@ protected:
 		vkCmdPipelineBarrier(commandBuffer,
 								sourceStage, destinationStage, 0,
 								0, nullptr, 0, nullptr, 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
 
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t
+	void copyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t
 						   width, uint32_t height, int layerCount) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		VkCommandBuffer commandBuffer = uploads.record();
 
 		VkBufferImageCopy region{};
-		region.bufferOffset = 0;
+		region.bufferOffset = bufferOffset;
 		region.bufferRowLength = 0;
 		region.bufferImageHeight = 0;
 		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1448,45 +2069,12 @@ protected:
 
 		vkCmdCopyBufferToImage(commandBuffer, buffer, image,
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-		endSingleTimeCommands(commandBuffer);
-	}
-
-	VkCommandBuffer beginSingleTimeCommands() {
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = commandPool;
-		allocInfo.commandBufferCount = 1;
-
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-		return commandBuffer;
-	}
-
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-		vkEndCommandBuffer(commandBuffer);
-
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
-
-		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 	}
 
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 					  VkMemoryPropertyFlags properties,
-					  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+					  VkBuffer& buffer, GpuAllocation& bufferMemory,
+					  GpuMemoryUsage memoryUsage = GPU_MEMORY_RESOURCE) {
 		VkBufferCreateInfo bufferInfo{};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.size = size;
@@ -1503,50 +2091,28 @@ protected:
 		VkMemoryRequirements memRequirements;
 		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex =
-				findMemoryType(memRequirements.memoryTypeBits, properties);
-
-		result = vkAllocateMemory(device, &allocInfo, nullptr,
-				&bufferMemory);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to allocate vertex buffer memory!");
-		}
-
-		vkBindBufferMemory(device, buffer, bufferMemory, 0);
-	}
-
-	uint32_t findMemoryType(uint32_t typeFilter,
-							VkMemoryPropertyFlags properties) {
-		 VkPhysicalDeviceMemoryProperties memProperties;
-		 vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-		 for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		 	if ((typeFilter & (1 << i)) &&
-		 		(memProperties.memoryTypes[i].propertyFlags & properties) ==
-		 				properties) {
-				return i;
-			}
-		}
-
-		throw std::runtime_error("failed to find suitable memory type!");
+		// GPU memory
+		bufferMemory = gpuMemory.allocate(memRequirements, properties, false, memoryUsage);
+		vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
 	}
 
 	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		std::array<VkDescriptorPoolSize, 3> poolSizes{};
+		// Uniform arena
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
 															 swapChainImages.size());
 		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
 															 swapChainImages.size());
+		// GPU culling
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[2].descriptorCount = static_cast<uint32_t>(storageBlocksInPool *
+															 swapChainImages.size());
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
+		poolInfo.poolSizeCount = static_cast<uint32_t>((storageBlocksInPool > 0) ? 3 : 2);
 		poolInfo.pPoolSizes = poolSizes.data();
 		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
 
@@ -1559,6 +2125,23 @@ protected:
 	}
 
 	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+	// Parallel recording: number of groups of draws of the render pass, 0 to record it with populateCommandBuffer()
+	virtual uint32_t drawGroupCount(int) { return 0; }
+	virtual void populateDrawGroup(VkCommandBuffer, int, uint32_t) {}
+	// GPU culling: compute work of a frame, recorded before the render pass begins
+	virtual void populateComputeCommands(VkCommandBuffer, int) {}
+
+	// GPU culling: draws count commands of an indirect buffer, with one call when the device allows it
+	void drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t count) {
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		if(multiDrawIndirect) {
+			vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, count, stride);
+		} else {
+			for(uint32_t i = 0; i < count; i++) {
+				vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset + i * stride, 1, stride);
+			}
+		}
+	}
 
     void createCommandBuffers() {
     	commandBuffers.resize(swapChainFramebuffers.size());
@@ -1576,44 +2159,132 @@ protected:
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
 
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		recordingPools.resize(commandBuffers.size());
+		for (auto &imagePools : recordingPools) {
+			imagePools.resize(JobSystem::shared().threadCount());
+			for (auto &P : imagePools) {
+				result = vkCreateCommandPool(device, &poolInfo, nullptr, &P.pool);
+				if (result != VK_SUCCESS) {
+					PrintVkError(result);
+					throw std::runtime_error("failed to create command pool!");
+				}
+			}
+		}
+
 		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
-
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-						VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
+			recordCommandBuffer(i);
+		}
+		recordedGeneration.assign(commandBuffers.size(), textureGeneration);
+	}
+
+	// Parallel recording: a secondary command buffer of the pool of the calling thread, begun inside the render pass
+	VkCommandBuffer beginSecondaryCommandBuffer(size_t i) {
+		RecordingPool &P = recordingPools[i][JobSystem::threadIndex()];
+		if (P.used == P.buffers.size()) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = P.pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			VkCommandBuffer commandBuffer;
+			VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+			P.buffers.push_back(commandBuffer);
+		}
+		VkCommandBuffer commandBuffer = P.buffers[P.used++];
+
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = swapChainFramebuffers[i];
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+						  VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording secondary command buffer!");
+		}
+		// The buffers of a reset pool come back with the same handles
+		geometry.invalidate();
+		return commandBuffer;
+	}
+
+	// Parallel recording: the groups of draws in secondary command buffers, executed by the primary one
+	void recordDrawGroups(size_t i, uint32_t groupCount) {
+		for (auto &P : recordingPools[i]) {
+			vkResetCommandPool(device, P.pool, 0);
+			P.used = 0;
+		}
+		// Indexed by the first group of each range, the other elements stay empty
+		std::vector<VkCommandBuffer> secondary(groupCount, VK_NULL_HANDLE);
+		JobSystem::shared().parallelFor(groupCount, 1, [&](size_t begin, size_t end) {
+			VkCommandBuffer commandBuffer = beginSecondaryCommandBuffer(i);
+			for (size_t group = begin; group < end; group++) {
+				populateDrawGroup(commandBuffer, static_cast<int>(i), static_cast<uint32_t>(group));
+			}
+			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to record secondary command buffer!");
 			}
+			secondary[begin] = commandBuffer;
+		});
+		secondary.erase(std::remove(secondary.begin(), secondary.end(), VK_NULL_HANDLE), secondary.end());
+		vkCmdExecuteCommands(commandBuffers[i], static_cast<uint32_t>(secondary.size()), secondary.data());
+	}
+
+	void recordCommandBuffer(size_t i) {
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = 0; // Optional
+		beginInfo.pInheritanceInfo = nullptr; // Optional
 
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass;
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = {0, 0};
-			renderPassInfo.renderArea.extent = swapChainExtent;
+		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
+					VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+		geometry.invalidate();
+		populateComputeCommands(commandBuffers[i], i);
+
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.renderArea.offset = {0, 0};
+		renderPassInfo.renderArea.extent = swapChainExtent;
 
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = {1.0f, 0};
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = initialBackgroundColor;
+		clearValues[1].depthStencil = {1.0f, 0};
 
-			renderPassInfo.clearValueCount =
-							static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
+		renderPassInfo.clearValueCount =
+						static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
 
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-					VK_SUBPASS_CONTENTS_INLINE);
+		uint32_t groupCount = drawGroupCount(static_cast<int>(i));
+		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
+				(groupCount > 0) ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
 
 
+		if (groupCount > 0) {
+			recordDrawGroups(i, groupCount);
+		} else {
 			populateCommandBuffer(commandBuffers[i], i);
+		}
 
 
-			vkCmdEndRenderPass(commandBuffers[i]);
+		vkCmdEndRenderPass(commandBuffers[i]);
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
-			}
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
 		}
 	}
 
@@ -1680,6 +2351,11 @@ protected:
 		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
 		updateUniformBuffer(imageIndex);
+		updateTextureStreaming(imageIndex);
+		if(recordCommandBuffersEveryFrame) {
+			recordCommandBuffer(imageIndex);
+			recordedGeneration[imageIndex] = textureGeneration;
+		}
 
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1728,6 +2404,72 @@ protected:
 
 	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
 
+	// Texture streaming
+	// Called every frame after updateUniformBuffer(), where the application touches the streamed textures,
+	// and after the fences of currentImage: its descriptor sets and command buffer are no longer in use
+	void updateTextureStreaming(uint32_t currentImage) {
+		if(streamedTextures.empty()) {
+			return;
+		}
+		std::vector<TextureStreamingState *> states;
+		for(Texture *T : streamedTextures) {
+			states.push_back(&T->streaming);
+		}
+		textureStreamingPlan(states, textureStreamingBudget);
+
+		// At most one image is created per frame. It is uploaded asynchronously (on the transfer queue when the
+		// device has one), and replaces the current image in a later frame, once its upload has completed:
+		// each replacement makes every command buffer be recorded again
+		bool created = false;
+		for(Texture *T : streamedTextures) {
+			if(T->streamUploading) {
+				if(uploads.completed(T->streamTicket)) {
+					textureGeneration++;
+					retiredTextures.push_back({T->textureImage, T->textureImageMemory, T->textureImageView,
+											   textureGeneration});
+					T->swapStreamedImage();
+				}
+			} else if(T->streamLoading) {
+				if(!created && (T->streamJob.pending.load() == 0)) {
+					textureStreamingJobs().wait(T->streamJob);
+					T->createStreamedImage();
+					created = true;
+				}
+			} else if(T->streaming.wantedLevel != T->streaming.residentLevel) {
+				T->loadStreamedLevels(T->streaming.wantedLevel);
+			}
+		}
+
+		if(recordedGeneration[currentImage] != textureGeneration) {
+			for(DescriptorSet *DS : textureDescriptorSets) {
+				DS->updateTextures(currentImage);
+			}
+			if(!recordCommandBuffersEveryFrame) {
+				recordCommandBuffer(currentImage);
+			}
+			recordedGeneration[currentImage] = textureGeneration;
+		}
+		uploads.flush();
+
+		uint64_t oldest = *std::min_element(recordedGeneration.begin(), recordedGeneration.end());
+		destroyRetiredTextures(oldest);
+	}
+
+	// Destroys the replaced images no longer referenced by any command buffer recorded at generation or later
+	void destroyRetiredTextures(uint64_t generation) {
+		for(size_t i = 0; i < retiredTextures.size();) {
+			RetiredTexture &R = retiredTextures[i];
+			if(R.generation > generation) {
+				i++;
+				continue;
+			}
+			vkDestroyImageView(device, R.view, nullptr);
+			vkDestroyImage(device, R.image, nullptr);
+			gpuMemory.free(R.memory);
+			retiredTextures.erase(retiredTextures.begin() + i);
+		}
+	}
+
 	virtual void pipelinesAndDescriptorSetsCleanup() = 0;
 	virtual void localCleanup() = 0;
 
@@ -1751,20 +2493,22 @@ protected:
 		createDepthResources();
 		createFramebuffers();
 		createDescriptorPool();
+		uniforms.init(this);
 
 		pipelinesAndDescriptorSetsInit();
 
 		createCommandBuffers();
+		uploads.flush();
 	}
 
 	void cleanupSwapChain() {
     	vkDestroyImageView(device, colorImageView, nullptr);
     	vkDestroyImage(device, colorImage, nullptr);
-    	vkFreeMemory(device, colorImageMemory, nullptr);
+    	gpuMemory.free(colorImageMemory);
 
 		vkDestroyImageView(device, depthImageView, nullptr);
 		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+		gpuMemory.free(depthImageMemory);
 
 		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
 			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
@@ -1772,8 +2516,15 @@ protected:
 
 		vkFreeCommandBuffers(device, commandPool,
 				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+		for (auto &imagePools : recordingPools) {
+			for (auto &P : imagePools) {
+				vkDestroyCommandPool(device, P.pool, nullptr);
+			}
+		}
+		recordingPools.clear();
 
 		pipelinesAndDescriptorSetsCleanup();
+		uniforms.cleanup();
 
 		vkDestroyRenderPass(device, renderPass, nullptr);
 
@@ -1790,6 +2541,10 @@ protected:
 		cleanupSwapChain();
 
 		localCleanup();
+		geometry.cleanup();
+		uploads.cleanup();
+		destroyRetiredTextures(UINT64_MAX);
+		assets.close();
 
     	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
@@ -1799,6 +2554,7 @@ protected:
 
     	vkDestroyCommandPool(device, commandPool, nullptr);
 
+		gpuMemory.cleanup();
  		vkDestroyDevice(device, nullptr);
 
 		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
@@ -2035,6 +2791,22 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  std::cout << "Vertex Tangent - wrong format\n";
 				}
 			    break;
+			  // Vertex compression: only checked, models fill the packed vertices from their loaded ones
+			  case VertexDescriptorElementUsage::PACKED_POSITION:
+			    if(E[i].format != VK_FORMAT_R16G16B16A16_UNORM || E[i].size != 4 * sizeof(uint16_t)) {
+				  std::cout << "Vertex Packed Position - wrong format or size\n";
+				}
+			    break;
+			  case VertexDescriptorElementUsage::PACKED_NORMAL:
+			    if(E[i].format != VK_FORMAT_R16G16_SNORM || E[i].size != 2 * sizeof(int16_t)) {
+				  std::cout << "Vertex Packed Normal - wrong format or size\n";
+				}
+			    break;
+			  case VertexDescriptorElementUsage::PACKED_UV:
+			    if(E[i].format != VK_FORMAT_R16G16_SFLOAT || E[i].size != 2 * sizeof(uint16_t)) {
+				  std::cout << "Vertex Packed UV - wrong format or size\n";
+				}
+			    break;
 			  default:
 			    break;
 			}
@@ -2071,71 +2843,90 @@ std::vector<VkVertexInputAttributeDescription> VertexDescriptor::getAttributeDes
 	return attributeDescriptions;
 }
 
+// Baked assets
+// Identifies the vertex layout a mesh has been baked for
+uint32_t VertexDescriptor::layoutKey() {
+	const VertexComponent *C[] = {&Position, &Normal, &UV, &Color, &Tangent};
+	uint32_t h = 2166136261u;
+	auto mix = [&h](uint32_t v) {
+		for(int i = 0; i < 4; i++) {
+			h = (h ^ ((v >> (8 * i)) & 0xff)) * 16777619u;
+		}
+	};
+	mix(Bindings.size() > 0 ? Bindings[0].stride : 0);
+	for(int i = 0; i < 5; i++) {
+		mix(C[i]->hasIt ? C[i]->offset : 0xffffffffu);
+	}
+	return h;
+}
+
 
 
 template <class Vert, class Instance>
 void Model<Vert, Instance>::loadModelOBJ(std::string file) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
+	OBJData obj;
 
 	std::cout << "Loading : " << file << "[OBJ]\n";
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-						  file.c_str())) {
-		throw std::runtime_error(warn + err);
+	MappedFile F;
+	if (!F.open(file)) {
+		throw std::runtime_error("Cannot open file [" + file + "]");
 	}
+	OBJParser::parse(F.data, F.size, obj);
+	F.close();
+
+	buildFromOBJ(obj);
+}
 
+// One vertex per face corner (the optimizer welds them afterwards), written through VertexTraits<Vert>:
+// the attributes missing from Vert are dropped at compile time, without tests in the loop
+template <class Vert, class Instance>
+void Model<Vert, Instance>::buildFromOBJ(const OBJData &obj) {
+	using VT = VertexTraits<Vert>;
 	std::cout << "Building\n";
-//	std::cout << "Position " << VMesh->Position.hasIt << "," << VMesh->Position.offset << "\n";
-//	std::cout << "UV " << VMesh->UV.hasIt << "," << VMesh->UV.offset << "\n";
-//	std::cout << "Normal " << VMesh->Normal.hasIt << "," << VMesh->Normal.offset << "\n";
-	for (const auto& shape : shapes) {
-		for (const auto& index : shape.mesh.indices) {
+	// Appended to what the model already has (indexBase, as firstIndex is its range in the geometry pool)
+	size_t firstVertex = vertices.size();
+	size_t indexBase = indices.size();
+	vertices.resize(firstVertex + obj.corners.size());
+	indices.resize(indexBase + obj.corners.size());
+	JobSystem::shared().parallelFor(obj.corners.size(), OBJ_MIN_CHUNK_SIZE / 16, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const OBJCorner &index = obj.corners[i];
 			Vert vertex{};
-			glm::vec3 pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
-			if(VD->Position.hasIt) {
-				glm::vec3 *o = (glm::vec3 *)((char*)(&vertex) + VD->Position.offset);
-				*o = pos;
+			if constexpr (VT::hasPosition) {
+				vertex.*VT::position = glm::vec3(
+					obj.positions[3 * index.v + 0],
+					obj.positions[3 * index.v + 1],
+					obj.positions[3 * index.v + 2]
+				);
 			}
-
-			glm::vec3 color = {
-				attrib.colors[3 * index.vertex_index + 0],
-				attrib.colors[3 * index.vertex_index + 1],
-				attrib.colors[3 * index.vertex_index + 2]
-			};
-			if(VD->Color.hasIt) {
-				glm::vec3 *o = (glm::vec3 *)((char*)(&vertex) + VD->Color.offset);
-				*o = color;
+			if constexpr (VT::hasColor) {
+				vertex.*VT::color = glm::vec3(
+					obj.colors[3 * index.v + 0],
+					obj.colors[3 * index.v + 1],
+					obj.colors[3 * index.v + 2]
+				);
 			}
-
-			glm::vec2 texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1 - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
-			if(VD->UV.hasIt) {
-				glm::vec2 *o = (glm::vec2 *)((char*)(&vertex) + VD->UV.offset);
-				*o = texCoord;
+			if constexpr (VT::hasUV) {
+				if(index.vt >= 0) {
+					vertex.*VT::uv = glm::vec2(
+						obj.texCoords[2 * index.vt + 0],
+						1 - obj.texCoords[2 * index.vt + 1]
+					);
+				}
 			}
-
-			glm::vec3 norm = {
-				attrib.normals[3 * index.normal_index + 0],
-				attrib.normals[3 * index.normal_index + 1],
-				attrib.normals[3 * index.normal_index + 2]
-			};
-			if(VD->Normal.hasIt) {
-				glm::vec3 *o = (glm::vec3 *)((char*)(&vertex) + VD->Normal.offset);
-				*o = norm;
+			if constexpr (VT::hasNormal) {
+				if(index.vn >= 0) {
+					vertex.*VT::normal = glm::vec3(
+						obj.normals[3 * index.vn + 0],
+						obj.normals[3 * index.vn + 1],
+						obj.normals[3 * index.vn + 2]
+					);
+				}
 			}
-
-			vertices.push_back(vertex);
-			indices.push_back(vertices.size()-1);
+			vertices[firstVertex + i] = vertex;
+			indices[indexBase + i] = static_cast<uint32_t>(firstVertex + i);
 		}
-	}
+	});
 	std::cout << "[OBJ] Vertices: "<< vertices.size() << "\n";
 	std::cout << "Indices: "<< indices.size() << "\n";
 
@@ -2143,12 +2934,11 @@ void Model<Vert, Instance>::loadModelOBJ(std::string file) {
 
 template <class Vert, class Instance>
 void Model<Vert, Instance>::loadModelGLTF(std::string file, bool encoded) {
-	tinygltf::Model model;
-	tinygltf::TinyGLTF loader;
-	std::string warn, err;
+	using VT = VertexTraits<Vert>;
+	GLTFReader reader;
 
 	// Light parameters
-    std::string lightFile = "lights/" + file.substr(0, file.length() - 4) + "lights";
+    std::string lightFile = lightsFileName(file);
 
     std::ifstream lightsStream(lightFile);
     std::string line;
@@ -2184,220 +2974,324 @@ void Model<Vert, Instance>::loadModelGLTF(std::string file, bool encoded) {
 
 	std::cout << "Loading : " << file << (encoded ? "[MGCG]" : "[GLTF]") << "\n";
 	if(encoded) {
-		auto modelString = readFile(file);
-
-		const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
-		const unsigned char iv[16] = {
-			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-			0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
-		};
-
-		// decrypt
-		unsigned long padded_size = 0;
-		std::vector<unsigned char> decrypted(modelString.size());
+		// Decrypted in place (AES-NI when available) and inflated straight into the glTF text
+		std::vector<char> decomp = MGCGDecoder::shared().decodeFile(file);
+		reader.parse(decomp, "");
+	} else {
+		reader.parseFile(file);
+	}
 
-		plusaes::decrypt_cbc((unsigned char*)modelString.data(), modelString.size(), &key[0], key.size(), &iv, &decrypted[0], decrypted.size(), &padded_size);
-
-		int size = 0;
-		void *decomp;
+	// Sizes are known upfront: the attributes are written once, directly in the Vert layout
+	size_t totVertices = vertices.size(), totIndices = indices.size();
+	for (const auto& primitive : reader.primitives) {
+		totVertices += std::max({primitive.position.count, primitive.normal.count,
+								 primitive.tangent.count, primitive.texCoord.count});
+		totIndices += primitive.indices.count;
+	}
+	vertices.reserve(totVertices);
+	indices.reserve(totIndices);
+
+	std::cout << "Primitives: " << reader.primitives.size() << "\n";
+	for (const auto& primitive : reader.primitives) {
+		const GLTFAccessor &pos = primitive.position;
+		const GLTFAccessor &norm = primitive.normal;
+		const GLTFAccessor &tan = primitive.tangent;
+		const GLTFAccessor &uv = primitive.texCoord;
+
+		if(!pos.isValid() && VT::hasPosition) {
+			std::cout << "Warning: vertex layout has position, but file hasn't\n";
+		}
+		if(!norm.isValid() && VT::hasNormal) {
+			std::cout << "Warning: vertex layout has normal, but file hasn't\n";
+		}
+		if(!tan.isValid() && VT::hasTangent) {
+			std::cout << "Warning: vertex layout has tangent, but file hasn't\n";
+		}
+		if(!uv.isValid() && VT::hasUV) {
+			std::cout << "Warning: vertex layout has UV, but file hasn't\n";
+		}
+		for (const GLTFAccessor *A : {&pos, &norm, &tan, &uv}) {
+			if(A->isValid() && A->componentType != GLTF_COMPONENT_FLOAT) {
+				std::cerr << "Vertex component type " << A->componentType << " not supported!" << std::endl;
+				throw std::runtime_error("Error loading GLTF component");
+			}
+		}
 
-		sscanf(reinterpret_cast<char *const>(&decrypted[0]), "%d", &size);
-//std::cout << decrypted.size() << ", decomp: " << size << "\n";
-//for(int i=0;i<32;i++) {
-//	std::cout << (int)decrypted[i] << "\n";
-//}
+		// Only the attributes present both in the file and in Vert are copied, one tight loop each
+		size_t cntTot = std::max({pos.count, norm.count, tan.count, uv.count});
+		uint32_t base = static_cast<uint32_t>(vertices.size());
+		vertices.resize(base + cntTot);
+		Vert *dst = vertices.data() + base;
+		if constexpr (VT::hasPosition) {
+			for(size_t i = 0; i < (pos.isValid() ? pos.count : 0); i++) {
+				memcpy(&(dst[i].*VT::position), pos.data + i * pos.stride, sizeof(glm::vec3));
+			}
+		}
+		if constexpr (VT::hasNormal) {
+			for(size_t i = 0; i < (norm.isValid() ? norm.count : 0); i++) {
+				memcpy(&(dst[i].*VT::normal), norm.data + i * norm.stride, sizeof(glm::vec3));
+			}
+		}
+		if constexpr (VT::hasTangent) {
+			for(size_t i = 0; i < (tan.isValid() ? tan.count : 0); i++) {
+				memcpy(&(dst[i].*VT::tangent), tan.data + i * tan.stride, sizeof(glm::vec4));
+			}
+		}
+		if constexpr (VT::hasUV) {
+			for(size_t i = 0; i < (uv.isValid() ? uv.count : 0); i++) {
+				memcpy(&(dst[i].*VT::uv), uv.data + i * uv.stride, sizeof(glm::vec2));
+			}
+		}
 
-		decomp = calloc(size, 1);
-		int n = sinflate(decomp, (int)size, &decrypted[16], decrypted.size()-16);
+		// Indices of each primitive are relative to its own vertices
+		const GLTFAccessor &idx = primitive.indices;
+		size_t first = indices.size();
+		indices.resize(first + idx.count);
+		uint32_t *out = indices.data() + first;
+		switch(idx.componentType) {
+			case GLTF_COMPONENT_UNSIGNED_BYTE:
+				for(size_t i = 0; i < idx.count; i++) {
+					out[i] = base + idx.data[i * idx.stride];
+				}
+				break;
+			case GLTF_COMPONENT_UNSIGNED_SHORT:
+				for(size_t i = 0; i < idx.count; i++) {
+					uint16_t v;
+					memcpy(&v, idx.data + i * idx.stride, sizeof(v));
+					out[i] = base + v;
+				}
+				break;
+			case GLTF_COMPONENT_UNSIGNED_INT:
+				for(size_t i = 0; i < idx.count; i++) {
+					uint32_t v;
+					memcpy(&v, idx.data + i * idx.stride, sizeof(v));
+					out[i] = base + v;
+				}
+				break;
+			default:
+				std::cerr << "Index component type " << idx.componentType << " not supported!" << std::endl;
+				throw std::runtime_error("Error loading GLTF component");
+		}
+	}
 
-		// Decrypted models
-        std::ofstream fileO;
-        std::string fileNameO = "decrypted_" + file + std::string(".gltf");
-        fileO.open(fileNameO, std::ios_base::binary);
-        fileO.write(reinterpret_cast<const char *>(decomp), size);
-        fileO.close();
+	std::cout << (encoded ? "[MGCG]" : "[GLTF]") << " Vertices: " << vertices.size()
+			  << "\nIndices: " << indices.size() << "\n";
+}
 
-		if (!loader.LoadASCIIFromString(&model, &warn, &err,
-						reinterpret_cast<const char *>(decomp), size, "/")) {
-			throw std::runtime_error(warn + err);
+template <class Vert, class Instance>
+void Model<Vert, Instance>::computeBounds() {
+	using VT = VertexTraits<Vert>;
+	minCoords = glm::vec3(0.0f);
+	maxCoords = glm::vec3(0.0f);
+	if constexpr (VT::hasPosition) {
+		if(vertices.empty()) {
+			return;
 		}
-	} else {
-		if (!loader.LoadASCIIFromFile(&model, &warn, &err,
-						file.c_str())) {
-			throw std::runtime_error(warn + err);
+		minCoords = glm::vec3(std::numeric_limits<float>::max());
+		maxCoords = glm::vec3(std::numeric_limits<float>::lowest());
+		for(const auto &vertex : vertices) {
+			minCoords = glm::min(minCoords, vertex.*VT::position);
+			maxCoords = glm::max(maxCoords, vertex.*VT::position);
 		}
 	}
+}
 
-	for (const auto& mesh :  model.meshes) {
-		std::cout << "Primitives: " << mesh.primitives.size() << "\n";
-		for (const auto& primitive :  mesh.primitives) {
-			if (primitive.indices < 0) {
-				continue;
-			}
+// The loaders write the attributes where VertexTraits<Vert> says, the pipelines read them where the
+// VertexDescriptor says: every attribute the descriptor tags must be the same member in both
+template <class Vert, class Instance>
+void Model<Vert, Instance>::checkLayout() const {
+	using VT = VertexTraits<Vert>;
+	static_assert(VT::defined, "Vertex struct without a VertexTraits specialization (see Vertex.h)");
+	auto check = [](const VertexComponent &C, bool has, uint32_t offset, const char *name) {
+		if(C.hasIt && (!has || C.offset != offset)) {
+			throw std::runtime_error(std::string("Vertex descriptor does not match VertexTraits: ") + name);
+		}
+	};
+	uint32_t offset = 0;
+	if constexpr (VT::hasPosition) offset = vertexMemberOffset(VT::position);
+	check(VD->Position, VT::hasPosition, offset, "POSITION");
+	if constexpr (VT::hasNormal) offset = vertexMemberOffset(VT::normal);
+	check(VD->Normal, VT::hasNormal, offset, "NORMAL");
+	if constexpr (VT::hasUV) offset = vertexMemberOffset(VT::uv);
+	check(VD->UV, VT::hasUV, offset, "UV");
+	if constexpr (VT::hasColor) offset = vertexMemberOffset(VT::color);
+	check(VD->Color, VT::hasColor, offset, "COLOR");
+	if constexpr (VT::hasTangent) offset = vertexMemberOffset(VT::tangent);
+	check(VD->Tangent, VT::hasTangent, offset, "TANGENT");
+}
 
-			const float *bufferPos = nullptr;
-			const float *bufferNormals = nullptr;
-			const float *bufferTangents = nullptr;
-			const float *bufferTexCoords = nullptr;
-
-			bool meshHasPos = false;
-			bool meshHasNorm = false;
-			bool meshHasTan = false;
-			bool meshHasUV = false;
-
-			int cntPos = 0;
-			int cntNorm = 0;
-			int cntTan = 0;
-			int cntUV = 0;
-			int cntTot = 0;
-
-			auto pIt = primitive.attributes.find("POSITION");
-			if(pIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &posAccessor = model.accessors[pIt->second];
-				const tinygltf::BufferView &posView = model.bufferViews[posAccessor.bufferView];
-				bufferPos = reinterpret_cast<const float *>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
-				meshHasPos = true;
-				cntPos = posAccessor.count;
-				if(cntPos > cntTot) cntTot = cntPos;
-			} else {
-				if(VD->Position.hasIt) {
-					std::cout << "Warning: vertex layout has position, but file hasn't\n";
-				}
-			}
+// Welds the duplicated vertices and reorders triangles and vertices for the GPU (see MeshOptimizer.hpp)
+template <class Vert, class Instance>
+void Model<Vert, Instance>::optimize() {
+	int positionOffset = -1;
+	if constexpr (VertexTraits<Vert>::hasPosition) {
+		positionOffset = static_cast<int>(vertexMemberOffset(VertexTraits<Vert>::position));
+	}
+	MeshOptimizerStats S = meshOptimize(vertices, indices, positionOffset, indexRangeEnds);
+	std::cout << "Optimized: " << S.verticesBefore << " -> " << S.verticesAfter << " vertices, ACMR "
+			  << S.acmrBefore << " -> " << S.acmrAfter << "\n";
+}
 
-			auto nIt = primitive.attributes.find("NORMAL");
-			if(nIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &normAccessor = model.accessors[nIt->second];
-				const tinygltf::BufferView &normView = model.bufferViews[normAccessor.bufferView];
-				bufferNormals = reinterpret_cast<const float *>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
-				meshHasNorm = true;
-				cntNorm = normAccessor.count;
-				if(cntNorm > cntTot) cntTot = cntNorm;
-			} else {
-				if(VD->Normal.hasIt) {
-					std::cout << "Warning: vertex layout has normal, but file hasn't\n";
-				}
-			}
+// Levels of detail: appends the simplified levels to the index buffer, as it is after optimize(). It must be called
+// before the upload, and the levels are not baked (the asset baker does not call it)
+template <class Vert, class Instance>
+void Model<Vert, Instance>::buildLods() {
+	if constexpr (VertexTraits<Vert>::hasPosition) {
+		int normalOffset = -1;
+		if constexpr (VertexTraits<Vert>::hasNormal) {
+			normalOffset = static_cast<int>(vertexMemberOffset(VertexTraits<Vert>::normal));
+		}
+		lods = meshBuildLods(vertices, indices, vertexMemberOffset(VertexTraits<Vert>::position), normalOffset);
+		std::cout << "Levels of detail:";
+		for(const auto &L : lods) {
+			std::cout << " " << L.indexCount / 3;
+		}
+		std::cout << " triangles\n";
+	} else {
+		throw std::runtime_error("Vertex format without position cannot be simplified");
+	}
+}
 
-			auto tIt = primitive.attributes.find("TANGENT");
-			if(tIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &tanAccessor = model.accessors[tIt->second];
-				const tinygltf::BufferView &tanView = model.bufferViews[tanAccessor.bufferView];
-				bufferTangents = reinterpret_cast<const float *>(&(model.buffers[tanView.buffer].data[tanAccessor.byteOffset + tanView.byteOffset]));
-				meshHasTan = true;
-				cntTan = tanAccessor.count;
-				if(cntTan > cntTot) cntTot = cntTan;
-			} else {
-				if(VD->Tangent.hasIt) {
-					std::cout << "Warning: vertex layout has tangent, but file hasn't\n";
-				}
+// Meshlets: splits the index buffer, as it is after optimize() and buildLods(), in clusters culled on the GPU
+// (see Meshlets.hpp), level by level. Only the meshlets of a model drawn with back faces culled (!doubleSided)
+// get a normal cone, so their triangles are oriented by their winding, as the rasterizer does
+template <class Vert, class Instance>
+void Model<Vert, Instance>::buildMeshlets() {
+	if constexpr (VertexTraits<Vert>::hasPosition) {
+		MeshletStats S;
+		meshlets.clear();
+		lodMeshlets.clear();
+		std::vector<MeshLod> levels = lods.empty() ? std::vector<MeshLod>{{0, static_cast<uint32_t>(indices.size()), 0.0f}} : lods;
+		for(const auto &L : levels) {
+			lodMeshlets.push_back(static_cast<uint32_t>(meshlets.size()));
+			std::vector<Meshlet> M = meshletBuild(vertices, indices, vertexMemberOffset(VertexTraits<Vert>::position),
+												  -1, doubleSided, &S, L.firstIndex, L.firstIndex + L.indexCount);
+			if(M.empty() && L.indexCount > 0) {
+				throw std::runtime_error("Meshlets: the indices are not a list of triangles");
 			}
+			meshlets.insert(meshlets.end(), M.begin(), M.end());
+		}
+		lodMeshlets.push_back(static_cast<uint32_t>(meshlets.size()));
+		std::cout << "Meshlets: " << S.meshlets << ", " << S.triangles / std::max<size_t>(S.meshlets, 1)
+				  << " triangles and " << S.vertices / std::max<size_t>(S.meshlets, 1) << " vertices on average, "
+				  << S.withCone << " with a normal cone\n";
+	} else {
+		throw std::runtime_error("Vertex format without position cannot be split in meshlets");
+	}
+}
 
-			auto uIt = primitive.attributes.find("TEXCOORD_0");
-			if(uIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &uvAccessor = model.accessors[uIt->second];
-				const tinygltf::BufferView &uvView = model.bufferViews[uvAccessor.bufferView];
-				bufferTexCoords = reinterpret_cast<const float *>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-				meshHasUV = true;
-				cntUV = uvAccessor.count;
-				if(cntUV > cntTot) cntTot = cntUV;
-			} else {
-				if(VD->UV.hasIt) {
-					std::cout << "Warning: vertex layout has UV, but file hasn't\n";
-				}
-			}
+// Baked assets
+// Blob layout: vertices (Vert), indices (uint32_t), lights (AssetArchiveLight)
+template <class Vert, class Instance>
+bool Model<Vert, Instance>::loadBaked(const AssetArchive &A, const std::string &file) {
+	const AssetArchiveEntry *E = A.find(file, ARCHIVE_MESH, VD->layoutKey(), {file, lightsFileName(file)});
+	if(E == nullptr) {
+		return false;
+	}
+	size_t vSize = sizeof(Vert) * E->vertexCount;
+	size_t iSize = sizeof(uint32_t) * E->indexCount;
+	if((E->vertexStride != sizeof(Vert)) ||
+	   (vSize + iSize + sizeof(AssetArchiveLight) * E->lightCount != E->size)) {
+		std::cout << "Asset archive: " << file << " does not match the vertex format, loading the source\n";
+		return false;
+	}
 
-			for(int i = 0; i < cntTot; i++) {
-				Vert vertex{};
-
-				if((i < cntPos) && meshHasPos && VD->Position.hasIt) {
-					glm::vec3 pos = {
-						bufferPos[3 * i + 0],
-						bufferPos[3 * i + 1],
-						bufferPos[3 * i + 2]
-					};
-					glm::vec3 *o = (glm::vec3 *)((char*)(&vertex) + VD->Position.offset);
-					*o = pos;
-				}
+	std::cout << "Loading : " << file << "[BAKED]\n";
+	const char *blob = A.data(*E);
+	vertices.resize(E->vertexCount);
+	memcpy(vertices.data(), blob, vSize);
+	indices.resize(E->indexCount);
+	memcpy(indices.data(), blob + vSize, iSize);
 
-				if((i < cntNorm) && meshHasNorm && VD->Normal.hasIt) {
-					glm::vec3 normal = {
-						bufferNormals[3 * i + 0],
-						bufferNormals[3 * i + 1],
-						bufferNormals[3 * i + 2]
-					};
-					glm::vec3 *o = (glm::vec3 *)((char*)(&vertex) + VD->Normal.offset);
-					*o = normal;
-				}
+	// Light parameters
+	lights.resize(E->lightCount);
+	for(uint32_t i = 0; i < E->lightCount; i++) {
+		AssetArchiveLight L;
+		memcpy(&L, blob + vSize + iSize + sizeof(AssetArchiveLight) * i, sizeof(L));
+		LightParameters &parameters = lights[i];
+		parameters.position = glm::vec3(L.position[0], L.position[1], L.position[2]);
+		parameters.lightColor = glm::vec3(L.lightColor[0], L.lightColor[1], L.lightColor[2]);
+		parameters.type = static_cast<LightType>(L.type);
+		if(parameters.type == LightType::SPOT) {
+			parameters.parameters.spot = SpotLightParameters { L.g, L.beta, L.cosout, L.cosin, glm::vec3(L.direction[0], L.direction[1], L.direction[2]) };
+		} else {
+			parameters.parameters.point = PointLightParameters { L.g, L.beta };
+		}
+	}
 
-				if((i < cntTan) && meshHasTan && VD->Tangent.hasIt) {
-					glm::vec4 tangent = {
-						bufferTangents[4 * i + 0],
-						bufferTangents[4 * i + 1],
-						bufferTangents[4 * i + 2],
-						bufferTangents[4 * i + 3]
-					};
-					glm::vec4 *o = (glm::vec4 *)((char*)(&vertex) + VD->Tangent.offset);
-					*o = tangent;
-				}
+	minCoords = glm::vec3(E->minCoords[0], E->minCoords[1], E->minCoords[2]);
+	maxCoords = glm::vec3(E->maxCoords[0], E->maxCoords[1], E->maxCoords[2]);
 
-				if((i < cntUV) && meshHasUV && VD->UV.hasIt) {
-					glm::vec2 texCoord = {
-						bufferTexCoords[2 * i + 0],
-						bufferTexCoords[2 * i + 1]
-					};
-					glm::vec2 *o = (glm::vec2 *)((char*)(&vertex) + VD->UV.offset);
-					*o = texCoord;
-				}
+	std::cout << "[BAKED] Vertices: " << vertices.size()
+			  << "\nIndices: " << indices.size() << "\n";
+	return true;
+}
 
-				vertices.push_back(vertex);
-			}
+template <class Vert, class Instance>
+void Model<Vert, Instance>::bake(AssetArchiveWriter &W, const std::string &file) {
+	size_t vSize = sizeof(Vert) * vertices.size();
+	size_t iSize = sizeof(uint32_t) * indices.size();
+	std::vector<char> blob(vSize + iSize + sizeof(AssetArchiveLight) * lights.size());
+	memcpy(blob.data(), vertices.data(), vSize);
+	memcpy(blob.data() + vSize, indices.data(), iSize);
 
-			const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
-			const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
-			const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-
-			switch(accessor.componentType) {
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
-					{
-						const uint16_t *bufferIndex = reinterpret_cast<const uint16_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
-						for(int i = 0; i < accessor.count; i++) {
-							indices.push_back(bufferIndex[i]);
-						}
-					}
-					break;
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
-					{
-						const uint32_t *bufferIndex = reinterpret_cast<const uint32_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
-						for(int i = 0; i < accessor.count; i++) {
-							indices.push_back(bufferIndex[i]);
-						}
-					}
-					break;
-				default:
-					std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-					throw std::runtime_error("Error loading GLTF component");
-			}
+	// Light parameters
+	for(size_t i = 0; i < lights.size(); i++) {
+		const LightParameters &parameters = lights[i];
+		AssetArchiveLight L{};
+		L.position[0] = parameters.position.x;
+		L.position[1] = parameters.position.y;
+		L.position[2] = parameters.position.z;
+		L.lightColor[0] = parameters.lightColor.r;
+		L.lightColor[1] = parameters.lightColor.g;
+		L.lightColor[2] = parameters.lightColor.b;
+		L.type = parameters.type;
+		if(parameters.type == LightType::SPOT) {
+			L.g = parameters.parameters.spot.g;
+			L.beta = parameters.parameters.spot.beta;
+			L.cosout = parameters.parameters.spot.cosout;
+			L.cosin = parameters.parameters.spot.cosin;
+			L.direction[0] = parameters.parameters.spot.direction.x;
+			L.direction[1] = parameters.parameters.spot.direction.y;
+			L.direction[2] = parameters.parameters.spot.direction.z;
+		} else {
+			L.g = parameters.parameters.point.g;
+			L.beta = parameters.parameters.point.beta;
 		}
+		memcpy(blob.data() + vSize + iSize + sizeof(AssetArchiveLight) * i, &L, sizeof(L));
 	}
 
-	std::cout << (encoded ? "[MGCG]" : "[GLTF]") << " Vertices: " << vertices.size()
-			  << "\nIndices: " << indices.size() << "\n";
+	AssetArchiveEntry &E = W.add(file, ARCHIVE_MESH, std::move(blob));
+	E.layoutKey = VD->layoutKey();
+	E.sourceStamp = assetSourceStamp({file, lightsFileName(file)});
+	E.vertexStride = sizeof(Vert);
+	E.vertexCount = static_cast<uint32_t>(vertices.size());
+	E.indexCount = static_cast<uint32_t>(indices.size());
+	E.lightCount = static_cast<uint32_t>(lights.size());
+	for(int i = 0; i < 3; i++) {
+		E.minCoords[i] = minCoords[i];
+		E.maxCoords[i] = maxCoords[i];
+	}
 }
 
 template <class Vert, class Instance>
 void Model<Vert, Instance>::createVertexBuffer() {
-	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						vertexBuffer, vertexBufferMemory);
+	// Vertex compression
+	std::vector<VertexPacked> packed;
+	const void *source = vertices.data();
+	vertexStride = sizeof(Vert);
+	if(compressed) {
+		if constexpr (VertexTraits<Vert>::hasPosition) {
+			dequantization = packVertices(vertices, packed);
+			source = packed.data();
+			vertexStride = sizeof(VertexPacked);
+		} else {
+			throw std::runtime_error("Vertex format without position cannot be compressed");
+		}
+	}
 
-	void* data;
-	vkMapMemory(BP->device, vertexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, vertexBufferMemory);
+	// Geometry pool: the vertices are appended to the shared vertex buffer of their size
+	vertexOffset = BP->geometry.addVertices(source, vertices.size(), vertexStride);
 }
 
 // Instance rendering
@@ -2405,52 +3299,54 @@ template <class Vert, class Instance>
 void Model<Vert, Instance>::createInstanceBuffer() {
     VkDeviceSize bufferSize = sizeof(instances[0]) * instances.size();
     instanceBufferPresent = true;
-    BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // Used to tell that the buffer can be used in vkcmdbindvertexbuffers (used below)
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |            // specifies that memory allocated with this type can be mapped for host access using vkMapMemory.
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,                     // bit specifies that the host cache management commands vkFlushMappedMemoryRanges and vkInvalidateMappedMemoryRanges are not needed to flush host writes to the device or make device writes visible to the host, respectively.
+    BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | // Used to tell that the buffer can be used in vkcmdbindvertexbuffers (used below)
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,                 // filled by a copy from the staging ring of the upload manager
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,              // instances do not change after loading: they can stay in video memory
                      instanceBuffer, instanceBufferMemory);
-
-    void* data;
-    // Once the Descriptors have been setup, the application can update them in three steps:
-    //1. Acquiring a pointer to a memory area where the CPU can write the data, using the vkMapMemory() command.
-    //2. Filling that memory area with the new values – generally done with a standard memcpy() command.
-    //3. Trigger the update of the video memory with the vkUnmapMemory() command.
-    vkMapMemory(BP->device, instanceBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, instances.data(), (size_t) bufferSize);
-    vkUnmapMemory(BP->device, instanceBufferMemory);
+    BP->uploads.uploadBuffer(instanceBuffer, instances.data(), bufferSize);
 }
 
 template <class Vert, class Instance>
 void Model<Vert, Instance>::createIndexBuffer() {
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-							 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-							 indexBuffer, indexBufferMemory);
+	// 16 bit indices halve the index buffer of every model with less than 65536 vertices
+	// (primitive restart is disabled, so no index value is reserved)
+	std::vector<uint16_t> indices16;
+	const void *source = indices.data();
+	indexType = VK_INDEX_TYPE_UINT32;
+	if(vertices.size() <= 65536) {
+		indices16.assign(indices.begin(), indices.end());
+		source = indices16.data();
+		indexType = VK_INDEX_TYPE_UINT16;
+	}
 
-	void* data;
-	vkMapMemory(BP->device, indexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, indexBufferMemory);
+	// Geometry pool: indices stay relative to the first vertex of the model (see vertexOffset)
+	firstIndex = BP->geometry.addIndices(source, indices.size(), indexType);
 }
 
 template <class Vert, class Instance>
 void Model<Vert, Instance>::initMesh(BaseProject *bp, VertexDescriptor *vd) {
 	BP = bp;
 	VD = vd;
+	checkLayout();
 	std::cout << "[Manual] Vertices: " << vertices.size()
 			  << "\nIndices: " << indices.size() << "\n";
+	optimize();
 	createVertexBuffer();
 	// Instance rendering
     if(instanceBufferPresent) createInstanceBuffer();
 	createIndexBuffer();
 }
 
+// Fills vertices, indices, lights and bounds without touching the GPU (the asset baker calls it directly)
 template <class Vert, class Instance>
-void Model<Vert, Instance>::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT) {
-	BP = bp;
+void Model<Vert, Instance>::load(VertexDescriptor *vd, std::string file, ModelType MT, const AssetArchive *A) {
 	VD = vd;
+	checkLayout();
+	// Baked assets
+	if((A != nullptr) && loadBaked(*A, file)) {
+		return;
+	}
+
 	if(MT == OBJ) {
 		loadModelOBJ(file);
 	} else if(MT == GLTF) {
@@ -2458,7 +3354,15 @@ void Model<Vert, Instance>::init(BaseProject *bp, VertexDescriptor *vd, std::str
 	} else if(MT == MGCG) {
 		loadModelGLTF(file, true);
 	}
+	optimize();
+	computeBounds();
+}
 
+// Creates the GPU buffers of a model already filled by load(): since load() does not use Vulkan,
+// several models can be loaded in parallel and uploaded afterwards
+template <class Vert, class Instance>
+void Model<Vert, Instance>::upload(BaseProject *bp) {
+	BP = bp;
 	createVertexBuffer();
 	// Instance rendering
     if(instanceBufferPresent)
@@ -2466,33 +3370,39 @@ void Model<Vert, Instance>::init(BaseProject *bp, VertexDescriptor *vd, std::str
 	createIndexBuffer();
 }
 
+template <class Vert, class Instance>
+void Model<Vert, Instance>::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT) {
+	BP = bp;
+	load(vd, file, MT, &BP->assets);
+	upload(bp);
+}
+
+// Geometry pool: vertices and indices are freed with the pool
 template <class Vert, class Instance>
 void Model<Vert, Instance>::cleanup() {
-    vkDestroyBuffer(BP->device, indexBuffer, nullptr);
-    vkFreeMemory(BP->device, indexBufferMemory, nullptr);
-    vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
-    vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
 	// Instance rendering
     if(instanceBufferPresent) {
         vkDestroyBuffer(BP->device, instanceBuffer, nullptr);
-        vkFreeMemory(BP->device, instanceBufferMemory, nullptr);
+        BP->gpuMemory.free(instanceBufferMemory);
     }
 }
 
 template <class Vert, class Instance>
 void Model<Vert, Instance>::bind(VkCommandBuffer commandBuffer) {
-	VkBuffer vertexBuffers[] = {vertexBuffer};
-	// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
-	VkDeviceSize offsets[] = {0};
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+	// Geometry pool: binds the shared vertex and index buffers, unless they are already bound
+	BP->geometry.bind(commandBuffer, vertexStride, indexType);
     // Instance rendering
 	if(instanceBufferPresent) {
         VkBuffer instanceBuffers[] = {instanceBuffer};
+        VkDeviceSize offsets[] = {0};
         vkCmdBindVertexBuffers(commandBuffer, 1, 1, instanceBuffers, offsets); // vkCmdBindVertexBuffers binds vertex buffers to a command buffer for use in subsequent drawing commands
     }
-	// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
-	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
-							VK_INDEX_TYPE_UINT32);
+}
+
+// Meshlets: the vertices of the model with another index buffer, of 32 bit indices relative to vertexOffset
+template <class Vert, class Instance>
+void Model<Vert, Instance>::bind(VkCommandBuffer commandBuffer, VkBuffer indexBuffer) {
+	BP->geometry.bind(commandBuffer, vertexStride, indexBuffer);
 }
 
 
@@ -2500,7 +3410,108 @@ void Model<Vert, Instance>::bind(VkCommandBuffer commandBuffer) {
 
 
 
+// Block compressed textures
+// Uploads the mip chains stored in DDS containers, either given directly as .dds files or baked in the
+// asset archive. Returns false (and nothing is created) if any of the images is not available in that form,
+// or if the device cannot sample BC formats: the caller then decodes the sources.
+bool Texture::createCompressedTextureImage(const char *const files[], VkFormat Fmt) {
+	if(!BP->textureCompressionBC) {
+		return false;
+	}
+	DDSImage images[maxImgs];
+	MappedFile ddsFiles[maxImgs];
+	for(int i = 0; i < imgs; i++) {
+		std::string file = files[i];
+		bool parsed = false;
+		if(file.size() > 4 && file.compare(file.size() - 4, 4, ".dds") == 0) {
+			parsed = ddsFiles[i].open(file) && images[i].parse(ddsFiles[i].data, ddsFiles[i].size);
+		} else {
+			const AssetArchiveEntry *E = BP->assets.find(file, ARCHIVE_TEXTURE, 0, {file});
+			parsed = (E != nullptr) && images[i].parse(BP->assets.data(*E), E->size);
+		}
+		if(!parsed ||
+		   ((i > 0) && ((images[i].format != images[0].format) || (images[i].width != images[0].width) ||
+						(images[i].height != images[0].height) || (images[i].mipLevels != images[0].mipLevels)))) {
+			return false;
+		}
+	}
+
+	const DDSImage &I = images[0];
+	if(!selectBlockFormat(I.format, Fmt)) {
+		return false;
+	}
+	const char *levels[maxImgs];
+	for(int i = 0; i < imgs; i++) {
+		levels[i] = images[i].data;
+		std::cout << "[" << i << "]" << files[i] << "[BC" << I.format << "] -> size: " << I.width
+				  << "x" << I.height << ", levels: " << I.mipLevels << "\n";
+	}
+	createCompressedImage(I, 0, levels);
+	return true;
+}
+
+// Sets blockFormat to the Vulkan format of a DDS, false if the device cannot sample it
+bool Texture::selectBlockFormat(DDSBlockFormat format, VkFormat Fmt) {
+	bool sRGB = (Fmt == VK_FORMAT_R8G8B8A8_SRGB);
+	if(format == DDS_BC1) {
+		blockFormat = sRGB ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	} else {
+		blockFormat = sRGB ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(BP->physicalDevice, blockFormat, &formatProperties);
+	if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+		blockFormat = VK_FORMAT_UNDEFINED;
+		return false;
+	}
+	return true;
+}
+
+// Creates textureImage with the levels of I from firstLevel to the last one: levels[i] points to the
+// bytes of firstLevel of layer i, followed by the smaller levels as in the DDS
+void Texture::createCompressedImage(const DDSImage &I, uint32_t firstLevel, const char *const levels[]) {
+	mipLevels = I.mipLevels - firstLevel;
+	uint32_t width = std::max(1u, I.width >> firstLevel);
+	uint32_t height = std::max(1u, I.height >> firstLevel);
+	VkDeviceSize layerSize = I.size - I.levelOffsets[firstLevel];
+
+	VkDeviceSize totalImageSize = layerSize * imgs;
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset;
+	char *data = static_cast<char *>(BP->uploads.stage(totalImageSize, stagingBuffer, stagingOffset));
+	std::vector<VkBufferImageCopy> regions;
+	for(int i = 0; i < imgs; i++) {
+		memcpy(data + layerSize * i, levels[i], layerSize);
+		for(uint32_t level = 0; level < mipLevels; level++) {
+			VkBufferImageCopy region{};
+			region.bufferOffset = stagingOffset + layerSize * i + I.levelOffsets[firstLevel + level] -
+								  I.levelOffsets[firstLevel];
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = level;
+			region.imageSubresource.baseArrayLayer = i;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = {0, 0, 0};
+			region.imageExtent = {std::max(1u, width >> level), std::max(1u, height >> level), 1};
+			regions.push_back(region);
+		}
+	}
+
+	BP->createImage(width, height, mipLevels, imgs, VK_SAMPLE_COUNT_1_BIT, blockFormat,
+				VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+				imgs == 6 ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+				textureImageMemory);
+
+	// All the levels are in the file: no mip generation, so the whole upload can run on the transfer queue
+	BP->uploads.uploadImage(textureImage, mipLevels, imgs, stagingBuffer, regions);
+}
+
 void Texture::createTextureImage(const char *const files[], VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
+	// Block compressed textures
+	if(createCompressedTextureImage(files, Fmt)) {
+		return;
+	}
+
 	int texWidth, texHeight, texChannels;
 	int curWidth = -1, curHeight = -1, curChannels = -1;
 	stbi_uc* pixels[maxImgs];
@@ -2534,19 +3545,12 @@ void Texture::createTextureImage(const char *const files[], VkFormat Fmt = VK_FO
 					std::log2(std::max(texWidth, texHeight)))) + 1;
 
 	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	BP->createBuffer(totalImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-	  						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-	  						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-	  						stagingBuffer, stagingBufferMemory);
-	void* data;
-	vkMapMemory(BP->device, stagingBufferMemory, 0, totalImageSize, 0, &data);
+	VkDeviceSize stagingOffset;
+	char *data = static_cast<char *>(BP->uploads.stage(totalImageSize, stagingBuffer, stagingOffset));
 	for(int i = 0; i < imgs; i++) {
-		memcpy(static_cast<char *>(data) + imageSize * i, pixels[i], static_cast<size_t>(imageSize));
+		memcpy(data + imageSize * i, pixels[i], static_cast<size_t>(imageSize));
 		stbi_image_free(pixels[i]);
 	}
-	vkUnmapMemory(BP->device, stagingBufferMemory);
 
 
 	BP->createImage(texWidth, texHeight, mipLevels, imgs, VK_SAMPLE_COUNT_1_BIT, Fmt,
@@ -2558,19 +3562,16 @@ void Texture::createTextureImage(const char *const files[], VkFormat Fmt = VK_FO
 
 	BP->transitionImageLayout(textureImage, Fmt,
 			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, imgs);
-	BP->copyBufferToImage(stagingBuffer, textureImage,
+	BP->copyBufferToImage(stagingBuffer, stagingOffset, textureImage,
 			static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), imgs);
 
 	BP->generateMipmaps(textureImage, Fmt,
 					texWidth, texHeight, mipLevels, imgs);
-
-	vkDestroyBuffer(BP->device, stagingBuffer, nullptr);
-	vkFreeMemory(BP->device, stagingBufferMemory, nullptr);
 }
 
 void Texture::createTextureImageView(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
 	textureImageView = BP->createImageView(textureImage,
-									   Fmt,
+									   (blockFormat != VK_FORMAT_UNDEFINED) ? blockFormat : Fmt,
 									   VK_IMAGE_ASPECT_COLOR_BIT,
 									   mipLevels,
 									   imgs == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D,
@@ -2627,6 +3628,27 @@ void Texture::init(BaseProject *bp, const char *  file, VkFormat Fmt = VK_FORMAT
 }
 
 
+// Baked assets
+// Stores the block compressed mip chain in a DDS container (see BlockCompression.hpp), so that at runtime
+// the levels are copied from the archive to the staging buffer as they are
+void Texture::bake(AssetArchiveWriter &W, const char *file) {
+	int texWidth, texHeight, texChannels;
+	stbi_uc *pixels = stbi_load(file, &texWidth, &texHeight,
+					&texChannels, STBI_rgb_alpha);
+	if (!pixels) {
+		std::cout << "Not found: " << file << "\n";
+		throw std::runtime_error("failed to load texture image!");
+	}
+	std::vector<char> blob = bcEncodeTexture(pixels, texWidth, texHeight);
+	stbi_image_free(pixels);
+
+	AssetArchiveEntry &E = W.add(file, ARCHIVE_TEXTURE, std::move(blob));
+	E.sourceStamp = assetSourceStamp({file});
+	E.width = texWidth;
+	E.height = texHeight;
+	E.channels = texChannels;
+}
+
 void Texture::initCubic(BaseProject *bp, const char * files[6]) {
 	BP = bp;
 	imgs = 6;
@@ -2635,12 +3657,128 @@ void Texture::initCubic(BaseProject *bp, const char * files[6]) {
 	createTextureSampler();
 }
 
+// Texture streaming
+// Loads only the tail of the mip chain of a DDS (a .dds file or a texture baked in the asset archive); the
+// finer levels follow while running, as decided by BaseProject::updateTextureStreaming(). Textures without
+// a DDS, or on devices without BC support, are loaded completely by init()
+void Texture::initStreaming(BaseProject *bp, const char *file, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
+	BP = bp;
+	imgs = 1;
+	std::string name = file;
+	bool parsed = false;
+	if(BP->textureCompressionBC) {
+		if(name.size() > 4 && name.compare(name.size() - 4, 4, ".dds") == 0) {
+			parsed = streamFile.open(name) && streamSource.parse(streamFile.data, streamFile.size);
+		} else {
+			const AssetArchiveEntry *E = BP->assets.find(name, ARCHIVE_TEXTURE, 0, {name});
+			parsed = (E != nullptr) && streamSource.parse(BP->assets.data(*E), E->size);
+		}
+	}
+	if(!parsed || !selectBlockFormat(streamSource.format, Fmt)) {
+		streamFile.close();
+		init(bp, file, Fmt);
+		return;
+	}
+
+	const DDSImage &I = streamSource;
+	streaming.levelSizes.clear();
+	for(uint32_t level = 0; level < I.mipLevels; level++) {
+		streaming.levelSizes.push_back(ddsLevelSize(I.format, std::max(1u, I.width >> level),
+													std::max(1u, I.height >> level)));
+	}
+	streaming.tailLevel = 0;
+	while((streaming.tailLevel + 1 < I.mipLevels) &&
+		  (std::max(I.width, I.height) >> streaming.tailLevel) > TEXTURE_STREAMING_TAIL_SIZE) {
+		streaming.tailLevel++;
+	}
+	streaming.residentLevel = streaming.wantedLevel = streaming.tailLevel;
+	std::cout << file << "[BC" << I.format << "] -> size: " << I.width << "x" << I.height
+			  << ", streamed from level " << streaming.tailLevel << " of " << I.mipLevels << "\n";
+
+	const char *levels[1] = {I.data + I.levelOffsets[streaming.tailLevel]};
+	createCompressedImage(I, streaming.tailLevel, levels);
+	createTextureImageView(Fmt);
+	// The sampler covers the whole chain, whatever part of it is resident
+	createTextureSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT,
+						 VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_TRUE, 16,
+						 static_cast<float>(I.mipLevels));
+	streamed = true;
+	BP->streamedTextures.push_back(this);
+}
+
+// Reports a user of the texture at the given distance from the camera in this frame
+void Texture::touch(float distance) {
+	if(streamed) {
+		streaming.distance = std::min(streaming.distance, distance);
+	}
+}
+
+// Starts reading the levels from level to the last one on the background thread
+void Texture::loadStreamedLevels(uint32_t level) {
+	streamLevel = level;
+	streamLoading = true;
+	const char *src = streamSource.data + streamSource.levelOffsets[level];
+	size_t bytes = streamSource.size - streamSource.levelOffsets[level];
+	textureStreamingJobs().run(streamJob, [this, src, bytes]() {
+		streamLevels.assign(src, src + bytes);
+	});
+}
+
+// Creates the image with the levels read by loadStreamedLevels(), and starts its upload: the current
+// image stays in use until swapStreamedImage()
+void Texture::createStreamedImage() {
+	VkImage image = textureImage;
+	GpuAllocation memory = textureImageMemory;
+	VkImageView view = textureImageView;
+
+	const char *levels[1] = {streamLevels.data()};
+	createCompressedImage(streamSource, streamLevel, levels);
+	createTextureImageView();
+	streamTicket = BP->uploads.currentSerial();
+	streamUploading = true;
+	streamLoading = false;
+	std::vector<char>().swap(streamLevels);
+
+	streamImage = textureImage;
+	streamMemory = textureImageMemory;
+	streamView = textureImageView;
+	textureImage = image;
+	textureImageMemory = memory;
+	textureImageView = view;
+}
+
+// Puts in use the image made by createStreamedImage(): the previous one must have been retired by the caller
+void Texture::swapStreamedImage() {
+	textureImage = streamImage;
+	textureImageMemory = streamMemory;
+	textureImageView = streamView;
+	streaming.residentLevel = streamLevel;
+	streamUploading = false;
+}
+
 
 void Texture::cleanup() {
+	if(streamed) {
+		if(streamLoading) {
+			textureStreamingJobs().wait(streamJob);
+			streamLoading = false;
+		}
+		if(streamUploading) {
+			BP->uploads.wait();
+			vkDestroyImageView(BP->device, streamView, nullptr);
+			vkDestroyImage(BP->device, streamImage, nullptr);
+			BP->gpuMemory.free(streamMemory);
+			streamUploading = false;
+		}
+		BP->streamedTextures.erase(std::remove(BP->streamedTextures.begin(), BP->streamedTextures.end(), this),
+								   BP->streamedTextures.end());
+		streamFile.close();
+		streamed = false;
+	}
    	vkDestroySampler(BP->device, textureSampler, nullptr);
    	vkDestroyImageView(BP->device, textureImageView, nullptr);
 	vkDestroyImage(BP->device, textureImage, nullptr);
-	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+	BP->gpuMemory.free(textureImageMemory);
 }
 
 
@@ -2649,7 +3787,7 @@ void Texture::cleanup() {
 
 void Pipeline::init(BaseProject *bp, VertexDescriptor *vd,
 					const std::string& VertShader, const std::string& FragShader,
-					std::vector<DescriptorSetLayout *> d) {
+					std::vector<DescriptorSetLayout *> d, std::vector<VkPushConstantRange> pc) {
 	BP = bp;
 	VD = vd;
 
@@ -2671,6 +3809,7 @@ void Pipeline::init(BaseProject *bp, VertexDescriptor *vd,
  	transp = false;
 
 	D = d;
+	PC = pc;
 }
 
 void Pipeline::setAdvancedFeatures(VkCompareOp _compareOp, VkPolygonMode _polyModel,
@@ -2805,8 +3944,8 @@ void Pipeline::create() {
 		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = DSL.size();
 	pipelineLayoutInfo.pSetLayouts = DSL.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+	pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(PC.size());
+	pipelineLayoutInfo.pPushConstantRanges = PC.empty() ? nullptr : PC.data();
 
 	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
 				&pipelineLayout);
@@ -2868,6 +4007,19 @@ void Pipeline::bind(VkCommandBuffer commandBuffer) {
 
 }
 
+// Push constants: writes the bytes [offset, offset + size) of the per draw data, to the stages of each range
+// that contains them
+void Pipeline::push(VkCommandBuffer commandBuffer, const void *data, uint32_t size, uint32_t offset) {
+	for(const auto &R : PC) {
+		uint32_t begin = std::max(offset, R.offset);
+		uint32_t end = std::min(offset + size, R.offset + R.size);
+		if(begin < end) {
+			vkCmdPushConstants(commandBuffer, pipelineLayout, R.stageFlags, begin, end - begin,
+							   static_cast<const char *>(data) + (begin - offset));
+		}
+	}
+}
+
 VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -2891,6 +4043,95 @@ void Pipeline::cleanup() {
 		vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
 }
 
+// GPU culling
+void ComputePipeline::init(BaseProject *bp, const std::string& CompShader, std::vector<DescriptorSetLayout *> d) {
+	BP = bp;
+
+	auto compShaderCode = readFile(CompShader);
+	std::cout << "Compute shader <" << CompShader << "> len: " <<
+				compShaderCode.size() << "\n";
+
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = compShaderCode.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(compShaderCode.data());
+	VkResult result = vkCreateShaderModule(BP->device, &createInfo, nullptr, &compShaderModule);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create shader module!");
+	}
+
+	D = d;
+}
+
+void ComputePipeline::create() {
+	std::vector<VkDescriptorSetLayout> DSL(D.size());
+	for(int i = 0; i < D.size(); i++) {
+		DSL[i] = D[i]->descriptorSetLayout;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = DSL.size();
+	pipelineLayoutInfo.pSetLayouts = DSL.data();
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
+				&pipelineLayout);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create compute pipeline layout!");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = compShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	result = vkCreateComputePipelines(BP->device, VK_NULL_HANDLE, 1,
+			&pipelineInfo, nullptr, &computePipeline);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+}
+
+void ComputePipeline::destroy() {
+	vkDestroyShaderModule(BP->device, compShaderModule, nullptr);
+}
+
+void ComputePipeline::bind(VkCommandBuffer commandBuffer) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+}
+
+// Dispatches groupCount work groups, and makes what they write visible to the indirect draws, to the index
+// fetch and to the vertex shaders of the render pass
+void ComputePipeline::dispatch(VkCommandBuffer commandBuffer, uint32_t groupCount) {
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+							VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+						 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+						 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ComputePipeline::cleanup() {
+	vkDestroyPipeline(BP->device, computePipeline, nullptr);
+	vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
+}
+
 void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B) {
 	BP = bp;
 
@@ -2929,6 +4170,13 @@ void DescriptorSetLayout::cleanup() {
 void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 						 std::vector<DescriptorSetElement> E) {
 	BP = bp;
+	elements = E;
+	for (const auto &e : E) {
+		if(e.type == TEXTURE) {
+			BP->textureDescriptorSets.push_back(this);
+			break;
+		}
+	}
 
 	uniformBuffers.resize(E.size());
 	uniformBuffersMemory.resize(E.size());
@@ -2937,13 +4185,15 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	for (int j = 0; j < E.size(); j++) {
 		uniformBuffers[j].resize(BP->swapChainImages.size());
 		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
-		if(E[j].type == UNIFORM) {
+		if(E[j].type == STORAGE) {
+			VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+									   VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
 				VkDeviceSize bufferSize = E[j].size;
-				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				BP->createBuffer(bufferSize, usage,
 									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
+									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i], GPU_MEMORY_LINEAR);
 			}
 			toFree[j] = true;
 		} else {
@@ -2951,6 +4201,22 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		}
 	}
 
+	// Uniform arena: the UNIFORM elements in binding order, and their slots for the first block
+	std::vector<int> uniformElements;
+	for (size_t j = 0; j < E.size(); j++) {
+		if(E[j].type == UNIFORM) {
+			uniformElements.push_back(static_cast<int>(j));
+		}
+	}
+	std::sort(uniformElements.begin(), uniformElements.end(),
+			  [&E](int a, int b) { return E[a].binding < E[b].binding; });
+	dynamicIndex.assign(E.size(), -1);
+	for (size_t k = 0; k < uniformElements.size(); k++) {
+		dynamicIndex[uniformElements[k]] = static_cast<int>(k);
+	}
+	dynamicOffsets.clear();
+	addBlock();
+
 	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
 											   DSL->descriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
@@ -2972,8 +4238,9 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		std::vector<VkDescriptorBufferInfo> bufferInfo(E.size());
 		std::vector<VkDescriptorImageInfo> imageInfo(E.size());
 		for (int j = 0; j < E.size(); j++) {
-			if(E[j].type == UNIFORM) {
-				bufferInfo[j].buffer = uniformBuffers[j][i];
+			if(E[j].type == UNIFORM || E[j].type == STORAGE) {
+				// Uniform arena: the offset of the slot is added when the set is bound
+				bufferInfo[j].buffer = (E[j].type == UNIFORM) ? BP->uniforms.buffers[i] : uniformBuffers[j][i];
 				bufferInfo[j].offset = 0;
 				bufferInfo[j].range = E[j].size;
 
@@ -2981,7 +4248,8 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 				descriptorWrites[j].dstSet = descriptorSets[i];
 				descriptorWrites[j].dstBinding = E[j].binding;
 				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				descriptorWrites[j].descriptorType = (E[j].type == UNIFORM) ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC :
+													 VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 				descriptorWrites[j].descriptorCount = 1;
 				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
 			} else if(E[j].type == TEXTURE) {
@@ -3007,30 +4275,619 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	}
 }
 
+// Texture streaming: writes again the descriptors of the streamed textures for one swap chain image
+void DescriptorSet::updateTextures(int currentImage) {
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	std::vector<VkDescriptorImageInfo> imageInfo(elements.size());
+	for (size_t j = 0; j < elements.size(); j++) {
+		if(elements[j].type != TEXTURE || !elements[j].tex->streamed) {
+			continue;
+		}
+		imageInfo[j].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo[j].imageView = elements[j].tex->textureImageView;
+		imageInfo[j].sampler = elements[j].tex->textureSampler;
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = descriptorSets[currentImage];
+		write.dstBinding = elements[j].binding;
+		write.dstArrayElement = elements[j].texDstArrayElement;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.descriptorCount = 1;
+		write.pImageInfo = &imageInfo[j];
+		descriptorWrites.push_back(write);
+	}
+	if(!descriptorWrites.empty()) {
+		vkUpdateDescriptorSets(BP->device, static_cast<uint32_t>(descriptorWrites.size()),
+							   descriptorWrites.data(), 0, nullptr);
+	}
+}
+
 void DescriptorSet::cleanup() {
+	BP->textureDescriptorSets.erase(std::remove(BP->textureDescriptorSets.begin(),
+												BP->textureDescriptorSets.end(), this),
+									BP->textureDescriptorSets.end());
 	for(int j = 0; j < uniformBuffers.size(); j++) {
 		if(toFree[j]) {
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
-				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
+				BP->gpuMemory.free(uniformBuffersMemory[j][i]);
 			}
 		}
 	}
 }
 
+// Uniform arena: new slots for the UNIFORM elements, mapped and bound by passing the returned block
+int DescriptorSet::addBlock() {
+	std::vector<uint32_t> offsets(std::count_if(dynamicIndex.begin(), dynamicIndex.end(), [](int k) { return k >= 0; }));
+	for (size_t j = 0; j < elements.size(); j++) {
+		if(dynamicIndex[j] >= 0) {
+			offsets[dynamicIndex[j]] = BP->uniforms.allocate(elements[j].size);
+		}
+	}
+	dynamicOffsets.push_back(offsets);
+	return static_cast<int>(dynamicOffsets.size() - 1);
+}
+
 void DescriptorSet::bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId,
-						 int currentImage) {
+						 int currentImage, int block) {
 	vkCmdBindDescriptorSets(commandBuffer,
 					VK_PIPELINE_BIND_POINT_GRAPHICS,
 					P.pipelineLayout, setId, 1, &descriptorSets[currentImage],
-					0, nullptr);
+					static_cast<uint32_t>(dynamicOffsets[block].size()), dynamicOffsets[block].data());
+}
+
+// GPU culling: binds the set to a compute pipeline
+void DescriptorSet::bind(VkCommandBuffer commandBuffer, ComputePipeline &P, int setId,
+						 int currentImage, int block) {
+	vkCmdBindDescriptorSets(commandBuffer,
+					VK_PIPELINE_BIND_POINT_COMPUTE,
+					P.pipelineLayout, setId, 1, &descriptorSets[currentImage],
+					static_cast<uint32_t>(dynamicOffsets[block].size()), dynamicOffsets[block].data());
 }
 
-void DescriptorSet::map(int currentImage, void *src, int size, int slot) {
-	void* data;
+void DescriptorSet::map(int currentImage, void *src, int size, int slot, int block) {
+	// GPU memory: the buffers are in host visible blocks, always mapped
+	if(dynamicIndex[slot] >= 0) {
+		memcpy(BP->uniforms.data(currentImage, dynamicOffsets[block][dynamicIndex[slot]]), src, size);
+	} else {
+		memcpy(uniformBuffersMemory[slot][currentImage].mapped, src, size);
+	}
+}
 
-	vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
-						size, 0, &data);
-	memcpy(data, src, size);
-	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);
+// Scene graph: writes only the bytes [offset, offset + size) of the data at src, at the same offset in the buffer
+void DescriptorSet::mapRange(int currentImage, void *src, int offset, int size, int slot, int block) {
+	char *dst = (dynamicIndex[slot] >= 0) ? BP->uniforms.data(currentImage, dynamicOffsets[block][dynamicIndex[slot]]) :
+				uniformBuffersMemory[slot][currentImage].mapped;
+	memcpy(dst + offset, static_cast<char *>(src) + offset, size);
+}
+
+// Batch transforms: the mapped memory of a UNIFORM or STORAGE element, to write it in place
+char *DescriptorSet::data(int currentImage, int slot, int block) {
+	return (dynamicIndex[slot] >= 0) ? BP->uniforms.data(currentImage, dynamicOffsets[block][dynamicIndex[slot]]) :
+		   uniformBuffersMemory[slot][currentImage].mapped;
+}
+
+// GPU culling: buffer of a UNIFORM or STORAGE element, for instance to draw from an indirect buffer
+VkBuffer DescriptorSet::buffer(int currentImage, int slot) {
+	return (dynamicIndex[slot] >= 0) ? BP->uniforms.buffers[currentImage] : uniformBuffers[slot][currentImage];
+}
+
+// Uniform arena
+void UniformArena::init(BaseProject *bp) {
+	BP = bp;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(BP->physicalDevice, &properties);
+	alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+	head = 0;
+	buffers.resize(BP->swapChainImages.size());
+	memories.resize(BP->swapChainImages.size());
+	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+		BP->createBuffer(UNIFORM_ARENA_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffers[i], memories[i], GPU_MEMORY_LINEAR);
+	}
+}
+
+uint32_t UniformArena::allocate(VkDeviceSize size) {
+	VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+	if(offset + size > UNIFORM_ARENA_SIZE) {
+		throw std::runtime_error("Uniform arena full: increase UNIFORM_ARENA_SIZE");
+	}
+	head = offset + size;
+	return static_cast<uint32_t>(offset);
+}
+
+void UniformArena::cleanup() {
+	for (size_t i = 0; i < buffers.size(); i++) {
+		vkDestroyBuffer(BP->device, buffers[i], nullptr);
+		BP->gpuMemory.free(memories[i]);
+	}
+	buffers.clear();
+	memories.clear();
+	head = 0;
+}
+
+
+// Batched uploads
+void UploadManager::init(BaseProject *bp) {
+	BP = bp;
+	QueueFamilyIndices indices = BP->findQueueFamilies(BP->physicalDevice);
+	graphicsFamily = indices.graphicsFamily.value();
+	separateTransfer = indices.transferFamily.has_value();
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	VkResult result = vkCreateCommandPool(BP->device, &poolInfo, nullptr, &commandPool);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create upload command pool!");
+	}
+
+	if(separateTransfer) {
+		transferFamily = indices.transferFamily.value();
+		poolInfo.queueFamilyIndex = transferFamily;
+		result = vkCreateCommandPool(BP->device, &poolInfo, nullptr, &transferPool);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create transfer command pool!");
+		}
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		if (vkCreateSemaphore(BP->device, &semaphoreInfo, nullptr, &transferDone) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create transfer semaphore!");
+		}
+		std::cout << "Uploads on the transfer queue family " << transferFamily << "\n";
+	} else {
+		transferFamily = graphicsFamily;
+	}
+
+	BP->createBuffer(UPLOAD_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 ringBuffer, ringMemory);
+	ringData = ringMemory.mapped;
+	ringHead = 0;
+}
+
+// Command buffer of the current batch on the graphics queue, begun on first use
+VkCommandBuffer UploadManager::record() {
+	if(recording) {
+		return current.commandBuffer;
+	}
+	if(!available.empty()) {
+		current = std::move(available.back());
+		available.pop_back();
+	} else {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = commandPool;
+		allocInfo.commandBufferCount = 1;
+		current = UploadBatch{};
+		vkAllocateCommandBuffers(BP->device, &allocInfo, &current.commandBuffer);
+
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if(vkCreateFence(BP->device, &fenceInfo, nullptr, &current.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload fence!");
+		}
+	}
+	current.serial = nextSerial++;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(current.commandBuffer, &beginInfo);
+	recording = true;
+	buffersWritten = false;
+	return current.commandBuffer;
+}
+
+// Command buffer of the current batch on the transfer queue (the graphics one without a transfer family)
+VkCommandBuffer UploadManager::recordTransfer() {
+	record();
+	if(!separateTransfer) {
+		return current.commandBuffer;
+	}
+	if(recordingTransfer) {
+		return current.transferCommandBuffer;
+	}
+	if(current.transferCommandBuffer == VK_NULL_HANDLE) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = transferPool;
+		allocInfo.commandBufferCount = 1;
+		vkAllocateCommandBuffers(BP->device, &allocInfo, &current.transferCommandBuffer);
+	}
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(current.transferCommandBuffer, &beginInfo);
+	recordingTransfer = true;
+	return current.transferCommandBuffer;
+}
+
+// Reserves size bytes of staging memory, read by the commands recorded next in the current batch:
+// returns where to write them, and the buffer and offset to copy them from
+void *UploadManager::stage(VkDeviceSize size, VkBuffer &buffer, VkDeviceSize &offset) {
+	stagedBytes += size;
+	if(size > UPLOAD_RING_SIZE) {
+		GpuAllocation memory;
+		BP->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffer, memory);
+		record();
+		current.stagingBuffers.push_back(buffer);
+		current.stagingMemories.push_back(memory);
+		offset = 0;
+		return memory.mapped;
+	}
+
+	VkDeviceSize start = (ringHead + UPLOAD_ALIGNMENT - 1) / UPLOAD_ALIGNMENT * UPLOAD_ALIGNMENT;
+	if(start + size > UPLOAD_RING_SIZE) {
+		// The ring is full: start again from its beginning once every batch reading it has completed
+		wait();
+		start = 0;
+	}
+	ringHead = start + size;
+	record();
+	buffer = ringBuffer;
+	offset = start;
+	return ringData + start;
+}
+
+void UploadManager::uploadBuffer(VkBuffer dst, const void *src, VkDeviceSize size) {
+	if(size == 0) {
+		return;
+	}
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	memcpy(stage(size, buffer, offset), src, static_cast<size_t>(size));
+
+	VkCommandBuffer commandBuffer = recordTransfer();
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = offset;
+	copyRegion.dstOffset = 0;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(commandBuffer, buffer, dst, 1, &copyRegion);
+
+	if(!separateTransfer) {
+		buffersWritten = true;
+		return;
+	}
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = transferFamily;
+	barrier.dstQueueFamilyIndex = graphicsFamily;
+	barrier.buffer = dst;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+						 0, nullptr, 1, &barrier, 0, nullptr);
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	bufferAcquires.push_back(barrier);
+}
+
+// Copies the regions of buffer to all the levels of a new image, which is left ready to be sampled
+void UploadManager::uploadImage(VkImage image, uint32_t mipLevels, int layerCount, VkBuffer buffer,
+								const std::vector<VkBufferImageCopy> &regions) {
+	VkCommandBuffer commandBuffer = recordTransfer();
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+						 0, nullptr, 0, nullptr, 1, &barrier);
+
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						   static_cast<uint32_t>(regions.size()), regions.data());
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	if(!separateTransfer) {
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+							 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+	// The layout transition is done once, by the release and acquire pair
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = transferFamily;
+	barrier.dstQueueFamilyIndex = graphicsFamily;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+						 0, nullptr, 0, nullptr, 1, &barrier);
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	imageAcquires.push_back(barrier);
+}
+
+uint64_t UploadManager::currentSerial() {
+	record();
+	return current.serial;
+}
+
+bool UploadManager::completed(uint64_t serial) {
+	poll();
+	return serial <= completedSerial;
+}
+
+// Recycles the batches already completed
+void UploadManager::poll() {
+	for(size_t i = 0; i < submitted.size();) {
+		if(vkGetFenceStatus(BP->device, submitted[i].fence) == VK_SUCCESS) {
+			release(submitted[i]);
+			submitted.erase(submitted.begin() + i);
+		} else {
+			i++;
+		}
+	}
+}
+
+// Submits the current batch, if anything was recorded: first its transfer queue part, then its graphics part
+void UploadManager::flush() {
+	poll();
+	if(!recording) {
+		return;
+	}
+
+	bool transferSubmitted = false;
+	if(recordingTransfer) {
+		vkEndCommandBuffer(current.transferCommandBuffer);
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &current.transferCommandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &transferDone;
+		VkResult result = vkQueueSubmit(BP->transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to submit transfer command buffer!");
+		}
+		submissions++;
+		recordingTransfer = false;
+		transferSubmitted = true;
+	}
+
+	if(!bufferAcquires.empty() || !imageAcquires.empty()) {
+		vkCmdPipelineBarrier(current.commandBuffer,
+							 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+							 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+							 0, nullptr,
+							 static_cast<uint32_t>(bufferAcquires.size()), bufferAcquires.data(),
+							 static_cast<uint32_t>(imageAcquires.size()), imageAcquires.data());
+		bufferAcquires.clear();
+		imageAcquires.clear();
+	}
+	if(buffersWritten) {
+		// The geometry copies happen before any later vertex fetch, in this or in the next submissions
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		vkCmdPipelineBarrier(current.commandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+							 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	vkEndCommandBuffer(current.commandBuffer);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &current.commandBuffer;
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	if(transferSubmitted) {
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &transferDone;
+		submitInfo.pWaitDstStageMask = &waitStage;
+	}
+	VkResult result = vkQueueSubmit(BP->graphicsQueue, 1, &submitInfo, current.fence);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to submit upload command buffer!");
+	}
+	submissions++;
+	submitted.push_back(std::move(current));
+	recording = false;
+}
+
+// Submits the current batch and waits for all the submitted ones: the whole ring is free afterwards
+void UploadManager::wait() {
+	flush();
+	for(auto &B : submitted) {
+		vkWaitForFences(BP->device, 1, &B.fence, VK_TRUE, UINT64_MAX);
+		release(B);
+	}
+	submitted.clear();
+	ringHead = 0;
+}
+
+void UploadManager::release(UploadBatch &B) {
+	completedSerial = std::max(completedSerial, B.serial);
+	for(size_t i = 0; i < B.stagingBuffers.size(); i++) {
+		vkDestroyBuffer(BP->device, B.stagingBuffers[i], nullptr);
+		BP->gpuMemory.free(B.stagingMemories[i]);
+	}
+	B.stagingBuffers.clear();
+	B.stagingMemories.clear();
+	vkResetFences(BP->device, 1, &B.fence);
+	vkResetCommandBuffer(B.commandBuffer, 0);
+	if(B.transferCommandBuffer != VK_NULL_HANDLE) {
+		vkResetCommandBuffer(B.transferCommandBuffer, 0);
+	}
+	available.push_back(std::move(B));
+}
+
+void UploadManager::cleanup() {
+	wait();
+	for(auto &B : available) {
+		vkDestroyFence(BP->device, B.fence, nullptr);
+	}
+	available.clear();
+	vkDestroyCommandPool(BP->device, commandPool, nullptr);
+	if(separateTransfer) {
+		vkDestroyCommandPool(BP->device, transferPool, nullptr);
+		vkDestroySemaphore(BP->device, transferDone, nullptr);
+	}
+	vkDestroyBuffer(BP->device, ringBuffer, nullptr);
+	BP->gpuMemory.free(ringMemory);
+}
+
+
+
+// Geometry pool
+void GeometryPool::init(BaseProject *bp) {
+	BP = bp;
+}
+
+int32_t GeometryPool::addVertices(const void *vertices, size_t count, uint32_t stride) {
+	if(built) {
+		throw std::runtime_error("geometry pool already uploaded: models must be created in localInit()");
+	}
+	if(stride == 0) {
+		throw std::runtime_error("geometry pool: vertices without a size");
+	}
+	if(count == 0) {
+		return 0;
+	}
+	GeometryArena *A = nullptr;
+	for(auto &arena : arenas) {
+		if(arena.stride == stride) {
+			A = &arena;
+		}
+	}
+	if(A == nullptr) {
+		arenas.push_back(GeometryArena{stride, {}, VK_NULL_HANDLE, GpuAllocation{}});
+		A = &arenas.back();
+	}
+	int32_t vertexOffset = static_cast<int32_t>(A->data.size() / stride);
+	const char *src = static_cast<const char *>(vertices);
+	A->data.insert(A->data.end(), src, src + count * stride);
+	return vertexOffset;
+}
+
+uint32_t GeometryPool::addIndices(const void *indices, size_t count, VkIndexType indexType) {
+	if(built) {
+		throw std::runtime_error("geometry pool already uploaded: models must be created in localInit()");
+	}
+	uint32_t firstIndex;
+	if(indexType == VK_INDEX_TYPE_UINT16) {
+		firstIndex = static_cast<uint32_t>(indices16.size());
+		const uint16_t *src = static_cast<const uint16_t *>(indices);
+		indices16.insert(indices16.end(), src, src + count);
+	} else {
+		firstIndex = static_cast<uint32_t>(indices32.size());
+		const uint32_t *src = static_cast<const uint32_t *>(indices);
+		indices32.insert(indices32.end(), src, src + count);
+	}
+	return firstIndex;
+}
+
+// Creates the shared buffers and uploads everything added so far
+void GeometryPool::build() {
+	VkDeviceSize vertexBytes = 0;
+	for(auto &A : arenas) {
+		if(A.data.empty()) {
+			continue;
+		}
+		BP->createBuffer(A.data.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, A.buffer, A.memory);
+		BP->uploads.uploadBuffer(A.buffer, A.data.data(), A.data.size());
+		vertexBytes += A.data.size();
+		std::vector<char>().swap(A.data);
+	}
+
+	// The 32 bit indices start at a multiple of their size
+	VkDeviceSize bytes16 = sizeof(uint16_t) * indices16.size();
+	indices32Offset = (bytes16 + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t);
+	VkDeviceSize indexBytes = indices32Offset + sizeof(uint32_t) * indices32.size();
+	if(indexBytes > 0) {
+		std::vector<char> data(indexBytes);
+		memcpy(data.data(), indices16.data(), bytes16);
+		memcpy(data.data() + indices32Offset, indices32.data(), sizeof(uint32_t) * indices32.size());
+		BP->createBuffer(indexBytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexMemory);
+		BP->uploads.uploadBuffer(indexBuffer, data.data(), indexBytes);
+	}
+	std::vector<uint16_t>().swap(indices16);
+	std::vector<uint32_t>().swap(indices32);
+	built = true;
+
+	std::cout << "Geometry pool: " << arenas.size() << " vertex buffers, "
+			  << vertexBytes << " B of vertices, " << indexBytes << " B of indices\n";
+}
+
+void GeometryPool::bindVertices(VkCommandBuffer commandBuffer, uint32_t stride) {
+	Bindings &B = bound();
+	if(commandBuffer != B.commandBuffer) {
+		invalidate();
+		B.commandBuffer = commandBuffer;
+	}
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	for(auto &A : arenas) {
+		if(A.stride == stride) {
+			vertexBuffer = A.buffer;
+		}
+	}
+	if(vertexBuffer != B.vertexBuffer) {
+		VkDeviceSize offsets[] = {0};
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+		B.vertexBuffer = vertexBuffer;
+	}
+}
+
+// Meshlets: the index buffer is not the one of the pool, which is bound again by the next bind()
+void GeometryPool::bind(VkCommandBuffer commandBuffer, uint32_t stride, VkBuffer otherIndexBuffer) {
+	bindVertices(commandBuffer, stride);
+	vkCmdBindIndexBuffer(commandBuffer, otherIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	bound().indexType = VK_INDEX_TYPE_MAX_ENUM;
+}
+
+void GeometryPool::bind(VkCommandBuffer commandBuffer, uint32_t stride, VkIndexType indexType) {
+	bindVertices(commandBuffer, stride);
+	Bindings &B = bound();
+	if(indexType != B.indexType) {
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer,
+							 (indexType == VK_INDEX_TYPE_UINT16) ? 0 : indices32Offset, indexType);
+		B.indexType = indexType;
+	}
+}
+
+// Forgets the bindings of the calling thread: called whenever a command buffer starts being recorded
+void GeometryPool::invalidate() {
+	bound() = Bindings{};
+}
+
+void GeometryPool::cleanup() {
+	for(auto &A : arenas) {
+		if(A.buffer != VK_NULL_HANDLE) {
+			vkDestroyBuffer(BP->device, A.buffer, nullptr);
+			BP->gpuMemory.free(A.memory);
+		}
+	}
+	arenas.clear();
+	if(indexBuffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+		BP->gpuMemory.free(indexMemory);
+		indexBuffer = VK_NULL_HANDLE;
+	}
+	built = false;
 }
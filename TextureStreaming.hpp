@@ -0,0 +1,75 @@
+#pragma once
+
+// Texture streaming
+// A streamed texture starts with only its smallest mip levels (the tail, up to TEXTURE_STREAMING_TAIL_SIZE
+// pixels per side) in video memory, and receives the finer ones while the application is already running.
+// Each frame the application reports, for every streamed texture, the distance of its nearest user
+// (Texture::touch); a texture that is not touched is unused or culled. From those distances the planner
+// chooses how many levels each texture should keep:
+//  - full resolution up to TEXTURE_STREAMING_DETAIL_DISTANCE, one level less at each doubling of the distance;
+//  - when the total exceeds the budget, the finest level of the farthest texture is dropped, until it fits.
+// The levels are read from the DDS data (see DDSImage.hpp) on a background thread; the GPU side is done
+// by BaseProject, which swaps the images between frames (see BaseProject::updateTextureStreaming).
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "JobSystem.hpp"
+
+#define TEXTURE_STREAMING_TAIL_SIZE 64
+#define TEXTURE_STREAMING_DETAIL_DISTANCE 4.0f
+#define TEXTURE_STREAMING_DEFAULT_BUDGET (64ull << 20)
+
+struct TextureStreamingState {
+    std::vector<size_t> levelSizes;     // bytes of each level of the complete chain
+    uint32_t tailLevel = 0;             // first level of the tail, always resident
+    uint32_t residentLevel = 0;         // finest level in video memory
+    uint32_t wantedLevel = 0;           // finest level chosen by the planner
+    float distance = std::numeric_limits<float>::infinity();  // nearest user since the last plan
+
+    size_t bytesFrom(uint32_t level) const {
+        size_t bytes = 0;
+        for (uint32_t l = level; l < levelSizes.size(); l++) bytes += levelSizes[l];
+        return bytes;
+    }
+
+    // Finest level worth keeping at the current distance
+    uint32_t levelForDistance() const {
+        if (!std::isfinite(distance)) return tailLevel;
+        float ratio = std::max(distance, TEXTURE_STREAMING_DETAIL_DISTANCE) / TEXTURE_STREAMING_DETAIL_DISTANCE;
+        return std::min(tailLevel, static_cast<uint32_t>(std::floor(std::log2(ratio))));
+    }
+};
+
+// Sets wantedLevel of every texture so that together they fit in budget bytes (the tails always stay),
+// then forgets the distances of this frame
+inline void textureStreamingPlan(const std::vector<TextureStreamingState *> &textures, size_t budget) {
+    size_t total = 0;
+    for (auto *T: textures) {
+        T->wantedLevel = T->levelForDistance();
+        total += T->bytesFrom(T->wantedLevel);
+    }
+    while (total > budget) {
+        TextureStreamingState *farthest = nullptr;
+        for (auto *T: textures) {
+            if (T->wantedLevel < T->tailLevel && (farthest == nullptr || T->distance > farthest->distance)) {
+                farthest = T;
+            }
+        }
+        if (farthest == nullptr) break;
+        total -= farthest->levelSizes[farthest->wantedLevel];
+        farthest->wantedLevel++;
+    }
+    for (auto *T: textures) {
+        T->distance = std::numeric_limits<float>::infinity();
+    }
+}
+
+// Background thread of the streamer: a private pool with one worker, so that levels are read even on
+// machines where the shared pool has no workers
+inline JobSystem &textureStreamingJobs() {
+    static JobSystem js(1);
+    return js;
+}
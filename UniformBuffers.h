@@ -6,6 +6,7 @@
 #define VTEMPLATE_UNIFORMBUFFERS_H
 
 #include <vector>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include "Parameters.hpp"
 
@@ -45,18 +46,30 @@ struct PointLight {
 //     vec4  : alignas(16)
 //     mat3  : alignas(16)
 //     mat4  : alignas(16)
+// Material of the objects drawn with Shader, ShaderMultiTexture and VColor: the same in every frame
 struct UniformBlock {
     alignas(4) float amb;
     alignas(4) float gamma;
     alignas(16) glm::vec3 sColor;
-    alignas(16) glm::mat4 mvpMat;
+};
+
+// Push constants of the same shaders, set before each draw: the view-projection is in GlobalUniformBlock.
+// With packed vertices worldMat includes the dequantization of the positions, nMat does not
+struct ObjectPushConstants {
     alignas(16) glm::mat4 worldMat;
-    alignas(16) glm::mat4 nMat;
+    alignas(16) glm::mat3x4 nMat;   // only the xyz of its columns are used
 
     //These factors are used to decide if the light is on or off
     alignas(4) float diffuseLight = 1.0f;
     alignas(4) float internalLightsFactor = 0.0f;
+
+    void setWorld(const glm::mat4 &world) {
+        worldMat = world;
+        nMat = glm::mat3x4(glm::inverse(glm::transpose(world)));
+    }
 };
+// Vulkan guarantees 128 bytes of push constants
+static_assert(sizeof(ObjectPushConstants) <= 128, "push constants larger than the guaranteed size");
 
 
 // Door requires (N_ROOMS - 1) + 2 instances
@@ -68,13 +81,13 @@ struct UniformBlockInstance {
     alignas(4) float amb;
     alignas(4) float gamma;
     alignas(16) glm::vec3 sColor;
-    alignas(16) glm::mat4 prjViewMat;
     alignas(16) glm::vec4 rotOffsetAndLights[MAXIMUM_INSTANCES_PER_BUFFER];
     alignas(4) float diffuseLight = 1.0f;
     alignas(4) float internalLightsFactor = 0.0f;
 };
 
 struct GlobalUniformBlock {
+    alignas(16) glm::mat4 viewPrj;   // for the objects with push constants
     alignas(16) glm::vec3 DlightDir;
     alignas(16) glm::vec3 DlightColor;
     alignas(16) glm::vec3 eyePos;
@@ -89,4 +102,38 @@ struct OverlayUniformBlock {
     alignas(4) int overlayTex;
 };
 
+// GPU culling (std430 storage buffers and uniform of shaders/Cull.comp and shaders/Meshlets.comp)
+struct CullUniformBlock {
+    alignas(16) glm::vec4 planes[6]; // view frustum, see Culling.hpp
+    alignas(4) uint32_t objectCount;
+    alignas(16) glm::vec4 cameraPos; // meshlets: for their normal cones
+    alignas(4) uint32_t meshletWorkCount;
+};
+
+struct CullObject {
+    alignas(16) glm::vec4 boundsMin;    // world space bounding box
+    alignas(16) glm::vec4 boundsMax;
+    alignas(16) glm::vec4 instanceData; // instanced models: base rotation and position (see ModelInstance)
+    alignas(4) uint32_t draw;           // indirect command drawing the object
+    alignas(4) uint32_t instance;       // index of the instance in its model
+};
+
+// Of each furniture object, by its index (the instance of its CullObject): with the view-projection of
+// GlobalUniformBlock, it only changes when the object moves
+struct ObjectTransform {
+    alignas(16) glm::mat4 worldMat;
+    alignas(16) glm::mat4 nMat;
+};
+
+// Meshlets: a meshlet of a visible object, tested by one work group
+struct MeshletWork {
+    alignas(4) uint32_t meshlet;
+    alignas(4) uint32_t object;         // in the meshlet objects
+};
+
+struct MeshletObject {
+    alignas(16) glm::mat4 worldMat;     // without the dequantization of the positions (the meshlets are not packed)
+    alignas(4) uint32_t draw;           // indirect command receiving its visible triangles
+};
+
 #endif //VTEMPLATE_UNIFORMBUFFERS_H
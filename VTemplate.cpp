@@ -18,12 +18,17 @@
 
 namespace fs = std::filesystem;
 
+// Parallel recording: the groups of draws of the render pass, one per pipeline, in the order they are drawn
+enum DrawGroup {
+    DRAW_BUILDING, DRAW_MESHES, DRAW_FURNITURE, DRAW_OVERLAY, DRAW_POLIKEA, DRAW_INSTANCED, DRAW_GROUPS
+};
+
 // ----- MODEL INFO STRUCT ----- //
 // Struct used to store data related to a model
 struct ModelInfo {
     Model<Vertex> model;
     DescriptorSet dsModel;
-    UniformBlock modelUBO{};
+    ObjectPushConstants modelPC{};
     glm::vec3 modelPos{};
     float modelRot = 0.0;
     bool hasBeenBought = false;
@@ -35,6 +40,8 @@ struct ModelInfo {
     glm::vec3 size;
     glm::vec3 center;
     uint8_t roomCycling = 0;
+    uint32_t lod = 0;                       // level of detail drawn in the last frame
+    uint32_t firstSpotLight = 0, firstPointLight = 0;   // of its lights in GlobalUniformBlock
 
     glm::vec3 getMinCoordPos() const { return minCoords + modelPos; }
 
@@ -76,10 +83,12 @@ protected:
     DescriptorSetLayout DSLMesh, DSLMeshMultiTex, DSLInstance, DSLGubo, DSLOverlay, DSLVertexWithColors;
 
     // Vertex formats
-    VertexDescriptor VMesh, VMeshTexID, VOverlay, VVertexWithColor, VMeshInstanced;
+    VertexDescriptor VMesh, VMeshTexID, VOverlay, VVertexWithColor;
+    // Vertex compression: layouts of the models drawn with packed vertices (VertexPacked)
+    VertexDescriptor VMeshPacked, VMeshTexIDPacked;
 
     // Pipelines [Shader couples]
-    Pipeline PMesh, PMeshMultiTexture, POverlay, PVertexWithColors, PMeshInstanced;
+    Pipeline PMesh, PMeshPacked, PMeshPackedClosed, PMeshMultiTexture, POverlay, PVertexWithColors, PMeshInstanced;
 
     // Models, textures and Descriptors (values assigned to the uniforms)
     // Please note that Model objects depends on the corresponding vertex structure
@@ -94,7 +103,9 @@ protected:
     // Textures
     Texture TAsphalt, TFurniture, TFence, TPlankWall, TOverlayMoveObject, TBathFloor, TDarkFloor, TTiledStones, TOverlayBuyObject, TCharacter;
     // C++ storage for uniform variables
-    UniformBlock uboPolikeaExternFloor, uboFence, uboPolikea, uboBuilding;
+    // Push constants: the objects drawn one at a time, all with the same material
+    ObjectPushConstants pcPolikeaExternFloor, pcFence, pcPolikea, pcBuilding;
+    UniformBlock material{0.05f, 180.0f, glm::vec3(1.0f)};
     GlobalUniformBlock gubo;
     OverlayUniformBlock uboMoveOrBuyOverlay;
 
@@ -125,11 +136,83 @@ protected:
     std::vector<BoundingRectangle> roomOccupiedArea;
 
     Model<Vertex, ModelInstance> MDoor, MPositionedLights;
-    DescriptorSet DSDoor, DSPositionedLights;
+    // Uniform arena: the doors and the lights share a set, with a block each
+    DescriptorSet DSInstanced;
+    int doorBlock = 0, lightBlock = 0;
     UniformBlockInstance uboDoor, uboPositionedLights;
 
     std::vector<OpenableDoor> doors;
 
+    // GPU culling: furniture, doors and positioned lights are drawn by indirect commands, whose instances are
+    // the objects found inside the view frustum by PCull
+    DescriptorSetLayout DSLCull;
+    DescriptorSet DSCull, DSFurniture;
+    ComputePipeline PCull;
+    CullUniformBlock uboCull;
+    ObjectPushConstants pcFurniture;    // only the light factors, the transforms are in DSCull
+    std::vector<CullObject> cullObjects;
+    std::vector<VkDrawIndexedIndirectCommand> cullCommands;
+    BatchTransforms furnitureTransforms;    // written by compute() straight into the buffer of DSCull
+    uint32_t doorDraw = 0, lightDraw = 0;   // the furniture models are drawn by the first commands
+    std::vector<uint32_t> furnitureDraws;   // command of each furniture model: the double sided ones, then the closed ones
+    uint32_t closedFurnitureDraw = 0;
+
+    // Meshlets: the indices of a furniture command are the triangles of its meshlets that PMeshlets finds visible
+    // (for the objects left by the culling on the CPU), written in the index buffer of DSMeshlets
+    DescriptorSetLayout DSLMeshlets;
+    DescriptorSet DSMeshlets;
+    ComputePipeline PMeshlets;
+    std::vector<Meshlet> meshlets;                  // of all the furniture, ranges of meshletIndices
+    std::vector<uint32_t> meshletIndices;
+    std::vector<uint32_t> furnitureMeshlets;        // first meshlet of each furniture model (of its level 0), and the total
+    std::vector<MeshletObject> meshletObjects;
+    std::vector<MeshletWork> meshletWork;
+    uint32_t furnitureIndices = 0;                  // size of the index buffer of DSMeshlets
+
+    // Levels of detail of the furniture (their meshlets), the character and the Polikea building, chosen every frame
+    // by the error of the levels in pixels; the triangles drawn, against those of the full meshes, are in the title
+    uint32_t polikeaLod = 0;
+    size_t lodTrianglesFull = 0, lodTrianglesDrawn = 0;
+    float lodTitleTime = 0.0f;
+
+    // CPU culling: the objects above and the character are first tested on the CPU, 8 at a time; only the
+    // visible ones are sent to PCull, and the command buffer (recorded every frame) skips the empty groups
+    CullingBoxes cpuCullBoxes;
+    std::vector<uint8_t> cpuVisible;
+    std::vector<CullObject> visibleCullObjects;
+    uint32_t visibleFurniture = 0, visibleDoors = 0, visibleLights = 0;
+    bool characterVisible = false;
+
+    // Room/portal visibility: from inside a room, the other rooms are seen only through the door openings. The
+    // rooms (their part of MBuilding, furniture, doors and lights) are culled with the frustum narrowed to what
+    // is seen of them; from outside the rooms everything uses the frustum of the camera
+    std::vector<Portal> roomPortals;            // the first doors, in the same order
+    std::vector<ScreenRect> roomRects;
+    std::vector<Frustum> roomFrusta;
+    uint32_t roomLightsFirst = 0;               // first positioned light of the rooms, one per room
+    int cameraRoom = -1;
+
+    // Occlusion culling: the walls of the rooms hide the objects behind them. Polikea is not an occluder, as
+    // nothing tells which parts of its mesh are opaque. For debugging, O writes the occlusion buffer of the next
+    // frame to the file occlusion.pgm, and prints the number of objects it culled
+    std::vector<Occluder> occluders;
+    OcclusionBuffer occlusion;
+    bool dumpOcclusion = false;
+    bool occlusionDebounce = false;
+
+    // Scene graph: node i is the furniture object MV[i], then come the doors and the character. The transforms,
+    // the bounds, the lights and the uniforms derived from the nodes are updated only where the nodes changed,
+    // and written to the buffers of an image only when they changed since the last frame it drew
+    SceneGraph scene;
+    int firstDoorNode = 0, characterNode = 0;
+    std::vector<uint64_t> sceneUploaded;        // serial of the scene in the buffers of each image
+    uint64_t lightsVersion = 0;                 // serial of the scene when the lights of gubo last changed
+    uint32_t firstPositionedLight = 0;          // of the positioned lights in the point lights of gubo
+    bool positionedLightsOff = false;
+
+    // Texture streaming: bounds of the building vertices using each texture ID
+    std::vector<glm::vec3> buildingTexMin, buildingTexMax;
+
     inline glm::vec3
     rotateTargetRespectToCam(glm::vec3 CamPosition, float CameraAlpha, float CameraBeta, glm::vec3 modelPosition) {
         return glm::translate(glm::mat4(1.0f), CamPosition) *
@@ -149,9 +232,13 @@ protected:
         initialBackgroundColor = {0.4f, 1.0f, 1.0f, 1.0f};
 
         // Descriptor pool sizes
-        uniformBlocksInPool = 24; // 15 * furniture + 1 * (DScharacter, DSPolikeaExternFloor, DSFence, DSGubo, DSOverlayMoveObject, DSPolikeaBuilding, DSBuilding, DSDoor, DSPositionedLights)
-        texturesInPool = 27;      // 15 * furniture + 1 * (DSPolikeaExternFloor, DSFence, DSDoor, DSPositionedLights, DSCharacter) + 2 * DSOverlayMoveObject + 5 * DSBuilding
-        setsInPool = 24;          // 15 * furniture + 1 * (DSCharacter, DSPolikeaExternFloor, DSFence, DSGubo, DSOverlayMoveObject, DSPolikeaBuilding, DSBuilding, DSDoor, DSPositionedLights)
+        uniformBlocksInPool = 10; // 1 * (DSFurniture, DSCull, DScharacter, DSPolikeaExternFloor, DSFence, DSGubo, DSOverlayMoveObject, DSPolikeaBuilding, DSBuilding, DSInstanced)
+        texturesInPool = 12;      // 1 * (DSFurniture, DSPolikeaExternFloor, DSFence, DSInstanced, DSCharacter) + 2 * DSOverlayMoveObject + 5 * DSBuilding
+        setsInPool = 11;          // 1 * (DSFurniture, DSCull, DSMeshlets, DSCharacter, DSPolikeaExternFloor, DSFence, DSGubo, DSOverlayMoveObject, DSPolikeaBuilding, DSBuilding, DSInstanced)
+        storageBlocksInPool = 9;  // 4 * DSCull + 5 * DSMeshlets
+
+        // CPU culling: what is drawn depends on the camera
+        recordCommandBuffersEveryFrame = true;
 
         Ar = (float) windowWidth / (float) windowHeight;
     }
@@ -172,26 +259,42 @@ protected:
                 //                  using the corresponding Vulkan constant
                 // third  element : the pipeline stage where it will be used
                 //                  using the corresponding Vulkan constant
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         VK_SHADER_STAGE_ALL_GRAPHICS},
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS},
                 {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
         });
         DSLMeshMultiTex.init(this, {
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         VK_SHADER_STAGE_ALL_GRAPHICS},
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS},
                 {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 5}
         });
         DSLInstance.init(this, {
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         VK_SHADER_STAGE_ALL_GRAPHICS},
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS},
                 {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
         });
         DSLGubo.init(this, {
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT}
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS}
         });
         DSLOverlay.init(this, {
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         VK_SHADER_STAGE_ALL_GRAPHICS},
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS},
                 {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2}
         });
         DSLVertexWithColors.init(this, {
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS}
+        });
+        // GPU culling: frustum, objects, indirect commands, visible objects and furniture transforms
+        DSLCull.init(this, {
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT},
+                {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT},
+                {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT},
+                {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT}
+        });
+        // Meshlets: meshlets, their indices, meshlets to test, their objects and the visible indices
+        DSLMeshlets.init(this, {
+                {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT}
         });
 
         // Vertex descriptors
@@ -216,6 +319,8 @@ protected:
                            //                   UV       - a vec2 with a UV coordinate
                            //                   COLOR    - a vec4 with a RGBA color
                            //                   TANGENT  - a vec4 with the tangent vector
+                           //                   PACKED_POSITION, PACKED_NORMAL, PACKED_UV - the members
+                           //                              of VertexPacked (see VertexCompression.hpp)
                            //                   OTHER    - anything else
                            //
                            // ***************** DOUBLE CHECK ********************
@@ -244,6 +349,31 @@ protected:
                                         sizeof(uint8_t),   OTHER},
                         });
 
+        // Vertex compression
+        // The models are still loaded with the float layouts above, and packed when their buffers are created
+        VMeshPacked.init(this, {
+                {0, sizeof(VertexPacked), VK_VERTEX_INPUT_RATE_VERTEX}
+        }, {
+                                 {0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(VertexPacked, pos),
+                                         4 * sizeof(uint16_t), PACKED_POSITION},
+                                 {0, 1, VK_FORMAT_R16G16_SNORM,       offsetof(VertexPacked, norm),
+                                         2 * sizeof(int16_t),  PACKED_NORMAL},
+                                 {0, 2, VK_FORMAT_R16G16_SFLOAT,      offsetof(VertexPacked, UV),
+                                         2 * sizeof(uint16_t), PACKED_UV},
+                         });
+
+        // Same packed layout: the texture ID is read from the 4th component of the position
+        VMeshTexIDPacked.init(this, {
+                {0, sizeof(VertexPacked), VK_VERTEX_INPUT_RATE_VERTEX}
+        }, {
+                                      {0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(VertexPacked, pos),
+                                              4 * sizeof(uint16_t), PACKED_POSITION},
+                                      {0, 1, VK_FORMAT_R16G16_SNORM,       offsetof(VertexPacked, norm),
+                                              2 * sizeof(int16_t),  PACKED_NORMAL},
+                                      {0, 2, VK_FORMAT_R16G16_SFLOAT,      offsetof(VertexPacked, UV),
+                                              2 * sizeof(uint16_t), PACKED_UV},
+                              });
+
         VOverlay.init(this, {
                 {0, sizeof(VertexOverlay), VK_VERTEX_INPUT_RATE_VERTEX}
         }, {
@@ -264,46 +394,82 @@ protected:
                                               sizeof(glm::vec3), COLOR}
                               });
 
-        VMeshInstanced.init(this, {
-                {0, sizeof(Vertex),        VK_VERTEX_INPUT_RATE_VERTEX},
-                {1, sizeof(ModelInstance), VK_VERTEX_INPUT_RATE_INSTANCE}
-        }, {
-                                    {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos),
-                                                                                               sizeof(glm::vec3), POSITION},
-                                    {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, norm),
-                                                                                               sizeof(glm::vec3), NORMAL},
-                                    {0, 2, VK_FORMAT_R32G32_SFLOAT,    offsetof(Vertex, UV),
-                                                                                               sizeof(glm::vec2), UV},
-                                    {1, 3, VK_FORMAT_R32_SFLOAT,       offsetof(ModelInstance,
-                                                                                baseRot),      sizeof(float),     OTHER},
-                                    {1, 4, VK_FORMAT_R32G32B32_SFLOAT, offsetof(ModelInstance,
-                                                                                pos),          sizeof(glm::vec3), OTHER}
-                            });
-
         // Pipelines [Shader couples]
         // The second parameter is the pointer to the vertex definition
         // Third and fourth parameters are respectively the vertex and fragment shaders
         // The last array, is a vector of pointer to the layouts of the sets that will
         // be used in this pipeline. The first element will be set 0, and so on
-        PMesh.init(this, &VMesh, "shaders_c/Shader.vert.spv", "shaders_c/Shader.frag.spv",{&DSLGubo, &DSLMesh});
+        // Push constants: the last array, if present, has the ranges of the per draw data (see ObjectPushConstants)
+        VkPushConstantRange objectPushConstants{VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                                                sizeof(ObjectPushConstants)};
+        PMesh.init(this, &VMesh, "shaders_c/Shader.vert.spv", "shaders_c/Shader.frag.spv",{&DSLGubo, &DSLMesh}, {objectPushConstants});
         PMesh.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
 
-        PMeshMultiTexture.init(this, &VMeshTexID, "shaders_c/ShaderMultiTexture.vert.spv","shaders_c/ShaderMultiTexture.frag.spv", {&DSLGubo, &DSLMeshMultiTex});
+        // GPU culling: furniture and instanced models read their visible objects from the set of the culling
+        if (!drawIndirectFirstInstance) {
+            throw std::runtime_error("GPU culling requires the drawIndirectFirstInstance device feature");
+        }
+        PCull.init(this, "shaders_c/Cull.comp.spv", {&DSLCull});
+        PMeshlets.init(this, "shaders_c/Meshlets.comp.spv", {&DSLCull, &DSLMeshlets});
+
+        PMeshPacked.init(this, &VMeshPacked, "shaders_c/ShaderPacked.vert.spv", "shaders_c/Shader.frag.spv",{&DSLGubo, &DSLMesh, &DSLCull}, {objectPushConstants});
+        PMeshPacked.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
+        // The closed furniture (see meshClosed), whose meshlets are also culled by their normal cone
+        PMeshPackedClosed.init(this, &VMeshPacked, "shaders_c/ShaderPacked.vert.spv", "shaders_c/Shader.frag.spv",{&DSLGubo, &DSLMesh, &DSLCull}, {objectPushConstants});
+        PMeshPackedClosed.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, false);
+
+        PMeshMultiTexture.init(this, &VMeshTexIDPacked, "shaders_c/ShaderMultiTexturePacked.vert.spv","shaders_c/ShaderMultiTexture.frag.spv", {&DSLGubo, &DSLMeshMultiTex}, {objectPushConstants});
         PMeshMultiTexture.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
 
         POverlay.init(this, &VOverlay, "shaders_c/Overlay.vert.spv", "shaders_c/Overlay.frag.spv", {&DSLOverlay});
         POverlay.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
 
-        PVertexWithColors.init(this, &VVertexWithColor, "shaders_c/VColor.vert.spv", "shaders_c/VColor.frag.spv",{&DSLGubo, &DSLVertexWithColors});
+        PVertexWithColors.init(this, &VVertexWithColor, "shaders_c/VColor.vert.spv", "shaders_c/VColor.frag.spv",{&DSLGubo, &DSLVertexWithColors}, {objectPushConstants});
 
-        PMeshInstanced.init(this, &VMeshInstanced, "shaders_c/ShaderInstanced.vert.spv", "shaders_c/ShaderInstanced.frag.spv",{&DSLGubo, &DSLInstance});
+        // The instances are read from the culling objects, not from an instance buffer
+        PMeshInstanced.init(this, &VMesh, "shaders_c/ShaderInstanced.vert.spv", "shaders_c/ShaderInstanced.frag.spv",{&DSLGubo, &DSLInstance, &DSLCull});
         PMeshInstanced.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
 
         // Models, textures and Descriptors (values assigned to the uniforms)
 
-        loadModels("models/furniture", this, &VMesh, &MV, MGCG);
-        loadModels("models/lights", this, &VMesh, &MV, MGCG);
-        MVCharacter = loadCharacter("models/character/character.obj", this, &VMesh, OBJ);
+        // The models read from file are loaded in parallel (file read, decoding, vertex conversion and bounds),
+        // while this thread builds the procedural meshes. Their buffers are created once all of them are ready.
+        JobSystem &jobs = JobSystem::shared();
+        JobCounter modelsLoading;
+
+        std::vector<std::string> modelFiles = listModelFiles("models/furniture");
+        std::vector<std::string> lightModelFiles = listModelFiles("models/lights");
+        modelFiles.insert(modelFiles.end(), lightModelFiles.begin(), lightModelFiles.end());
+        MV.resize(modelFiles.size());
+        for (size_t i = 0; i < modelFiles.size(); i++) {
+            jobs.run(modelsLoading, [this, &modelFiles, i] {
+                // The second parameter is the pointer to the vertex definition for this model
+                // The third parameter is the file name
+                // The fourth is a constant specifying the file type: currently only OBJ or GLTF
+                MV[i].model.load(&VMesh, modelFiles[i], MGCG, &assets);
+                MV[i].model.compressed = true;
+                // Most of the furniture is open or has parts with a single face: only the closed models are drawn
+                // with back faces culled (PMeshPackedClosed), and have normal cones
+                MV[i].model.doubleSided = !meshClosed(MV[i].model.vertices, MV[i].model.indices,
+                                                      vertexMemberOffset(VertexTraits<Vertex>::position));
+                MV[i].model.buildLods();
+                MV[i].model.buildMeshlets();
+            });
+        }
+        jobs.run(modelsLoading, [this] {
+            MVCharacter.model.load(&VMesh, "models/character/character.obj", OBJ, &assets);
+            MVCharacter.model.buildLods();
+        });
+        jobs.run(modelsLoading, [this] {
+            MPolikeaBuilding.load(&VVertexWithColor, "models/polikeaBuilding.obj", OBJ, &assets);
+            MPolikeaBuilding.buildLods();
+        });
+        jobs.run(modelsLoading, [this] {
+            MDoor.load(&VMesh, "models/door_009_Mesh.112.mgcg", MGCG, &assets);
+        });
+        jobs.run(modelsLoading, [this] {
+            MPositionedLights.load(&VMesh, "models/lights/polilamp.mgcg", MGCG, &assets);
+        });
 
         // Creates a mesh with direct enumeration of vertices and indices
         initPolikeaSurroundings(&MPolikeaExternFloor.vertices,&MPolikeaExternFloor.indices,&MFence.vertices,
@@ -320,13 +486,25 @@ protected:
 
         //Procedural (random) generation of the building + lights
         auto floorplan = generateFloorplan(MAX_DIMENSION);
+        roomLightsFirst = static_cast<uint32_t>(positionedLightPos.size());
         floorPlanToVerIndexes(floorplan, MBuilding.vertices, MBuilding.indices, doors, &buildingBoundingRectangle,
-                              &positionedLightPos, &roomCenters, &roomOccupiedArea);
+                              &positionedLightPos, &roomCenters, &roomOccupiedArea, &MBuilding.indexRangeEnds,
+                              &occluders);
+        roomPortals = buildRoomPortals(floorplan);
+        roomRects.assign(floorplan.size(), ScreenRect());
+        roomFrusta.resize(floorplan.size());
+        MBuilding.compressed = true;
         MBuilding.initMesh(this, &VMeshTexID);
+        // Texture streaming: area covered by each texture of the building
+        for (const auto &vertex: MBuilding.vertices) {
+            if (vertex.texID >= buildingTexMin.size()) {
+                buildingTexMin.resize(vertex.texID + 1, glm::vec3(std::numeric_limits<float>::max()));
+                buildingTexMax.resize(vertex.texID + 1, glm::vec3(std::numeric_limits<float>::lowest()));
+            }
+            buildingTexMin[vertex.texID] = glm::min(buildingTexMin[vertex.texID], vertex.pos);
+            buildingTexMax[vertex.texID] = glm::max(buildingTexMax[vertex.texID], vertex.pos);
+        }
 
-        MPolikeaBuilding.init(this, &VVertexWithColor, "models/polikeaBuilding.obj", OBJ);
-
-        MDoor.instanceBufferPresent = true;
         MDoor.instances.reserve(doors.size() + 2);
         // we insert 2 doors for polikea at the end (the others were generated by the floorplan)
         doors.push_back(
@@ -352,56 +530,60 @@ protected:
         for (auto &door: doors) {
             MDoor.instances.push_back({door.baseRot, door.doorPos});
         }
-        MDoor.init(this, &VMeshInstanced, "models/door_009_Mesh.112.mgcg", MGCG);
 
-        MPositionedLights.instanceBufferPresent = true;
         MPositionedLights.instances.reserve(N_POS_LIGHTS);
         for (int i = 0; i < N_POS_LIGHTS; i++) {
             MPositionedLights.instances.push_back({0.0f, positionedLightPos[i]});
         }
-        MPositionedLights.init(this, &VMeshInstanced, "models/lights/polilamp.mgcg", MGCG);
+
+        // Batched upload of the models loaded from file, in the order of the sorted file names
+        jobs.wait(modelsLoading);
+        placeModels(&MV);
+        placeCharacter(MVCharacter);
+        for (auto &mInfo: MV) {
+            mInfo.model.upload(this);
+        }
+        MVCharacter.model.upload(this);
+        MPolikeaBuilding.upload(this);
+        MDoor.upload(this);
+        MPositionedLights.upload(this);
+        initCulling();
+        initScene();
 
         // Create the textures
         // The second parameter is the file name
         TAsphalt.init(this, "textures/Asphalt.jpg");
-        TFurniture.init(this, "textures/Textures_Furniture.png");
         TFence.init(this, "textures/Fence.jpg");
-        TPlankWall.init(this, "textures/plank_wall.jpg");
-        TBathFloor.init(this, "textures/bath_floor.jpg");
-        TDarkFloor.init(this, "textures/dark_floor.jpg");
-        TTiledStones.init(this, "textures/tiled_stones.jpg");
         TOverlayMoveObject.init(this, "textures/MoveBanner.png");
         TOverlayBuyObject.init(this, "textures/BuyObject.png");
-        TCharacter.init(this, "textures/character.png");
+        // Texture streaming: the textures of the building, of the furniture and of the character start from
+        // their smallest levels and are refined as the camera gets close to them (see touchStreamedTextures)
+        TFurniture.initStreaming(this, "textures/Textures_Furniture.png");
+        TPlankWall.initStreaming(this, "textures/plank_wall.jpg");
+        TBathFloor.initStreaming(this, "textures/bath_floor.jpg");
+        TDarkFloor.initStreaming(this, "textures/dark_floor.jpg");
+        TTiledStones.initStreaming(this, "textures/tiled_stones.jpg");
+        TCharacter.initStreaming(this, "textures/character.png");
     }
 
-    inline ModelInfo loadCharacter(const std::string &path, VTemplate *thisVTemplate, VertexDescriptor *VMeshRef, ModelType modelType) {
-        ModelInfo MIChar;
-        MIChar.model.init(thisVTemplate, VMeshRef, path, modelType);
+    inline void placeCharacter(ModelInfo &MIChar) {
         newCharacterPos = MIChar.modelPos = glm::vec3(2.0, 0.0, 3.45706);
         MIChar.modelRot = 0.0f;
 
-        MIChar.minCoords = glm::vec3(std::numeric_limits<float>::max());
-        MIChar.maxCoords = glm::vec3(std::numeric_limits<float>::lowest());
-
-        for (const auto &vertex: MIChar.model.vertices) {
-            MIChar.minCoords = glm::min(MIChar.minCoords, vertex.pos);
-            MIChar.maxCoords = glm::max(MIChar.maxCoords, vertex.pos);
-        }
+        // Bounds are computed by the loader (or read from the asset archive)
+        MIChar.minCoords = MIChar.model.minCoords;
+        MIChar.maxCoords = MIChar.model.maxCoords;
         MIChar.center = (MIChar.minCoords + MIChar.maxCoords) / 2.0f;
         MIChar.size = MIChar.maxCoords - MIChar.minCoords;
 
         MIChar.cylinderRadius = glm::distance(glm::vec3(MIChar.maxCoords.x, 0, MIChar.maxCoords.z),glm::vec3(MIChar.minCoords.x, 0, MIChar.minCoords.z)) / 2;
         MIChar.cylinderHeight = MIChar.maxCoords.y - MIChar.minCoords.y;
-
-        return MIChar;
     }
 
-    inline void loadModels(const std::string &path, VTemplate *thisVTemplate, VertexDescriptor *VMeshRef,
-                           std::vector<ModelInfo> *MVRef, ModelType modelType) {
-        int posOffset = 0;
-        static int polikeaBuildingOffsetsIndex = 0; // Used to count how many objects have been drawn inside polikea
-
+    // Returns the models of a directory sorted by name, so that their placement inside polikea
+    // does not depend on the order in which the file system lists them
+    inline std::vector<std::string> listModelFiles(const std::string &path) {
+        std::vector<std::string> files;
         for (const auto &entry: fs::directory_iterator(path)) {
             // Added this check since in MacOS this hidden file could be created in a directory
             if (static_cast<std::string>(entry.path()).find("DS_Store") != std::string::npos)
@@ -410,11 +592,17 @@ protected:
             if (static_cast<std::string>(entry.path()).find("polilamp") != std::string::npos)
                 continue;
 
-            ModelInfo MI;
-            // The second parameter is the pointer to the vertex definition for this model
-            // The third parameter is the file name
-            // The last is a constant specifying the file type: currently only OBJ or GLTF
-            MI.model.init(thisVTemplate, VMeshRef, entry.path(), modelType);
+            files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // Places the loaded models inside polikea, following their order in MVRef
+    inline void placeModels(std::vector<ModelInfo> *MVRef) {
+        static int polikeaBuildingOffsetsIndex = 0; // Used to count how many objects have been drawn inside polikea
+
+        for (auto &MI: *MVRef) {
             if (polikeaBuildingOffsetsIndex < MAX_OBJECTS_IN_POLIKEA) {
                 MI.modelPos = polikeaBuildingPosition + polikeaBuildingOffsets[polikeaBuildingOffsetsIndex];
                 polikeaBuildingOffsetsIndex++;
@@ -423,13 +611,8 @@ protected:
             }
             MI.modelRot = (MAX_OBJECTS_IN_POLIKEA - polikeaBuildingOffsetsIndex < 3) ? glm::radians(180.0f) : 0.0f;
 
-            MI.minCoords = glm::vec3(std::numeric_limits<float>::max());
-            MI.maxCoords = glm::vec3(std::numeric_limits<float>::lowest());
-
-            for (const auto &vertex: MI.model.vertices) {
-                MI.minCoords = glm::min(MI.minCoords, vertex.pos);
-                MI.maxCoords = glm::max(MI.maxCoords, vertex.pos);
-            }
+            MI.minCoords = MI.model.minCoords;
+            MI.maxCoords = MI.model.maxCoords;
             MI.center = (MI.minCoords + MI.maxCoords) / 2.0f;
             MI.size = MI.maxCoords - MI.minCoords;
 
@@ -437,9 +620,6 @@ protected:
             MI.cylinderHeight = MI.maxCoords.y - MI.minCoords.y;
 
             MI.modelPos += glm::vec3(0.0, -std::min(0.0f, MI.minCoords.y), 0.0);
-
-            MVRef->push_back(MI);
-            posOffset++;
         }
     }
 
@@ -447,10 +627,14 @@ protected:
     void pipelinesAndDescriptorSetsInit() {
         // This creates a new pipeline (with the current surface), using its shaders
         PMesh.create();
+        PMeshPacked.create();
+        PMeshPackedClosed.create();
         PMeshMultiTexture.create();
         POverlay.create();
         PVertexWithColors.create();
         PMeshInstanced.create();
+        PCull.create();
+        PMeshlets.create();
 
         // Here you define the data set
         DSPolikeaExternFloor.init(this, &DSLMesh, {
@@ -478,14 +662,12 @@ protected:
         DSPolikeaBuilding.init(this, &DSLVertexWithColors, {
                 {0, UNIFORM, sizeof(UniformBlock), nullptr}
         });
-        DSDoor.init(this, &DSLInstance, {
-                {0, UNIFORM, sizeof(UniformBlockInstance), nullptr},
-                {1, TEXTURE, 0,                            &TFurniture}
-        });
-        DSPositionedLights.init(this, &DSLInstance, {
+        DSInstanced.init(this, &DSLInstance, {
                 {0, UNIFORM, sizeof(UniformBlockInstance), nullptr},
                 {1, TEXTURE, 0,                            &TFurniture}
         });
+        doorBlock = 0;
+        lightBlock = DSInstanced.addBlock();
         DSBuilding.init(this, &DSLMeshMultiTex, {
                 {0, UNIFORM, sizeof(UniformBlock), nullptr},
                 {1, TEXTURE, 0,                    &TPlankWall,   0},
@@ -495,17 +677,60 @@ protected:
                 {1, TEXTURE, 0,                    &TTiledStones, 4}
         });
 
-        for (auto &mInfo: MV) {
-            mInfo.dsModel.init(this, &DSLMesh, {
-                    {0, UNIFORM, sizeof(UniformBlock), nullptr},
-                    {1, TEXTURE, 0,                    &TFurniture}
-            });
+        // GPU culling: the transforms of the furniture are in DSCull, the rest is the same for all the models
+        DSFurniture.init(this, &DSLMesh, {
+                {0, UNIFORM, sizeof(UniformBlock), nullptr},
+                {1, TEXTURE, 0,                    &TFurniture}
+        });
+        DSCull.init(this, &DSLCull, {
+                {0, UNIFORM, sizeof(CullUniformBlock),                                                nullptr},
+                {1, STORAGE, static_cast<int>(sizeof(CullObject) * cullObjects.size()),                nullptr},
+                {2, STORAGE, static_cast<int>(sizeof(VkDrawIndexedIndirectCommand) * cullCommands.size()), nullptr},
+                {3, STORAGE, static_cast<int>(sizeof(uint32_t) * cullObjects.size()),                  nullptr},
+                {4, STORAGE, static_cast<int>(sizeof(ObjectTransform) * furnitureTransforms.count),   nullptr}
+        });
+        DSMeshlets.init(this, &DSLMeshlets, {
+                {0, STORAGE, static_cast<int>(sizeof(Meshlet) * meshlets.size()),             nullptr},
+                {1, STORAGE, static_cast<int>(sizeof(uint32_t) * meshletIndices.size()),      nullptr},
+                {2, STORAGE, static_cast<int>(sizeof(MeshletWork) * meshlets.size()),         nullptr},
+                {3, STORAGE, static_cast<int>(sizeof(MeshletObject) * meshletObjects.size()), nullptr},
+                {4, STORAGE, static_cast<int>(sizeof(uint32_t) * furnitureIndices),           nullptr}
+        });
+        // The meshlets do not change: they are written once, in the buffers of every swap chain image
+        for (int i = 0; i < static_cast<int>(swapChainImages.size()); i++) {
+            DSMeshlets.map(i, meshlets.data(), static_cast<int>(sizeof(Meshlet) * meshlets.size()), 0);
+            DSMeshlets.map(i, meshletIndices.data(), static_cast<int>(sizeof(uint32_t) * meshletIndices.size()), 1);
         }
 
         MVCharacter.dsModel.init(this, &DSLMesh, {
                 {0, UNIFORM, sizeof(UniformBlock), nullptr},
                 {1, TEXTURE, 0,                    &TCharacter}
         });
+
+        // Push constants: the material does not change, it is written once in the uniforms of every swap chain image
+        for (int i = 0; i < static_cast<int>(swapChainImages.size()); i++) {
+            for (DescriptorSet *DS: {&DSPolikeaExternFloor, &DSFence, &DSPolikeaBuilding, &DSBuilding, &DSFurniture,
+                                     &MVCharacter.dsModel}) {
+                DS->map(i, &material, sizeof(material), 0);
+            }
+        }
+
+        // Scene graph: the buffers are new, everything is written again in the next frame of each image. The
+        // positioned lights never change
+        sceneUploaded.assign(swapChainImages.size(), 0);
+        for (UniformBlockInstance *U: {&uboDoor, &uboPositionedLights}) {
+            U->amb = 0.05f;
+            U->gamma = 180.0f;
+            U->sColor = glm::vec3(1.0f);
+            U->internalLightsFactor = 1.0;
+            U->diffuseLight = 1.0;
+        }
+        for (int i = 0; i < MAXIMUM_INSTANCES_PER_BUFFER; i++) {
+            uboPositionedLights.rotOffsetAndLights[i] = glm::vec4(/* rot = */ 0.0f, /*diffuseLight = */ 0.0f, /* internalLightsFactor = */1.0f, /*unused = */ 0);
+        }
+        for (int i = 0; i < static_cast<int>(swapChainImages.size()); i++) {
+            DSInstanced.map(i, &uboPositionedLights, sizeof(uboPositionedLights), 0, lightBlock);
+        }
     }
 
     // Here you destroy your pipelines and Descriptor Sets!
@@ -513,10 +738,14 @@ protected:
     void pipelinesAndDescriptorSetsCleanup() {
         // Cleanup pipelines
         PMesh.cleanup();
+        PMeshPacked.cleanup();
+        PMeshPackedClosed.cleanup();
         PMeshInstanced.cleanup();
         POverlay.cleanup();
         PVertexWithColors.cleanup();
         PMeshMultiTexture.cleanup();
+        PCull.cleanup();
+        PMeshlets.cleanup();
 
         // Cleanup datasets
         DSPolikeaExternFloor.cleanup();
@@ -524,12 +753,12 @@ protected:
         DSGubo.cleanup();
         DSOverlayMoveObject.cleanup();
         DSPolikeaBuilding.cleanup();
-        DSDoor.cleanup();
-        DSPositionedLights.cleanup();
+        DSInstanced.cleanup();
         DSBuilding.cleanup();
 
-        for (auto &mInfo: MV)
-            mInfo.dsModel.cleanup();
+        DSFurniture.cleanup();
+        DSCull.cleanup();
+        DSMeshlets.cleanup();
         MVCharacter.dsModel.cleanup();
     }
 
@@ -569,13 +798,305 @@ protected:
         DSLOverlay.cleanup();
         DSLVertexWithColors.cleanup();
         DSLInstance.cleanup();
+        DSLCull.cleanup();
+        DSLMeshlets.cleanup();
 
         // Destroys the pipelines
         PMesh.destroy();
+        PMeshPacked.destroy();
+        PMeshPackedClosed.destroy();
         PMeshMultiTexture.destroy();
         POverlay.destroy();
         PVertexWithColors.destroy();
         PMeshInstanced.destroy();
+        PCull.destroy();
+        PMeshlets.destroy();
+    }
+
+    // GPU culling
+    // One indirect command per furniture model, the double sided ones then the closed ones, each group drawn by a
+    // single call, then one for the doors and one for the positioned lights. The instances of each command have their own range of the visible list, starting
+    // from its first instance. The furniture commands draw from the index buffer of DSMeshlets, where each
+    // model has the room for all its indices, filled every frame with those of its visible meshlets.
+    template<class Vert, class Instance>
+    static VkDrawIndexedIndirectCommand drawCommand(const Model<Vert, Instance> &M, uint32_t firstInstance) {
+        VkDrawIndexedIndirectCommand command{};
+        command.indexCount = static_cast<uint32_t>(M.indices.size());
+        command.instanceCount = 0;
+        command.firstIndex = M.firstIndex;
+        command.vertexOffset = M.vertexOffset;
+        command.firstInstance = firstInstance;
+        return command;
+    }
+
+    void initCulling() {
+        cullCommands.clear();
+        meshlets.clear();
+        meshletIndices.clear();
+        furnitureMeshlets.clear();
+        furnitureIndices = 0;
+        std::vector<VkDrawIndexedIndirectCommand> furnitureCommands;
+        for (uint32_t i = 0; i < MV.size(); i++) {
+            const Model<Vertex> &M = MV[i].model;
+            furnitureMeshlets.push_back(static_cast<uint32_t>(meshlets.size()));
+            for (Meshlet m: M.meshlets) {
+                m.firstIndex += static_cast<uint32_t>(meshletIndices.size());
+                meshlets.push_back(m);
+            }
+            meshletIndices.insert(meshletIndices.end(), M.indices.begin(), M.indices.end());
+
+            VkDrawIndexedIndirectCommand command = drawCommand(M, i);
+            command.indexCount = 0;
+            command.firstIndex = furnitureIndices;
+            // Room for the triangles of the full mesh, the most a coarser level can use
+            furnitureIndices += M.lods.empty() ? static_cast<uint32_t>(M.indices.size()) : M.lods[0].indexCount;
+            furnitureCommands.push_back(command);
+        }
+        furnitureMeshlets.push_back(static_cast<uint32_t>(meshlets.size()));
+        furnitureDraws.assign(MV.size(), 0);
+        for (int closed = 0; closed < 2; closed++) {
+            if (closed) {
+                closedFurnitureDraw = static_cast<uint32_t>(cullCommands.size());
+            }
+            for (size_t i = 0; i < MV.size(); i++) {
+                if (MV[i].model.doubleSided == (closed == 0)) {
+                    furnitureDraws[i] = static_cast<uint32_t>(cullCommands.size());
+                    cullCommands.push_back(furnitureCommands[i]);
+                }
+            }
+        }
+        uint32_t firstInstance = static_cast<uint32_t>(MV.size());
+        doorDraw = static_cast<uint32_t>(cullCommands.size());
+        cullCommands.push_back(drawCommand(MDoor, firstInstance));
+        firstInstance += static_cast<uint32_t>(MDoor.instances.size());
+        lightDraw = static_cast<uint32_t>(cullCommands.size());
+        cullCommands.push_back(drawCommand(MPositionedLights, firstInstance));
+        firstInstance += static_cast<uint32_t>(MPositionedLights.instances.size());
+
+        cullObjects.assign(firstInstance, CullObject{});
+        furnitureTransforms.resize(MV.size());
+        cpuCullBoxes.resize(cullObjects.size() + 1);
+        visibleCullObjects.reserve(cullObjects.size());
+        meshletObjects.assign(MV.size(), MeshletObject{});
+        meshletWork.reserve(meshlets.size());
+        // The doors and the lights do not move: only their rotations change, which the bounds already hold
+        cullInstances(MDoor, doorDraw, MV.size());
+        cullInstances(MPositionedLights, lightDraw, MV.size() + MDoor.instances.size());
+    }
+
+    void setPositionedLights(bool off) {
+        positionedLightsOff = off;
+        uint32_t indexPoint = firstPositionedLight;
+        for (int i = 0; i < N_POS_LIGHTS; i++) {
+            for (const auto &light: MPositionedLights.lights) {
+                gubo.pointLights[indexPoint].beta = light.parameters.point.beta;
+                gubo.pointLights[indexPoint].g = light.parameters.point.g;
+                gubo.pointLights[indexPoint].lightPos = glm::vec3(glm::vec4(light.position, 1.0f)) + positionedLightPos[i];
+                gubo.pointLights[indexPoint].lightColor = glm::vec4(off ? glm::vec3(0.0f, 0.0f, 0.0f) : light.lightColor, 1.0f);
+                indexPoint++;
+            }
+        }
+        lightsVersion = scene.serial();
+    }
+
+    // Scene graph: the nodes, the ranges of the lights of each furniture object in GlobalUniformBlock, and what
+    // does not depend on the nodes. Only the character needs the normal matrix of its node: the furniture takes
+    // it from furnitureTransforms, the doors are rotated in the shader
+    void initScene() {
+        scene.clear();
+        uint32_t spot = 0, point = 0;
+        for (auto &mInfo: MV) {
+            scene.add(-1, false);
+            mInfo.firstSpotLight = spot;
+            mInfo.firstPointLight = point;
+            for (const auto &light: mInfo.model.lights) {
+                spot += (light.type == SPOT) ? 1 : 0;
+                point += (light.type == POINT) ? 1 : 0;
+            }
+        }
+        firstPositionedLight = point;
+        point += static_cast<uint32_t>(N_POS_LIGHTS * MPositionedLights.lights.size());
+        gubo.nSpotLights = static_cast<int>(spot);
+        gubo.nPointLights = static_cast<int>(point);
+        setPositionedLights(false);
+        firstDoorNode = static_cast<int>(scene.size());
+        for (size_t d = 0; d < doors.size(); d++) {
+            scene.add(-1, false);
+        }
+        characterNode = scene.add();
+
+        gubo.DlightDir = glm::normalize(glm::vec3(1, 2, 3));
+        gubo.DlightColor = glm::vec3(1.0f);
+        pcPolikeaExternFloor.setWorld(glm::mat4(1.0f));
+        pcFence.setWorld(glm::mat4(1.0f));
+        pcPolikea.setWorld(glm::translate(glm::mat4(1), polikeaBuildingPosition) * glm::scale(glm::mat4(1), glm::vec3(5.0f)));
+        pcPolikea.diffuseLight = 1.0f;
+        pcPolikea.internalLightsFactor = 1.0f;
+        // The building has compressed vertices: its positions are dequantized by the world matrix
+        pcBuilding.worldMat = MBuilding.dequantization;
+        pcBuilding.nMat = glm::mat3x4(1.0f);
+        pcBuilding.diffuseLight = 0.0f;
+        pcBuilding.internalLightsFactor = 1.0f;
+        pcFurniture.diffuseLight = 0.0f;
+        pcFurniture.internalLightsFactor = 1.0f;
+    }
+
+    // Fills the objects of an instanced model: the bounds hold the model whatever its rotation around Y
+    void cullInstances(Model<Vertex, ModelInstance> &M, uint32_t draw, size_t first) {
+        float radius = 0.0f;
+        for (float x: {M.minCoords.x, M.maxCoords.x}) {
+            for (float z: {M.minCoords.z, M.maxCoords.z}) {
+                radius = std::max(radius, std::sqrt(x * x + z * z));
+            }
+        }
+        for (size_t i = 0; i < M.instances.size(); i++) {
+            const ModelInstance &I = M.instances[i];
+            CullObject &O = cullObjects[first + i];
+            O.boundsMin = glm::vec4(I.pos + glm::vec3(-radius, M.minCoords.y, -radius), 0.0f);
+            O.boundsMax = glm::vec4(I.pos + glm::vec3(radius, M.maxCoords.y, radius), 0.0f);
+            O.instanceData = glm::vec4(I.baseRot, I.pos);
+            O.draw = draw;
+            O.instance = static_cast<uint32_t>(i);
+        }
+    }
+
+    // The culling pass: before the render pass, in every command buffer
+    void populateComputeCommands(VkCommandBuffer commandBuffer, int currentImage) {
+        if (visibleCullObjects.empty()) {
+            return;
+        }
+        PCull.bind(commandBuffer);
+        DSCull.bind(commandBuffer, PCull, 0, currentImage);
+        PCull.dispatch(commandBuffer, static_cast<uint32_t>((visibleCullObjects.size() + 63) / 64));
+
+        // Meshlets of the visible furniture, one work group each
+        if (!meshletWork.empty()) {
+            PMeshlets.bind(commandBuffer);
+            DSCull.bind(commandBuffer, PMeshlets, 0, currentImage);
+            DSMeshlets.bind(commandBuffer, PMeshlets, 1, currentImage);
+            PMeshlets.dispatch(commandBuffer, static_cast<uint32_t>(meshletWork.size()));
+        }
+    }
+
+    // CPU culling of the furniture, door and light objects (already filled for this frame) and of the character,
+    // then the compaction of the visible objects for PCull, and of the meshlets of the visible furniture for PMeshlets
+    void cullOnCPU(const Frustum &frustum) {
+        for (size_t i = 0; i < cullObjects.size(); i++) {
+            cpuCullBoxes.set(i, glm::vec3(cullObjects[i].boundsMin), glm::vec3(cullObjects[i].boundsMax));
+        }
+        glm::vec3 characterMin, characterMax;
+        transformBounds(MVCharacter.modelPC.worldMat, MVCharacter.model.minCoords, MVCharacter.model.maxCoords,
+                        characterMin, characterMax);
+        cpuCullBoxes.set(cullObjects.size(), characterMin, characterMax);
+        cpuCullBoxes.cull(frustum, cpuVisible);
+
+        // Objects in the rooms: furniture by its position, doors by the rooms on their sides, one light per room
+        if (cameraRoom >= 0) {
+            auto seenInRoom = [this](int room, size_t i) {
+                return (room >= 0) && !roomRects[room].empty() &&
+                       frustumContainsBounds(roomFrusta[room], glm::vec3(cullObjects[i].boundsMin),
+                                             glm::vec3(cullObjects[i].boundsMax));
+            };
+            for (size_t i = 0; i < MV.size(); i++) {
+                int room = roomAt(MV[i].modelPos);
+                if (cpuVisible[i] && (room >= 0)) {
+                    cpuVisible[i] = seenInRoom(room, i);
+                }
+            }
+            for (size_t d = 0; d < roomPortals.size(); d++) {
+                size_t i = MV.size() + d;
+                if (cpuVisible[i]) {
+                    const Portal &P = roomPortals[d];
+                    cpuVisible[i] = seenInRoom(static_cast<int>(P.cells[0]), i) ||
+                                    seenInRoom(static_cast<int>(P.cells[1]), i);
+                }
+            }
+            size_t firstLight = MV.size() + MDoor.instances.size() + roomLightsFirst;
+            for (size_t r = 0; r < roomRects.size() && firstLight + r < cullObjects.size(); r++) {
+                size_t i = firstLight + r;
+                if (cpuVisible[i]) {
+                    cpuVisible[i] = seenInRoom(static_cast<int>(r), i);
+                }
+            }
+        }
+
+        // Objects behind the occluders (the buffer is rendered by updateUniformBuffer)
+        for (size_t i = 0; i < cullObjects.size(); i++) {
+            if (cpuVisible[i]) {
+                cpuVisible[i] = occlusion.boxVisible(glm::vec3(cullObjects[i].boundsMin),
+                                                     glm::vec3(cullObjects[i].boundsMax));
+            }
+        }
+
+        visibleCullObjects.clear();
+        meshletWork.clear();
+        visibleFurniture = visibleDoors = visibleLights = 0;
+        for (size_t i = 0; i < cullObjects.size(); i++) {
+            if (!cpuVisible[i]) {
+                continue;
+            }
+            visibleCullObjects.push_back(cullObjects[i]);
+            if (i < MV.size()) {
+                const Model<Vertex> &M = MV[i].model;
+                uint32_t lod = std::min(MV[i].lod, static_cast<uint32_t>(M.lodMeshlets.size() - 2));
+                for (uint32_t m = furnitureMeshlets[i] + M.lodMeshlets[lod];
+                     m < furnitureMeshlets[i] + M.lodMeshlets[lod + 1]; m++) {
+                    meshletWork.push_back({m, static_cast<uint32_t>(i)});
+                }
+                visibleFurniture++;
+            } else if (cullObjects[i].draw == doorDraw) {
+                visibleDoors++;
+            } else {
+                visibleLights++;
+            }
+        }
+        characterVisible = cpuVisible[cullObjects.size()] != 0;
+    }
+
+    // Triangles of the meshes with levels of detail drawn in this frame, at their level and in full
+    void countLodTriangles() {
+        lodTrianglesFull = lodTrianglesDrawn = 0;
+        auto count = [this](const std::vector<MeshLod> &lods, uint32_t lod) {
+            if (!lods.empty()) {
+                lodTrianglesFull += lods[0].indexCount / 3;
+                lodTrianglesDrawn += lods[std::min(lod, static_cast<uint32_t>(lods.size() - 1))].indexCount / 3;
+            }
+        };
+        for (size_t i = 0; i < MV.size(); i++) {
+            if (cpuVisible[i]) {
+                count(MV[i].model.lods, MV[i].lod);
+            }
+        }
+        if (characterVisible && isLookAt) {
+            count(MVCharacter.model.lods, MVCharacter.lod);
+        }
+        count(MPolikeaBuilding.lods, polikeaLod);
+    }
+
+    // Room of a point, -1 outside the rooms
+    int roomAt(glm::vec3 pos) {
+        if (pos.y < 0.0f || pos.y > ROOM_CEILING_HEIGHT) {
+            return -1;
+        }
+        for (size_t r = 0; r < roomOccupiedArea.size(); r++) {
+            if (checkIfInBoundingRectangle(pos, roomOccupiedArea[r])) {
+                return static_cast<int>(r);
+            }
+        }
+        return -1;
+    }
+
+    // Rooms seen from the camera, and the frustum through which each one is seen
+    void updateRoomVisibility(const glm::mat4 &ViewPrj, glm::vec3 camPos) {
+        cameraRoom = roomAt(camPos);
+        if (cameraRoom >= 0) {
+            portalVisibility(ViewPrj, static_cast<uint32_t>(cameraRoom), roomPortals, roomRects);
+        } else {
+            std::fill(roomRects.begin(), roomRects.end(), ScreenRect());
+        }
+        for (size_t r = 0; r < roomRects.size(); r++) {
+            roomFrusta[r] = frustumFromViewProjection(ViewPrj, roomRects[r]);
+        }
     }
 
     // Here it is the creation of the command buffer:
@@ -583,6 +1104,42 @@ protected:
     // with their buffers and textures
 
     void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+        for (uint32_t group = 0; group < DRAW_GROUPS; group++) {
+            populateDrawGroup(commandBuffer, currentImage, group);
+        }
+    }
+
+    // Parallel recording: one group per pipeline, each recorded by a job in a secondary command buffer
+    uint32_t drawGroupCount(int) {
+        return DRAW_GROUPS;
+    }
+
+    void populateDrawGroup(VkCommandBuffer commandBuffer, int currentImage, uint32_t group) {
+        switch (group) {
+            case DRAW_BUILDING:
+                drawBuilding(commandBuffer, currentImage);
+                break;
+            case DRAW_MESHES:
+                drawMeshes(commandBuffer, currentImage);
+                break;
+            case DRAW_FURNITURE:
+                drawFurniture(commandBuffer, currentImage);
+                break;
+            case DRAW_OVERLAY:
+                drawOverlay(commandBuffer, currentImage);
+                break;
+            case DRAW_POLIKEA:
+                drawPolikea(commandBuffer, currentImage);
+                break;
+            case DRAW_INSTANCED:
+                drawInstanced(commandBuffer, currentImage);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void drawBuilding(VkCommandBuffer commandBuffer, int currentImage) {
         // binds the pipeline
         // For a pipeline object, this command binds the corresponding pipeline to the command buffer passed in its parameter
         PMeshMultiTexture.bind(commandBuffer);
@@ -596,10 +1153,25 @@ protected:
         // of the current image in the swap chain, passed in its last parameter
         DSGubo.bind(commandBuffer, PMeshMultiTexture, 0, currentImage);
 
+        // Only the visible rooms, consecutive ones with a single call
         DSBuilding.bind(commandBuffer, PMeshMultiTexture, 1, currentImage);
+        PMeshMultiTexture.push(commandBuffer, &pcBuilding, sizeof(pcBuilding));
         MBuilding.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MBuilding.indices.size()), 1, 0, 0, 0);
+        for (size_t r = 0; r < roomRects.size();) {
+            if (roomRects[r].empty()) {
+                r++;
+                continue;
+            }
+            uint32_t begin = (r == 0) ? 0 : MBuilding.indexRangeEnds[r - 1];
+            while (r < roomRects.size() && !roomRects[r].empty()) {
+                r++;
+            }
+            uint32_t end = MBuilding.indexRangeEnds[r - 1];
+            vkCmdDrawIndexed(commandBuffer, end - begin, 1, MBuilding.firstIndex + begin, MBuilding.vertexOffset, 0);
+        }
+    }
 
+    void drawMeshes(VkCommandBuffer commandBuffer, int currentImage) {
         // binds the pipeline
         // For a pipeline object, this command binds the corresponding pipeline to the command buffer passed in its parameter
         PMesh.bind(commandBuffer);
@@ -618,50 +1190,98 @@ protected:
         // For a Model object, this command binds the corresponding index and vertex buffer
         // to the command buffer passed in its parameter
         DSPolikeaExternFloor.bind(commandBuffer, PMesh, 1, currentImage);
+        PMesh.push(commandBuffer, &pcPolikeaExternFloor, sizeof(pcPolikeaExternFloor));
         MPolikeaExternFloor.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MPolikeaExternFloor.indices.size()), 1, 0, 0, 0);
+        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MPolikeaExternFloor.indices.size()), 1,
+                         MPolikeaExternFloor.firstIndex, MPolikeaExternFloor.vertexOffset, 0);
 
         DSFence.bind(commandBuffer, PMesh, 1, currentImage);
+        PMesh.push(commandBuffer, &pcFence, sizeof(pcFence));
         MFence.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MFence.indices.size()), 1, 0, 0, 0);
+        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MFence.indices.size()), 1,
+                         MFence.firstIndex, MFence.vertexOffset, 0);
         // the second parameter is the number of indexes to be drawn. For a Model object,
         // this can be retrieved with the .indices.size() method.
 
-        //--- MODELS ---
-        for (auto &mInfo: MV) {
-            mInfo.dsModel.bind(commandBuffer, PMesh, 1, currentImage);
-            mInfo.model.bind(commandBuffer);
-            vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(mInfo.model.indices.size()), 1, 0, 0, 0);
+        if (characterVisible) {
+            MVCharacter.dsModel.bind(commandBuffer, PMesh, 1, currentImage);
+            PMesh.push(commandBuffer, &MVCharacter.modelPC, sizeof(MVCharacter.modelPC));
+            MVCharacter.model.bind(commandBuffer);
+            const MeshLod &L = MVCharacter.model.lods[MVCharacter.lod];
+            vkCmdDrawIndexed(commandBuffer, L.indexCount, 1, MVCharacter.model.firstIndex + L.firstIndex,
+                             MVCharacter.model.vertexOffset, 0);
         }
+    }
 
-        MVCharacter.dsModel.bind(commandBuffer, PMesh, 1, currentImage);
-        MVCharacter.model.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MVCharacter.model.indices.size()), 1, 0, 0, 0);
+    void drawFurniture(VkCommandBuffer commandBuffer, int currentImage) {
+        //--- MODELS ---
+        // Furniture is drawn with compressed vertices, by the indirect commands written by the culling pass, with
+        // a call for the double sided models and one for the closed ones: all the models are in the same vertex
+        // buffer, and their visible triangles in DSMeshlets
+        VkBuffer cullCommandBuffer = DSCull.buffer(currentImage, 2);
+        const VkDeviceSize commandSize = sizeof(VkDrawIndexedIndirectCommand);
+        uint32_t closedCount = static_cast<uint32_t>(MV.size()) - closedFurnitureDraw;
+        for (Pipeline *P: {&PMeshPacked, &PMeshPackedClosed}) {
+            uint32_t first = (P == &PMeshPacked) ? 0 : closedFurnitureDraw;
+            uint32_t count = (P == &PMeshPacked) ? closedFurnitureDraw : closedCount;
+            if (visibleFurniture == 0 || count == 0) {
+                continue;
+            }
+            P->bind(commandBuffer);
+            DSGubo.bind(commandBuffer, *P, 0, currentImage);
+            DSFurniture.bind(commandBuffer, *P, 1, currentImage);
+            DSCull.bind(commandBuffer, *P, 2, currentImage);
+            P->push(commandBuffer, &pcFurniture, sizeof(pcFurniture));
+            MV[0].model.bind(commandBuffer, DSMeshlets.buffer(currentImage, 4));
+            drawIndexedIndirect(commandBuffer, cullCommandBuffer, first * commandSize, count);
+        }
+    }
 
+    void drawOverlay(VkCommandBuffer commandBuffer, int currentImage) {
         // --- PIPELINE OVERLAY ---
+        // Recorded every frame: nothing to draw while it is hidden
+        if (uboMoveOrBuyOverlay.visible == 0) {
+            return;
+        }
         POverlay.bind(commandBuffer);
         MOverlay.bind(commandBuffer);
         DSOverlayMoveObject.bind(commandBuffer, POverlay, 0, currentImage);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MOverlay.indices.size()), 1, 0, 0, 0);
+        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MOverlay.indices.size()), 1,
+                         MOverlay.firstIndex, MOverlay.vertexOffset, 0);
+    }
 
+    void drawPolikea(VkCommandBuffer commandBuffer, int currentImage) {
         // --- PIPELINE VERTEX WITH COLORS ---
         PVertexWithColors.bind(commandBuffer);
         DSGubo.bind(commandBuffer, PVertexWithColors, 0, currentImage);
         DSPolikeaBuilding.bind(commandBuffer, PVertexWithColors, 1, currentImage);
+        PVertexWithColors.push(commandBuffer, &pcPolikea, sizeof(pcPolikea));
         MPolikeaBuilding.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MPolikeaBuilding.indices.size()), 1, 0, 0, 0);
+        const MeshLod &polikeaLevel = MPolikeaBuilding.lods[polikeaLod];
+        vkCmdDrawIndexed(commandBuffer, polikeaLevel.indexCount, 1, MPolikeaBuilding.firstIndex + polikeaLevel.firstIndex,
+                         MPolikeaBuilding.vertexOffset, 0);
+    }
 
+    void drawInstanced(VkCommandBuffer commandBuffer, int currentImage) {
         //--- PIPELINE INSTANCED ---
+        VkBuffer cullCommandBuffer = DSCull.buffer(currentImage, 2);
+        const VkDeviceSize commandSize = sizeof(VkDrawIndexedIndirectCommand);
         PMeshInstanced.bind(commandBuffer);
         DSGubo.bind(commandBuffer, PMeshInstanced, 0, currentImage);
 
-        DSDoor.bind(commandBuffer, PMeshInstanced, 1, currentImage);
-        MDoor.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MDoor.indices.size()), N_ROOMS - 1 + 2, 0, 0, 0);
+        DSCull.bind(commandBuffer, PMeshInstanced, 2, currentImage);
+
+        if (visibleDoors > 0) {
+            DSInstanced.bind(commandBuffer, PMeshInstanced, 1, currentImage, doorBlock);
+            MDoor.bind(commandBuffer);
+            drawIndexedIndirect(commandBuffer, cullCommandBuffer, doorDraw * commandSize, 1);
+        }
 
-        DSPositionedLights.bind(commandBuffer, PMeshInstanced, 1, currentImage);
-        MPositionedLights.bind(commandBuffer);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MPositionedLights.indices.size()), N_POS_LIGHTS, 0, 0, 0);
+        if (visibleLights > 0) {
+            DSInstanced.bind(commandBuffer, PMeshInstanced, 1, currentImage, lightBlock);
+            MPositionedLights.bind(commandBuffer);
+            drawIndexedIndirect(commandBuffer, cullCommandBuffer, lightDraw * commandSize, 1);
+        }
     }
 
     // Here is where you update the uniforms.
@@ -672,6 +1292,13 @@ protected:
             glfwSetWindowShouldClose(window, GL_TRUE);
         }
 
+        if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+            dumpOcclusion = dumpOcclusion || !occlusionDebounce;
+            occlusionDebounce = true;
+        } else {
+            occlusionDebounce = false;
+        }
+
         // ----- MOVE CAMERA AND OBJECTS LOGIC ----- //
         const float ROT_SPEED = glm::radians(120.0f);
         const float MOVE_SPEED = 4.0f;
@@ -919,7 +1546,7 @@ protected:
 
         // ----- CHARACTER MANIPULATION AND MATRIX GENERATION ----- //
 
-        glm::mat4 World, WorldCharacter, ViewPrj;
+        glm::mat4 WorldCharacter, ViewPrj;
 
         // We check the bounding of the character for surroundings
         for (const auto &boundingRectangle: buildingBoundingRectangle)
@@ -952,14 +1579,28 @@ protected:
 
         // ----- END CHARACTER MANIPULATION AND MATRIX GENERATION ----- //
 
-        gubo.DlightDir = glm::normalize(glm::vec3(1, 2, 3));
-        gubo.DlightColor = glm::vec3(1.0f);
+        // Scene graph: the nodes move only when an object is placed, a door turns or the character walks
+        for (size_t i = 0; i < MV.size(); i++) {
+            scene.set(static_cast<int>(i), MV[i].modelPos, MV[i].modelRot);
+        }
+        for (size_t d = 0; d < doors.size(); d++) {
+            scene.set(firstDoorNode + static_cast<int>(d), doors[d].doorPos, doors[d].doorRot);
+        }
+        scene.set(characterNode, WorldCharacter * glm::scale(glm::mat4(1), (isLookAt) ? glm::vec3(1.5f, 1.8f, 1.5f) : glm::vec3(0.0f)));
+        scene.update();
+
         gubo.eyePos = camPos;
+        gubo.viewPrj = ViewPrj;
 
-        size_t indexSpot = 0;
-        size_t indexPoint = 0;
-        for (auto &modelInfo: MV) {
-            for (auto light: modelInfo.model.lights) {
+        // The lights of the furniture that moved
+        for (size_t i = 0; i < MV.size(); i++) {
+            if (!scene.changed(static_cast<int>(i))) {
+                continue;
+            }
+            const ModelInfo &modelInfo = MV[i];
+            uint32_t indexSpot = modelInfo.firstSpotLight;
+            uint32_t indexPoint = modelInfo.firstPointLight;
+            for (const auto &light: modelInfo.model.lights) {
                 if (light.type == SPOT) {
                     gubo.spotLights[indexSpot].beta = light.parameters.spot.beta;
                     gubo.spotLights[indexSpot].g = light.parameters.spot.g;
@@ -979,42 +1620,29 @@ protected:
                     indexPoint++;
                 }
             }
+            lightsVersion = scene.serial();
+        }
+        if (turnOffLight != positionedLightsOff) {
+            setPositionedLights(turnOffLight);
         }
 
-        for (int i = 0; i < N_POS_LIGHTS; i++) {
-            for (auto light: MPositionedLights.lights) {
-                gubo.pointLights[indexPoint].beta = light.parameters.point.beta;
-                gubo.pointLights[indexPoint].g = light.parameters.point.g;
-                gubo.pointLights[indexPoint].lightPos = glm::vec3(glm::vec4(light.position, 1.0f)) + positionedLightPos[i];
-                gubo.pointLights[indexPoint].lightColor = glm::vec4(turnOffLight ? glm::vec3(0.0f, 0.0f, 0.0f) : light.lightColor, 1.0f);
-                indexPoint++;
-            }
+        // the .map() method of a DataSet object, requires the current image of the swap chain as first parameter
+        // the second parameter is the pointer to the C++ data structure to transfer to the GPU
+        // the third parameter is its size
+        // the fourth parameter is the location inside the descriptor set of this uniform block
+        // The lights are written only to the images that have not seen them yet; the camera goes to all of them
+        if (lightsVersion > sceneUploaded[currentImage] || sceneUploaded[currentImage] == 0) {
+            DSGubo.map(currentImage, &gubo, sizeof(gubo), 0);
+        } else {
+            DSGubo.mapRange(currentImage, &gubo, 0, static_cast<int>(offsetof(GlobalUniformBlock, spotLights)), 0);
         }
-        gubo.nSpotLights = indexSpot;
-        gubo.nPointLights = indexPoint;
-        DSGubo.map(currentImage, &gubo, sizeof(gubo), 0);
-
-        // UBO POLIKEA
-        uboPolikea.amb = 0.05f;
-        uboPolikea.gamma = 180.0f;
-        uboPolikea.sColor = glm::vec3(1.0f);
-        uboPolikea.worldMat = glm::translate(glm::mat4(1), polikeaBuildingPosition) * glm::scale(glm::mat4(1), glm::vec3(5.0f));
-        uboPolikea.nMat = glm::inverse(glm::transpose(uboPolikea.worldMat));
-        uboPolikea.mvpMat = ViewPrj * uboPolikea.worldMat;
-        uboPolikea.diffuseLight = 1.0f;
-        uboPolikea.internalLightsFactor = 1.0f;
-        DSPolikeaBuilding.map(currentImage, &uboPolikea, sizeof(uboPolikea), 0);
-        //END UBO POLIKEA
-
-        uboBuilding.amb = 0.05f;
-        uboBuilding.gamma = 180.0f;
-        uboBuilding.sColor = glm::vec3(1.0f);
-        uboBuilding.worldMat = glm::mat4(1.0f);
-        uboBuilding.nMat = glm::inverse(glm::transpose(uboBuilding.worldMat));
-        uboBuilding.mvpMat = ViewPrj * uboBuilding.worldMat;
-        uboBuilding.diffuseLight = 0.0f;
-        uboBuilding.internalLightsFactor = 1.0f;
-        DSBuilding.map(currentImage, &uboBuilding, sizeof(uboBuilding), 0);
+
+        // POLIKEA
+        polikeaLod = lodSelect(MPolikeaBuilding.lods, lodPixelsPerUnit(ViewPrj, static_cast<float>(swapChainExtent.height),
+                                                                       polikeaBuildingPosition + 5.0f * 0.5f * (MPolikeaBuilding.minCoords + MPolikeaBuilding.maxCoords),
+                                                                       5.0f * 0.5f * glm::length(MPolikeaBuilding.maxCoords - MPolikeaBuilding.minCoords), 5.0f),
+                               polikeaLod);
+        //END POLIKEA
 
         bool displayBuyOrMoveOverlay = false;
         for (auto &modelInfo: MV) {
@@ -1030,82 +1658,134 @@ protected:
         uboMoveOrBuyOverlay.overlayTex = buyOrMoveOverlay ? 1.0f : 0.0f;
         DSOverlayMoveObject.map(currentImage, &uboMoveOrBuyOverlay, sizeof(uboMoveOrBuyOverlay), 0);
 
-        uboPolikeaExternFloor.amb = 0.05f;
-        uboPolikeaExternFloor.gamma = 180.0f;
-        uboPolikeaExternFloor.sColor = glm::vec3(1.0f);
-        uboPolikeaExternFloor.worldMat = glm::mat4(1.0f);
-        uboPolikeaExternFloor.nMat = glm::inverse(glm::transpose(uboPolikeaExternFloor.worldMat));
-        uboPolikeaExternFloor.mvpMat = ViewPrj * uboPolikeaExternFloor.worldMat;
-        // the .map() method of a DataSet object, requires the current image of the swap chain as first parameter
-        // the second parameter is the pointer to the C++ data structure to transfer to the GPU
-        // the third parameter is its size
-        // the fourth parameter is the location inside the descriptor set of this uniform block
-        DSPolikeaExternFloor.map(currentImage, &uboPolikeaExternFloor, sizeof(uboPolikeaExternFloor), 0);
-
-        uboFence.amb = 0.05f;
-        uboFence.gamma = 180.0f;
-        uboFence.sColor = glm::vec3(1.0f);
-        uboFence.worldMat = glm::mat4(1.0f);
-        uboFence.nMat = glm::inverse(glm::transpose(uboFence.worldMat));
-        uboFence.mvpMat = ViewPrj * uboFence.worldMat;
-        DSFence.map(currentImage, &uboFence, sizeof(uboFence), 0);
-
-        uboDoor.amb = 0.05f;
-        uboDoor.gamma = 180.0f;
-        uboDoor.sColor = glm::vec3(1.0f);
-        uboDoor.prjViewMat = ViewPrj;
-        uboDoor.internalLightsFactor = 1.0;
-        uboDoor.diffuseLight = 1.0;
-        //The door in the house receive no light from the outside
-        for (int i = 0; i < N_ROOMS - 1; i++) {
-            uboDoor.rotOffsetAndLights[i] = glm::vec4(doors[i].doorRot, /*diffuseLight = */ 0.0f, /* internalLightsFactor = */1.0f, /*unused = */ 0);
-        }
-        //The two polikea doors have the light
-        for (int i = N_ROOMS - 1; i < N_ROOMS - 1 + 2; i++) {
-            uboDoor.rotOffsetAndLights[i] = glm::vec4(doors[i].doorRot, /*diffuseLight = */ 1.0f, /* internalLightsFactor = */1.0f, /*unused = */ 0);
-        }
-        DSDoor.map(currentImage, &uboDoor, sizeof(uboDoor), 0);
-
-        uboPositionedLights.amb = 0.05f;
-        uboPositionedLights.gamma = 180.0f;
-        uboPositionedLights.sColor = glm::vec3(1.0f);
-        uboPositionedLights.prjViewMat = ViewPrj;
-        uboPositionedLights.internalLightsFactor = 1.0;
-        uboPositionedLights.diffuseLight = 1.0;
-        for (int i = 0; i < MAXIMUM_INSTANCES_PER_BUFFER; i++) {
-            uboPositionedLights.rotOffsetAndLights[i] = glm::vec4(/* rot = */ 0.0f, /*diffuseLight = */ 0.0f, /* internalLightsFactor = */1.0f, /*unused = */ 0);
+        bool doorsMoved = false;
+        for (size_t d = 0; d < doors.size(); d++) {
+            doorsMoved = doorsMoved || scene.changedSince(firstDoorNode + static_cast<int>(d), sceneUploaded[currentImage]);
+        }
+        if (doorsMoved) {
+            //The door in the house receive no light from the outside
+            for (int i = 0; i < N_ROOMS - 1; i++) {
+                uboDoor.rotOffsetAndLights[i] = glm::vec4(doors[i].doorRot, /*diffuseLight = */ 0.0f, /* internalLightsFactor = */1.0f, /*unused = */ 0);
+            }
+            //The two polikea doors have the light
+            for (int i = N_ROOMS - 1; i < N_ROOMS - 1 + 2; i++) {
+                uboDoor.rotOffsetAndLights[i] = glm::vec4(doors[i].doorRot, /*diffuseLight = */ 1.0f, /* internalLightsFactor = */1.0f, /*unused = */ 0);
+            }
+            DSInstanced.map(currentImage, &uboDoor, sizeof(uboDoor), 0, doorBlock);
         }
-        DSPositionedLights.map(currentImage, &uboPositionedLights, sizeof(uboPositionedLights), 0);
 
-        for (auto &mInfo: MV) {
-            World = MakeWorldMatrix(mInfo.modelPos, mInfo.modelRot, glm::vec3(1.0f, 1.0f, 1.0f)) * glm::mat4(1.0f);;
-            mInfo.modelUBO.amb = 0.05f;
-            mInfo.modelUBO.gamma = 180.0f;
-            mInfo.modelUBO.sColor = glm::vec3(1.0f);
-            mInfo.modelUBO.worldMat = World;
-            mInfo.modelUBO.nMat = glm::inverse(glm::transpose(mInfo.modelUBO.worldMat));
-            mInfo.modelUBO.mvpMat = ViewPrj * mInfo.modelUBO.worldMat;
-            mInfo.modelUBO.diffuseLight = 0.0f;
-            mInfo.modelUBO.internalLightsFactor = 1.0f;
-            mInfo.dsModel.map(currentImage, &mInfo.modelUBO, sizeof(mInfo.modelUBO), 0);
-        }
-
-        MVCharacter.modelUBO.amb = 0.05f;
-        MVCharacter.modelUBO.gamma = 180.0f;
-        MVCharacter.modelUBO.sColor = glm::vec3(1.0f);
-        MVCharacter.modelUBO.worldMat = WorldCharacter * glm::scale(glm::mat4(1), (isLookAt) ? glm::vec3(1.5f, 1.8f, 1.5f) : glm::vec3(0.0f));
-        MVCharacter.modelUBO.nMat = glm::inverse(glm::transpose(MVCharacter.modelUBO.worldMat));
-        MVCharacter.modelUBO.mvpMat = ViewPrj * MVCharacter.modelUBO.worldMat;
+        // GPU culling: transforms and world bounds of the furniture that moved (the frustum comes after the character)
+        for (size_t i = 0; i < MV.size(); i++) {
+            ModelInfo &mInfo = MV[i];
+            CullObject &O = cullObjects[i];
+            if (scene.changed(static_cast<int>(i))) {
+                const SceneNode &N = scene[static_cast<int>(i)];
+                // Compressed vertices: the positions are dequantized by the world matrix, the normals are not
+                furnitureTransforms.set(i, mInfo.modelPos, mInfo.modelRot, 1.0f, mInfo.model.dequantization);
+                meshletObjects[i].worldMat = N.world;
+                meshletObjects[i].draw = furnitureDraws[i];
+
+                glm::vec3 boundsMin, boundsMax;
+                transformBounds(N.world, mInfo.model.minCoords, mInfo.model.maxCoords, boundsMin, boundsMax);
+                O.boundsMin = glm::vec4(boundsMin, 0.0f);
+                O.boundsMax = glm::vec4(boundsMax, 0.0f);
+                O.draw = furnitureDraws[i];
+                O.instance = static_cast<uint32_t>(i);
+            }
+
+            glm::vec3 boundsMin(O.boundsMin), boundsMax(O.boundsMax);
+            mInfo.lod = lodSelect(mInfo.model.lods,
+                                  lodPixelsPerUnit(ViewPrj, static_cast<float>(swapChainExtent.height),
+                                                   0.5f * (boundsMin + boundsMax), 0.5f * glm::length(boundsMax - boundsMin)),
+                                  mInfo.lod);
+        }
+
+        if (scene.changed(characterNode)) {
+            const SceneNode &N = scene[characterNode];
+            MVCharacter.modelPC.worldMat = N.world;
+            MVCharacter.modelPC.nMat = glm::mat3x4(N.normal);
+        }
+        if (isLookAt) {
+            glm::vec3 characterCenter = glm::vec3(MVCharacter.modelPC.worldMat *
+                                                  glm::vec4(0.5f * (MVCharacter.model.minCoords + MVCharacter.model.maxCoords), 1.0f));
+            float characterRadius = 1.8f * 0.5f * glm::length(MVCharacter.model.maxCoords - MVCharacter.model.minCoords);
+            MVCharacter.lod = lodSelect(MVCharacter.model.lods,
+                                        lodPixelsPerUnit(ViewPrj, static_cast<float>(swapChainExtent.height),
+                                                         characterCenter, characterRadius, 1.8f),
+                                        MVCharacter.lod);
+        }
 
         bool insideBuilding = isInsideBuilding(characterPos);
 
-        MVCharacter.modelUBO.diffuseLight = insideBuilding ? 0.0f : 1.0f;
-        MVCharacter.modelUBO.internalLightsFactor = insideBuilding ? 1.0f : 0.0f;
-        MVCharacter.dsModel.map(currentImage, &MVCharacter.modelUBO, sizeof(MVCharacter.modelUBO), 0);
+        MVCharacter.modelPC.diffuseLight = insideBuilding ? 0.0f : 1.0f;
+        MVCharacter.modelPC.internalLightsFactor = insideBuilding ? 1.0f : 0.0f;
+
+        Frustum frustum = frustumFromViewProjection(ViewPrj);
+        updateRoomVisibility(ViewPrj, camPos);
+        occlusion.clear(ViewPrj);
+        occlusion.render(occluders);
+        cullOnCPU(frustum);
+        countLodTriangles();
+        lodTitleTime += deltaT;
+        if (lodTitleTime > 0.5f) {
+            lodTitleTime = 0.0f;
+            std::string title = windowTitle + " - LOD: " + std::to_string(lodTrianglesDrawn) + " of " +
+                                std::to_string(lodTrianglesFull) + " triangles";
+            glfwSetWindowTitle(window, title.c_str());
+        }
+        if (dumpOcclusion) {
+            dumpOcclusion = false;
+            occlusion.writePGM("occlusion.pgm");
+            std::cout << "Occlusion: " << occlusion.stats.occluders << " occluders (" << occlusion.stats.triangles
+                      << " triangles), " << occlusion.stats.occluded << " of " << occlusion.stats.tested
+                      << " objects culled, written to occlusion.pgm\n";
+        }
+        for (int i = 0; i < FRUSTUM_PLANES; i++) {
+            uboCull.planes[i] = frustum.planes[i];
+        }
+        uboCull.objectCount = static_cast<uint32_t>(visibleCullObjects.size());
+        uboCull.cameraPos = glm::vec4(camPos, 1.0f);
+        uboCull.meshletWorkCount = static_cast<uint32_t>(meshletWork.size());
+        DSCull.map(currentImage, &uboCull, sizeof(uboCull), 0);
+        DSCull.map(currentImage, visibleCullObjects.data(),
+                   static_cast<int>(sizeof(CullObject) * visibleCullObjects.size()), 1);
+        // The instance counts (and the index counts of the furniture) start from 0 in every frame
+        DSCull.map(currentImage, cullCommands.data(),
+                   static_cast<int>(sizeof(VkDrawIndexedIndirectCommand) * cullCommands.size()), 2);
+        DSMeshlets.map(currentImage, meshletWork.data(), static_cast<int>(sizeof(MeshletWork) * meshletWork.size()), 2);
+        // Scene graph: the furniture changed since the last frame drawn with this image
+        scene.changedSince(sceneUploaded[currentImage], [&](size_t first, size_t end) {
+            end = std::min(end, MV.size());
+            if (first < end) {
+                furnitureTransforms.compute(first, end, reinterpret_cast<ObjectTransform *>(DSCull.data(currentImage, 4)));
+                DSMeshlets.mapRange(currentImage, meshletObjects.data(), static_cast<int>(sizeof(MeshletObject) * first),
+                                    static_cast<int>(sizeof(MeshletObject) * (end - first)), 3);
+            }
+        });
+        sceneUploaded[currentImage] = scene.serial();
+
+        touchStreamedTextures(camPos);
 
         oldCharacterPos = characterPos;
     }
 
+    // Texture streaming: reports the distance from the camera of the nearest user of each streamed texture
+    void touchStreamedTextures(glm::vec3 camPos) {
+        // Same order as the multi texture array of DSBuilding
+        Texture *buildingTextures[] = {&TPlankWall, &TAsphalt, &TBathFloor, &TDarkFloor, &TTiledStones};
+        for (size_t id = 0; id < buildingTexMin.size() && id < 5; id++) {
+            glm::vec3 nearest = glm::clamp(camPos, buildingTexMin[id], buildingTexMax[id]);
+            buildingTextures[id]->touch(glm::distance(camPos, nearest));
+        }
+        for (auto &mInfo: MV) {
+            TFurniture.touch(glm::distance(camPos, mInfo.modelPos + mInfo.center));
+        }
+        // The character is drawn only in the third person view
+        if (isLookAt) {
+            TCharacter.touch(glm::distance(camPos, characterPos));
+        }
+    }
+
     bool isInsideBuilding(glm::vec3 pos) {
         for (auto bounding: roomOccupiedArea)
             if(checkIfInBoundingRectangle(pos, bounding))
@@ -5,6 +5,7 @@
 #ifndef VTEMPLATE_VERTEX_H
 #define VTEMPLATE_VERTEX_H
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
 struct Vertex {
@@ -31,4 +32,80 @@ struct VertexWithTextID {
     uint8_t texID;
 };
 
+// Compressed vertex (see VertexCompression.hpp), 16 bytes instead of 32 (Vertex) or 36 (VertexWithTextID):
+// position quantized to 16 bits inside the bounds of its model (texture ID in the 4th component),
+// octahedral normal, half float UV
+struct VertexPacked {
+    uint16_t pos[4];
+    int16_t norm[2];
+    uint16_t UV[2];
+};
+
+// Vertex traits
+// Compile-time description of the attributes of each vertex struct, as pointers to its members. The Model
+// loaders write the attributes through them, so the conversion loops are specialized for each struct instead
+// of testing the VertexDescriptor and computing offsets for every vertex. A struct used by a Model must have
+// its specialization, and the VertexDescriptor of the Model must agree with it (Model checks it when loading).
+struct VertexTraitsBase {
+    static constexpr bool defined = true;
+    static constexpr bool hasPosition = false;
+    static constexpr bool hasNormal = false;
+    static constexpr bool hasUV = false;
+    static constexpr bool hasColor = false;
+    static constexpr bool hasTangent = false;
+    static constexpr bool hasTexID = false;
+};
+
+template <class Vert>
+struct VertexTraits {
+    static constexpr bool defined = false;
+};
+
+template <>
+struct VertexTraits<Vertex> : VertexTraitsBase {
+    static constexpr bool hasPosition = true;
+    static constexpr bool hasNormal = true;
+    static constexpr bool hasUV = true;
+    static constexpr glm::vec3 Vertex::*position = &Vertex::pos;
+    static constexpr glm::vec3 Vertex::*normal = &Vertex::norm;
+    static constexpr glm::vec2 Vertex::*uv = &Vertex::UV;
+};
+
+// The overlay position is in screen space, it is not a POSITION for the loaders
+template <>
+struct VertexTraits<VertexOverlay> : VertexTraitsBase {
+    static constexpr bool hasUV = true;
+    static constexpr glm::vec2 VertexOverlay::*uv = &VertexOverlay::UV;
+};
+
+template <>
+struct VertexTraits<VertexVColor> : VertexTraitsBase {
+    static constexpr bool hasPosition = true;
+    static constexpr bool hasNormal = true;
+    static constexpr bool hasColor = true;
+    static constexpr glm::vec3 VertexVColor::*position = &VertexVColor::pos;
+    static constexpr glm::vec3 VertexVColor::*normal = &VertexVColor::norm;
+    static constexpr glm::vec3 VertexVColor::*color = &VertexVColor::color;
+};
+
+template <>
+struct VertexTraits<VertexWithTextID> : VertexTraitsBase {
+    static constexpr bool hasPosition = true;
+    static constexpr bool hasNormal = true;
+    static constexpr bool hasUV = true;
+    static constexpr bool hasTexID = true;
+    static constexpr glm::vec3 VertexWithTextID::*position = &VertexWithTextID::pos;
+    static constexpr glm::vec3 VertexWithTextID::*normal = &VertexWithTextID::norm;
+    static constexpr glm::vec2 VertexWithTextID::*uv = &VertexWithTextID::UV;
+    static constexpr uint8_t VertexWithTextID::*texID = &VertexWithTextID::texID;
+};
+
+// Offset of a member, from its pointer
+template <class Vert, class T>
+uint32_t vertexMemberOffset(T Vert::*member) {
+    Vert vertex{};
+    return static_cast<uint32_t>(reinterpret_cast<const char *>(&(vertex.*member)) -
+                                 reinterpret_cast<const char *>(&vertex));
+}
+
 #endif //VTEMPLATE_VERTEX_H
@@ -0,0 +1,82 @@
+#pragma once
+
+// Vertex compression
+// Converts the vertices of a model to VertexPacked, halving the vertex buffer:
+//  - positions are stored as 16 bit UNORM values inside the bounding box of the model; the box is returned
+//    as a dequantization matrix, to be multiplied to the right of the world matrix of the model (the
+//    shader then reads the quantized position as it is, without any extra uniform);
+//  - normals are stored with the octahedral encoding (Cigolle et al. 2014) in two 16 bit SNORM values;
+//  - UVs are stored as half floats (exact for the [0, 1] range up to 1/2048);
+//  - the texture ID, when the vertex has one, takes the 4th component of the position.
+// The normal matrix must be computed from the world matrix before the dequantization is applied.
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Vertex.h"
+
+// Octahedral encoding of a unit vector, in [-1, 1]^2
+inline glm::vec2 octahedralEncode(glm::vec3 n) {
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 <= 0.0f) return glm::vec2(0.0f);
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.0f) {
+        p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return p;
+}
+
+// Same decoding done by the packed vertex shaders
+inline glm::vec3 octahedralDecode(glm::vec2 e) {
+    glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += (n.x >= 0.0f) ? -t : t;
+    n.y += (n.y >= 0.0f) ? -t : t;
+    return glm::normalize(n);
+}
+
+// Packs vertices (any vertex struct with a position in its VertexTraits) and returns the dequantization matrix
+template <class Vert>
+glm::mat4 packVertices(const std::vector<Vert> &vertices, std::vector<VertexPacked> &packed) {
+    using VT = VertexTraits<Vert>;
+    static_assert(VT::hasPosition, "Only vertices with a position can be packed");
+    packed.assign(vertices.size(), VertexPacked{});
+    if (vertices.empty()) return glm::mat4(1.0f);
+
+    glm::vec3 minCoords = vertices[0].*VT::position, maxCoords = minCoords;
+    for (const auto &vertex: vertices) {
+        minCoords = glm::min(minCoords, vertex.*VT::position);
+        maxCoords = glm::max(maxCoords, vertex.*VT::position);
+    }
+    // Flat models keep a non-degenerate matrix
+    glm::vec3 extent = glm::max(maxCoords - minCoords, glm::vec3(1e-6f));
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Vert &vertex = vertices[i];
+        VertexPacked &P = packed[i];
+        glm::vec3 q = glm::clamp((vertex.*VT::position - minCoords) / extent, 0.0f, 1.0f);
+        for (int k = 0; k < 3; k++) {
+            P.pos[k] = static_cast<uint16_t>(std::lround(q[k] * 65535.0f));
+        }
+        if constexpr (VT::hasTexID) {
+            P.pos[3] = static_cast<uint16_t>(vertex.*VT::texID);
+        }
+        if constexpr (VT::hasNormal) {
+            glm::vec2 e = octahedralEncode(vertex.*VT::normal);
+            P.norm[0] = static_cast<int16_t>(std::lround(glm::clamp(e.x, -1.0f, 1.0f) * 32767.0f));
+            P.norm[1] = static_cast<int16_t>(std::lround(glm::clamp(e.y, -1.0f, 1.0f) * 32767.0f));
+        }
+        if constexpr (VT::hasUV) {
+            glm::vec2 uv = vertex.*VT::uv;
+            P.UV[0] = static_cast<uint16_t>(glm::packHalf1x16(uv.x));
+            P.UV[1] = static_cast<uint16_t>(glm::packHalf1x16(uv.y));
+        }
+    }
+
+    return glm::translate(glm::mat4(1.0f), minCoords) * glm::scale(glm::mat4(1.0f), extent);
+}
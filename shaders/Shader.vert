@@ -1,16 +1,18 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(set = 1, binding = 0) uniform UniformBufferObject {
-	float amb;
-	float gamma;
-	vec3 sColor;
-	mat4 mvpMat;
+// Only the view-projection of the global uniforms, which come first (the rest is for the fragment shader)
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewPrj;
+} gubo;
+
+// Push constants: the object being drawn
+layout(push_constant) uniform ObjectPushConstants {
 	mat4 worldMat;
-	mat4 nMat;
+	mat3x4 nMat;
 	float diffuseLightFactor;
 	float internalLightsFactor;
-} ubo;
+} pc;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNorm;
@@ -21,8 +23,9 @@ layout(location = 1) out vec3 fragNorm;
 layout(location = 2) out vec2 outUV;
 
 void main() {
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
-	fragPos = (ubo.worldMat * vec4(inPosition, 1.0)).xyz;
-	fragNorm = (ubo.nMat * vec4(inNorm, 0.0)).xyz;
+	vec4 worldPos = pc.worldMat * vec4(inPosition, 1.0);
+	gl_Position = gubo.viewPrj * worldPos;
+	fragPos = worldPos.xyz;
+	fragNorm = (pc.nMat * inNorm).xyz;
 	outUV = inUV;
 }
\ No newline at end of file
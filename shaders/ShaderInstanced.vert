@@ -4,21 +4,40 @@
 #define N_ROOMS 5
 #define N_POS_LIGHTS 9
 
+// Only the view-projection of the global uniforms: the uniforms of the set change only when a door moves
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewPrj;
+} gubo;
+
 layout(std140, set = 1, binding = 0) uniform UniformBufferObject {
 	float amb;
 	float gamma;
 	vec3 sColor;
-	mat4 prjViewMat;
     vec4 offsetRot[N_ROOMS+4];
 	float diffuseLightFactor;
 	float internalLightsFactor;
 } ubo;
 
+// GPU culling: only the visible instances are drawn, their list is written by Cull.comp
+struct CullObject {
+	vec4 boundsMin;
+	vec4 boundsMax;
+	vec4 instanceData;
+	uint draw;
+	uint instance;
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer CullObjects {
+	CullObject objects[];
+};
+
+layout(std430, set = 2, binding = 3) readonly buffer VisibleObjects {
+	uint visible[];
+};
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNorm;
 layout(location = 2) in vec2 inUV;
-layout(location = 3) in float instanceRot;
-layout(location = 4) in vec3 shift;
 
 layout(location = 0) out vec3 fragPos;
 layout(location = 1) out vec3 fragNorm;
@@ -48,16 +67,21 @@ mat4 shiftMatFun(vec3 shift)
 }
 
 void main() {
-	float x = ubo.offsetRot[gl_InstanceIndex].x;
+	CullObject object = objects[visible[gl_InstanceIndex]];
+	uint instance = object.instance;
+	float instanceRot = object.instanceData.x;
+	vec3 shift = object.instanceData.yzw;
+
+	float x = ubo.offsetRot[instance].x;
 	mat4 rotation = rotationMatrix(vec3(0.0, 1.0, 0.0), instanceRot + x);
 	vec3 rotatedPosition = (rotation * vec4(inPosition, 1.0)).xyz;
 	vec3 rotatedNormal = (rotation * vec4(inNorm, 0.0)).xyz;
 
-	gl_Position = ubo.prjViewMat * vec4(rotatedPosition + shift, 1.0);
+	gl_Position = gubo.viewPrj * vec4(rotatedPosition + shift, 1.0);
 	fragPos = (vec4(rotatedPosition + shift, 1.0)).xyz;
 	fragNorm = (vec4(rotatedNormal, 0.0)).xyz;
 
 	outUV = inUV;
-	diffuseLightFactor = ubo.offsetRot[gl_InstanceIndex].y;
-	internalLightsFactor = ubo.offsetRot[gl_InstanceIndex].z;
+	diffuseLightFactor = ubo.offsetRot[instance].y;
+	internalLightsFactor = ubo.offsetRot[instance].z;
 }
\ No newline at end of file
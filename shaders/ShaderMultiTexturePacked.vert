@@ -0,0 +1,43 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Only the view-projection of the global uniforms, which come first (the rest is for the fragment shader)
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewPrj;
+} gubo;
+
+// Push constants: the object being drawn
+layout(push_constant) uniform ObjectPushConstants {
+	mat4 worldMat;
+	mat3x4 nMat;
+	float diffuseLightFactor;
+	float internalLightsFactor;
+} pc;
+
+// Packed vertices: worldMat includes the dequantization of the positions, nMat does not.
+// The texture ID is in the 4th component of the position.
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNorm;
+layout(location = 2) in vec2 inUV;
+
+layout(location = 0) out vec3 fragPos;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 outUV;
+layout(location = 3) out uint outFragTextureID;
+
+// Octahedral normal decoding (see VertexCompression.hpp)
+vec3 octahedralDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+void main() {
+	vec4 worldPos = pc.worldMat * vec4(inPosition.xyz, 1.0);
+	gl_Position = gubo.viewPrj * worldPos;
+	fragPos = worldPos.xyz;
+	fragNorm = (pc.nMat * octahedralDecode(inNorm)).xyz;
+	outUV = inUV;
+	outFragTextureID = uint(round(inPosition.w * 65535.0));
+}
\ No newline at end of file
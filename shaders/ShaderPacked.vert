@@ -0,0 +1,60 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// GPU culling: the furniture is drawn by indirect commands written by Cull.comp, one per model. The first
+// instance of a command points to the visible list, which gives the object, whose instance is the index of
+// its transforms (they change only when it moves, the view-projection is the one of the frame).
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewPrj;
+} gubo;
+
+struct CullObject {
+	vec4 boundsMin;
+	vec4 boundsMax;
+	vec4 instanceData;
+	uint draw;
+	uint instance;
+};
+
+struct ObjectTransform {
+	mat4 worldMat;
+	mat4 nMat;
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer CullObjects {
+	CullObject objects[];
+};
+
+layout(std430, set = 2, binding = 3) readonly buffer VisibleObjects {
+	uint visible[];
+};
+
+layout(std430, set = 2, binding = 4) readonly buffer ObjectTransforms {
+	ObjectTransform transforms[];
+};
+
+// Packed vertices: worldMat includes the dequantization of the positions, nMat does not
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNorm;
+layout(location = 2) in vec2 inUV;
+
+layout(location = 0) out vec3 fragPos;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 outUV;
+
+// Octahedral normal decoding (see VertexCompression.hpp)
+vec3 octahedralDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+void main() {
+	ObjectTransform t = transforms[objects[visible[gl_InstanceIndex]].instance];
+	vec4 worldPos = t.worldMat * vec4(inPosition.xyz, 1.0);
+	gl_Position = gubo.viewPrj * worldPos;
+	fragPos = worldPos.xyz;
+	fragNorm = (t.nMat * vec4(octahedralDecode(inNorm), 0.0)).xyz;
+	outUV = inUV;
+}